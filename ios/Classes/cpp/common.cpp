@@ -1,4 +1,5 @@
 #include "common.h"
+#include "pipeline_stats.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -8,8 +9,6 @@
 #include <opencv2/imgcodecs.hpp>
 #include <cstdio>
 
-std::mutex _mutex;
-
 
 
 /*
@@ -17,7 +16,7 @@ std::mutex _mutex;
  * The returned data must be freed
  */
 u_char *matToBmp(cv::Mat &img, int32_t *retImgLength) {
-    std::lock_guard<std::mutex> guard(_mutex);
+    STATS_SCOPE(STAGE_ENCODE);
     *retImgLength = 0;
     if (img.empty())
         return nullptr;
@@ -42,7 +41,7 @@ u_char *matToRaw(cv::Mat &img,
                 int32_t *height, 
                 int32_t *bytesPerPixel, 
                 int32_t *retImgLength) {
-    std::lock_guard<std::mutex> guard(_mutex);
+    STATS_SCOPE(STAGE_ENCODE);
     if (img.empty())
         return nullptr;
     int length = img.cols * img.rows * img.channels();
@@ -77,7 +76,7 @@ u_char *matToRaw(cv::Mat &img,
  */
 void resampleMat(cv::Mat &src, ColorSpace colorSpace, double scaleFactor,
                   int32_t rotation, int32_t flip) {
-    std::lock_guard<std::mutex> guard(_mutex);
+    STATS_SCOPE(STAGE_RESAMPLE);
     switch (colorSpace) {
         case SRC_YUV:
             cv::cvtColor(src, src, cv::COLOR_YUV2RGB);
@@ -0,0 +1,110 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#   include <dirent.h>
+#endif
+
+// first number of the file at [path], -1 if it can't be read
+static int64_t readNumber(const std::string &path)
+{
+    std::ifstream in(path);
+    int64_t value = -1;
+    if (!(in >> value)) return -1;
+    return value;
+}
+
+// ids of the cpulist file at [path] (ie. "0-3,6"), empty if it can't be read
+static std::vector<int32_t> readCpuList(const std::string &path)
+{
+    std::vector<int32_t> ids;
+    std::ifstream in(path);
+    std::string list;
+    if (!(in >> list)) return ids;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        size_t dash = range.find('-');
+        int32_t first = std::atoi(range.c_str());
+        int32_t last = dash == std::string::npos
+                ? first : std::atoi(range.c_str() + dash + 1);
+        for (int32_t id = first; id <= last; ++id) ids.push_back(id);
+    }
+    return ids;
+}
+
+// ids of the cpuN directories under [root]
+static std::vector<int32_t> listCpus(const std::string &root)
+{
+    std::vector<int32_t> ids = readCpuList(root + "/present");
+    if (ids.empty()) ids = readCpuList(root + "/possible");
+#ifndef _WIN32
+    if (ids.empty()) {
+        DIR *dir = opendir(root.c_str());
+        if (dir == nullptr) return ids;
+        while (dirent *entry = readdir(dir)) {
+            const char *name = entry->d_name;
+            if (strncmp(name, "cpu", 3) == 0 && isdigit(name[3])
+                    && strspn(name + 3, "0123456789") == strlen(name + 3))
+                ids.push_back(std::atoi(name + 3));
+        }
+        closedir(dir);
+        std::sort(ids.begin(), ids.end());
+    }
+#endif
+    return ids;
+}
+
+CpuTopology readCpuTopology(const std::string &root)
+{
+    CpuTopology topology;
+    for (int32_t id : listCpus(root)) {
+        std::string dir = root + "/cpu" + std::to_string(id);
+        int64_t capacity = readNumber(dir + "/cpu_capacity");
+        if (capacity < 0)
+            capacity = readNumber(dir + "/cpufreq/cpuinfo_max_freq");
+        // ie. an offline cpu without cpufreq: the others are still read
+        if (capacity < 0) continue;
+        topology.cpus.push_back({id, capacity});
+    }
+
+    // no sysfs (ie. iOS, macOS): identical cores
+    if (topology.cpus.empty()) {
+        int32_t n = std::max(1u, std::thread::hardware_concurrency());
+        for (int32_t id = 0; id < n; ++id)
+            topology.cpus.push_back({id, 0});
+    }
+
+    // the fast cores are the ones above the largest ratio between two
+    // consecutive capacities: the big and the mid cores of a 1+3+4 SoC
+    std::vector<int64_t> capacities;
+    for (auto &cpu : topology.cpus) capacities.push_back(cpu.capacity);
+    std::sort(capacities.rbegin(), capacities.rend());
+    capacities.erase(std::unique(capacities.begin(), capacities.end()),
+                     capacities.end());
+    int64_t threshold = capacities.front();
+    double largestGap = 1;
+    for (size_t i = 0; i + 1 < capacities.size(); ++i) {
+        double gap = (double)capacities[i] / std::max<int64_t>(1, capacities[i + 1]);
+        if (gap > largestGap) {
+            largestGap = gap;
+            threshold = capacities[i];
+        }
+    }
+    for (auto &cpu : topology.cpus) {
+        if (cpu.capacity >= threshold)
+            topology.fast.push_back(cpu.id);
+        else
+            topology.slow.push_back(cpu.id);
+    }
+    if (topology.slow.empty())
+        topology.slow = topology.fast;
+    return topology;
+}
@@ -0,0 +1,38 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define CPU_SYSFS_ROOT "/sys/devices/system/cpu"
+
+struct CpuInfo {
+    int32_t id;
+    int64_t capacity;       // relative performance, higher is faster
+};
+
+/*
+ * CPUs of the device split by performance. On big.LITTLE SoCs [fast] holds
+ * the cores above the largest relative step of capacity (ie. the prime
+ * and the mid cores of a 1+3+4 SoC) and [slow] all the others. When all
+ * the cores are the same (or nothing can be read) both hold every core.
+ */
+struct CpuTopology {
+    std::vector<CpuInfo> cpus;
+    std::vector<int32_t> fast;
+    std::vector<int32_t> slow;
+
+    bool heterogeneous() const {return !slow.empty() && slow.size() < cpus.size();}
+};
+
+/*
+ * Read the CPUs under [root]: the ones listed by [root]/present (or
+ * possible, or the cpuN directories). The capacity of a CPU is
+ * cpuN/cpu_capacity, or cpuN/cpufreq/cpuinfo_max_freq on kernels without
+ * it, the CPUs with none of them are left out. [root] can point to a fake
+ * sysfs tree to simulate a topology
+ */
+CpuTopology readCpuTopology(const std::string &root = CPU_SYSFS_ROOT);
+
+#endif // CPU_TOPOLOGY_H
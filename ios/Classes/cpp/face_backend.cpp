@@ -0,0 +1,491 @@
+#include "face_backend.h"
+#include "face_models.h"
+#include "pipeline_stats.h"
+#include "task_scheduler.h"
+
+#include <mutex>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/objdetect.hpp>
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/opencv.h>
+
+// size of the ResNet chips
+static const int RESNET_CHIP_SIZE = 150;
+// size of the SFace chips
+static const int SFACE_CHIP_SIZE = 112;
+// SFace matching threshold of the normalized features (FR_NORM_L2)
+static const double SFACE_L2_THRESHOLD = 1.128;
+// scale of the SFace descriptors: the ResNet threshold applies to them
+static const double SFACE_DESCRIPTOR_SCALE = 0.6 / SFACE_L2_THRESHOLD;
+
+// where FaceRecognizerSF::alignCrop() puts the eyes, nose tip and mouth
+// corners in the 112x112 chip
+static const cv::Point2f SFACE_TEMPLATE[5] = {
+    {38.2946f, 51.6963f}, {73.5318f, 51.5014f}, {56.0252f, 71.7366f},
+    {41.5493f, 92.3655f}, {70.7299f, 92.2041f}
+};
+
+std::vector<dlib::rectangle> detectionRects(
+        const std::vector<dlib::full_object_detection> &faces)
+{
+    std::vector<dlib::rectangle> rects;
+    for (auto &f : faces)
+        rects.push_back(f.get_rect());
+    return rects;
+}
+
+std::vector<dlib::matrix<float,0,1>> RecognizerBackend::descriptors(
+        const std::vector<const dlib::matrix<dlib::rgb_pixel> *> &chips)
+{
+    std::vector<dlib::matrix<float,0,1>> result(chips.size());
+    TaskGroup group;
+    for (size_t i = 0; i < chips.size(); ++i) {
+        group.run([this, i, &chips, &result] () {
+            STATS_SCOPE(STAGE_DESCRIPTOR);
+            result[i] = descriptor(*chips[i]);
+        });
+    }
+    group.wait();
+    return result;
+}
+
+// -------------------------------------------------------------------------
+/// detectors
+
+class HogDetectorBackend : public DetectorBackend
+{
+public:
+    HogDetectorBackend() : m_detector(dlib::get_frontal_face_detector()) {}
+
+    std::vector<dlib::full_object_detection> detect(cv::Mat &rgb) override
+    {
+        std::vector<dlib::full_object_detection> faces;
+        for (auto &r : m_detector(dlib::cv_image<dlib::rgb_pixel>(rgb)))
+            faces.push_back(dlib::full_object_detection(r));
+        return faces;
+    }
+
+    void setPyramidLevels(int32_t levels) override
+    {
+        if (levels < 0) levels = 0;
+        if (levels == m_pyramidLevels) return;
+        m_pyramidLevels = levels;
+
+        // the scanner of a detector can't be changed: build a new one with
+        // the same weights
+        dlib::frontal_face_detector base = dlib::get_frontal_face_detector();
+        if (levels == 0) {
+            m_detector = base;
+            return;
+        }
+        dlib::frontal_face_detector::image_scanner_type scanner;
+        scanner.copy_configuration(base.get_scanner());
+        scanner.set_max_pyramid_levels(levels);
+        std::vector<dlib::frontal_face_detector::feature_vector_type> w;
+        for (unsigned long i = 0; i < base.num_detectors(); ++i)
+            w.push_back(base.get_w(i));
+        m_detector = dlib::frontal_face_detector(scanner, base.get_overlap_tester(), w);
+    }
+
+private:
+    dlib::frontal_face_detector m_detector;
+    int32_t m_pyramidLevels = 0;
+};
+
+class YuNetDetectorBackend : public DetectorBackend
+{
+public:
+    explicit YuNetDetectorBackend(cv::Ptr<cv::FaceDetectorYN> net) : m_net(net) {}
+
+    std::vector<dlib::full_object_detection> detect(cv::Mat &rgb) override
+    {
+        // the input size is fixed until the next call of setInputSize()
+        if (m_net->getInputSize() != rgb.size())
+            m_net->setInputSize(rgb.size());
+        cv::cvtColor(rgb, m_bgr, cv::COLOR_RGB2BGR);
+        cv::Mat found;
+        m_net->detect(m_bgr, found);
+
+        // one row per face: box, 5 landmarks (x, y) and score
+        std::vector<dlib::full_object_detection> faces;
+        for (int i = 0; i < found.rows; ++i) {
+            const float *f = found.ptr<float>(i);
+            std::vector<dlib::point> parts;
+            for (int p = 0; p < 5; ++p)
+                parts.push_back(dlib::point(f[4 + p * 2], f[5 + p * 2]));
+            faces.push_back(dlib::full_object_detection(
+                    dlib::rectangle(f[0], f[1], f[0] + f[2] - 1, f[1] + f[3] - 1),
+                    parts));
+        }
+        return faces;
+    }
+
+private:
+    cv::Ptr<cv::FaceDetectorYN> m_net;
+    cv::Mat m_bgr;
+};
+
+std::unique_ptr<DetectorBackend> createDetectorBackend(const BackendConfig &config)
+{
+    switch (config.detector) {
+        case DETECTOR_BACKEND_HOG:
+            return std::unique_ptr<DetectorBackend>(new HogDetectorBackend());
+        case DETECTOR_BACKEND_YUNET:
+            try {
+                cv::Ptr<cv::FaceDetectorYN> net = cv::FaceDetectorYN::create(
+                        config.detectorModel, "", cv::Size(320, 320));
+                if (net.empty()) return nullptr;
+                return std::unique_ptr<DetectorBackend>(new YuNetDetectorBackend(net));
+            }
+            catch (cv::Exception &e) {
+                return nullptr;
+            }
+        default:
+            return nullptr;
+    }
+}
+
+// -------------------------------------------------------------------------
+/// recognizers
+
+// landmarks of the face [det] from the detector or, if it has none, from [sp]
+static dlib::full_object_detection landmarks(
+        const dlib::cv_image<dlib::rgb_pixel> &frame,
+        const dlib::full_object_detection &det,
+        const FaceShapePredictor *sp)
+{
+    if (det.num_parts() > 0 || sp == nullptr) return det;
+    STATS_SCOPE(STAGE_LANDMARKS);
+    return (*sp)(frame, det.get_rect());
+}
+
+class ResNetRecognizerBackend : public RecognizerBackend
+{
+public:
+    ResNetRecognizerBackend(std::shared_ptr<const FaceShapePredictor> sp,
+                            std::shared_ptr<const facenet::anet_type> net)
+        : m_sp(sp), m_net(net) {}
+
+    bool align(cv::Mat &rgb, const dlib::full_object_detection &det,
+               dlib::full_object_detection &shape,
+               dlib::matrix<dlib::rgb_pixel> &chip) override
+    {
+        // the chips are aligned on the 5 points of the shape predictor,
+        // the landmarks of the detector are not used
+        dlib::cv_image<dlib::rgb_pixel> frame(rgb);
+        shape = landmarks(frame, dlib::full_object_detection(det.get_rect()),
+                          m_sp.get());
+        STATS_SCOPE(STAGE_CHIP);
+        dlib::extract_image_chip(frame,
+                                 dlib::get_face_chip_details(shape, RESNET_CHIP_SIZE, 0.25),
+                                 chip);
+        return true;
+    }
+
+    dlib::matrix<float,0,1> descriptor(
+            const dlib::matrix<dlib::rgb_pixel> &chip) override
+    {
+        std::unique_ptr<facenet::anet_type> n = acquire();
+        dlib::matrix<float,0,1> d = (*n)(chip);
+        release(std::move(n));
+        return d;
+    }
+
+    dlib::matrix<float,0,1> meanDescriptor(
+            const std::vector<dlib::matrix<dlib::rgb_pixel>> &chips) override
+    {
+        std::unique_ptr<facenet::anet_type> n = acquire();
+        dlib::matrix<float,0,1> d;
+        try {
+            d = dlib::mean(dlib::mat((*n)(chips)));
+        }
+        catch (...) {
+            release(std::move(n));
+            throw;
+        }
+        release(std::move(n));
+        return d;
+    }
+
+private:
+    // copies of [m_net] lent to the threads running the network
+    std::unique_ptr<facenet::anet_type> acquire()
+    {
+        std::unique_lock<std::mutex> guard = timedLock(m_mutex);
+        if (m_nets.empty())
+            return std::unique_ptr<facenet::anet_type>(new facenet::anet_type(*m_net));
+        std::unique_ptr<facenet::anet_type> n = std::move(m_nets.back());
+        m_nets.pop_back();
+        return n;
+    }
+
+    void release(std::unique_ptr<facenet::anet_type> n)
+    {
+        std::unique_lock<std::mutex> guard = timedLock(m_mutex);
+        m_nets.push_back(std::move(n));
+    }
+
+    std::shared_ptr<const FaceShapePredictor> m_sp;
+    std::shared_ptr<const facenet::anet_type> m_net;   // never run: only copied
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<facenet::anet_type>> m_nets;
+};
+
+// the ResNet chips, descriptors run by FaceNetEngine
+class EngineRecognizerBackend : public ResNetRecognizerBackend
+{
+public:
+    EngineRecognizerBackend(std::shared_ptr<const FaceShapePredictor> sp,
+                            std::shared_ptr<const facenet::anet_type> net,
+                            std::shared_ptr<const FaceNetEngine> engine)
+        : ResNetRecognizerBackend(sp, net), m_weights(net), m_engine(engine) {}
+
+    dlib::matrix<float,0,1> descriptor(
+            const dlib::matrix<dlib::rgb_pixel> &chip) override
+    {
+        if (chip.nr() != FaceNetEngine::CHIP_SIZE || chip.nc() != FaceNetEngine::CHIP_SIZE)
+            return ResNetRecognizerBackend::descriptor(chip);
+        dlib::matrix<float,0,1> d(FaceNetEngine::DESCRIPTOR_SIZE);
+        std::atomic_load(&m_engine)->run(pixels(chip), &d(0));
+        return d;
+    }
+
+    // the faces in batches: the engine reads the weights once per batch
+    std::vector<dlib::matrix<float,0,1>> descriptors(
+            const std::vector<const dlib::matrix<dlib::rgb_pixel> *> &chips) override
+    {
+        std::vector<const uint8_t *> batch;
+        for (auto chip : chips)
+            if (chip->nr() == FaceNetEngine::CHIP_SIZE && chip->nc() == FaceNetEngine::CHIP_SIZE)
+                batch.push_back(pixels(*chip));
+        if (batch.size() != chips.size())
+            return RecognizerBackend::descriptors(chips);
+
+        std::vector<float> values(batch.size() * FaceNetEngine::DESCRIPTOR_SIZE);
+        {
+            STATS_SCOPE(STAGE_DESCRIPTOR);
+            std::atomic_load(&m_engine)->runBatch(batch.data(), batch.size(), values.data());
+        }
+        std::vector<dlib::matrix<float,0,1>> result(chips.size());
+        for (size_t i = 0; i < result.size(); ++i)
+            result[i] = dlib::mat(&values[i * FaceNetEngine::DESCRIPTOR_SIZE],
+                                  FaceNetEngine::DESCRIPTOR_SIZE, 1);
+        return result;
+    }
+
+    dlib::matrix<float,0,1> meanDescriptor(
+            const std::vector<dlib::matrix<dlib::rgb_pixel>> &chips) override
+    {
+        std::vector<const uint8_t *> batch = chipPixels(chips);
+        if (batch.size() != chips.size())
+            return ResNetRecognizerBackend::meanDescriptor(chips);
+
+        dlib::matrix<float,0,1> sum = dlib::zeros_matrix<float>(FaceNetEngine::DESCRIPTOR_SIZE, 1);
+        std::vector<float> values(batch.size() * FaceNetEngine::DESCRIPTOR_SIZE);
+        std::atomic_load(&m_engine)->runBatch(batch.data(), batch.size(), values.data());
+        for (size_t i = 0; i < batch.size(); ++i)
+            sum += dlib::mat(&values[i * FaceNetEngine::DESCRIPTOR_SIZE],
+                             FaceNetEngine::DESCRIPTOR_SIZE, 1);
+        return chips.empty() ? sum : dlib::matrix<float,0,1>(sum / chips.size());
+    }
+
+    bool setPrecision(int32_t precision,
+                      const std::vector<dlib::matrix<dlib::rgb_pixel>> &calibration,
+                      const std::vector<dlib::matrix<dlib::rgb_pixel>> &heldOut,
+                      float threshold, QuantizationReport &report) override
+    {
+        report = QuantizationReport();
+        report.precision = precision;
+        std::shared_ptr<const FaceNetEngine> reference = faceNetEngine(m_weights);
+        if (!reference) return false;
+        if (precision == ENGINE_PRECISION_FP32) {
+            std::atomic_store(&m_engine, reference);
+            report.applied = 1;
+            return true;
+        }
+        if (precision != ENGINE_PRECISION_INT8) return false;
+
+        std::vector<const uint8_t *> calibrationPixels = chipPixels(calibration);
+        std::vector<const uint8_t *> heldOutPixels = chipPixels(heldOut);
+        report.calibrationChips = calibrationPixels.size();
+        report.heldOutChips = heldOutPixels.size();
+        if (heldOutPixels.size() < 2) return false;
+        std::shared_ptr<const FaceNetEngine> quantized =
+                quantizedFaceNetEngine(m_weights, calibrationPixels);
+        if (!quantized) return false;
+
+        report = checkQuantization(*reference, *quantized, heldOutPixels, threshold);
+        report.calibrationChips = calibrationPixels.size();
+        if (report.flips > 0) return false;
+        std::atomic_store(&m_engine, quantized);
+        report.applied = 1;
+        return true;
+    }
+
+private:
+    static const uint8_t *pixels(const dlib::matrix<dlib::rgb_pixel> &chip)
+    {
+        return reinterpret_cast<const uint8_t *>(&chip(0, 0));
+    }
+
+    // the chips the engine can run
+    static std::vector<const uint8_t *> chipPixels(
+            const std::vector<dlib::matrix<dlib::rgb_pixel>> &chips)
+    {
+        std::vector<const uint8_t *> pixelsOf;
+        for (auto &chip : chips)
+            if (chip.nr() == FaceNetEngine::CHIP_SIZE && chip.nc() == FaceNetEngine::CHIP_SIZE)
+                pixelsOf.push_back(pixels(chip));
+        return pixelsOf;
+    }
+
+    std::shared_ptr<const facenet::anet_type> m_weights;
+    std::shared_ptr<const FaceNetEngine> m_engine;     // atomic
+};
+
+class SFaceRecognizerBackend : public RecognizerBackend
+{
+public:
+    SFaceRecognizerBackend(const std::string &model,
+                           cv::Ptr<cv::FaceRecognizerSF> first,
+                           std::shared_ptr<const FaceShapePredictor> sp)
+        : m_model(model), m_sp(sp)
+    {
+        m_nets.push_back(first);
+    }
+
+    bool align(cv::Mat &rgb, const dlib::full_object_detection &det,
+               dlib::full_object_detection &shape,
+               dlib::matrix<dlib::rgb_pixel> &chip) override
+    {
+        dlib::cv_image<dlib::rgb_pixel> frame(rgb);
+        dlib::full_object_detection points = landmarks(frame, det, m_sp.get());
+
+        // the eyes and nose tip of the template for the points of the
+        // detector (all of them) or of the 5 points shape predictor
+        std::vector<cv::Point2f> src, dst;
+        if (points.num_parts() == 5 && det.num_parts() == 5) {
+            for (unsigned long p = 0; p < 5; ++p) {
+                src.push_back(cv::Point2f(points.part(p).x(), points.part(p).y()));
+                dst.push_back(SFACE_TEMPLATE[p]);
+            }
+            // dlib 5 points layout for faceQuality(): corners of the eye
+            // on the image right, of the other eye, bottom of the nose
+            std::vector<dlib::point> parts = {
+                points.part(1), points.part(1), points.part(0), points.part(0),
+                points.part(2)};
+            shape = dlib::full_object_detection(det.get_rect(), parts);
+        } else if (points.num_parts() == 5) {
+            // the nose of the shape predictor is a bit lower than the tip
+            src.push_back(cv::Point2f((points.part(2).x() + points.part(3).x()) / 2.0f,
+                                      (points.part(2).y() + points.part(3).y()) / 2.0f));
+            src.push_back(cv::Point2f((points.part(0).x() + points.part(1).x()) / 2.0f,
+                                      (points.part(0).y() + points.part(1).y()) / 2.0f));
+            src.push_back(cv::Point2f(points.part(4).x(), points.part(4).y()));
+            dst.assign(SFACE_TEMPLATE, SFACE_TEMPLATE + 3);
+            shape = points;
+        } else {
+            return false;
+        }
+
+        STATS_SCOPE(STAGE_CHIP);
+        cv::Mat warp = cv::estimateAffinePartial2D(src, dst, cv::noArray(), cv::LMEDS);
+        if (warp.empty()) return false;
+        cv::Mat aligned;
+        cv::warpAffine(rgb, aligned, warp, cv::Size(SFACE_CHIP_SIZE, SFACE_CHIP_SIZE),
+                       cv::INTER_LINEAR);
+        dlib::assign_image(chip, dlib::cv_image<dlib::rgb_pixel>(aligned));
+        return true;
+    }
+
+    dlib::matrix<float,0,1> descriptor(
+            const dlib::matrix<dlib::rgb_pixel> &chip) override
+    {
+        cv::Mat bgr, feature;
+        cv::cvtColor(dlib::toMat(const_cast<dlib::matrix<dlib::rgb_pixel> &>(chip)),
+                     bgr, cv::COLOR_RGB2BGR);
+        cv::Ptr<cv::FaceRecognizerSF> n = acquire();
+        try {
+            n->feature(bgr, feature);
+        }
+        catch (...) {
+            release(n);
+            throw;
+        }
+        release(n);
+
+        dlib::matrix<float,0,1> d(feature.total());
+        double norm = cv::norm(feature);
+        for (long i = 0; i < d.size(); ++i)
+            d(i) = norm > 0 ? feature.at<float>(i) * SFACE_DESCRIPTOR_SCALE / norm : 0;
+        return d;
+    }
+
+    dlib::matrix<float,0,1> meanDescriptor(
+            const std::vector<dlib::matrix<dlib::rgb_pixel>> &chips) override
+    {
+        dlib::matrix<float,0,1> sum;
+        for (auto &c : chips) {
+            if (sum.size() == 0) sum = descriptor(c);
+            else sum += descriptor(c);
+        }
+        return chips.empty() ? sum : sum / (float)chips.size();
+    }
+
+private:
+    // the networks can't run on more threads at once: one per thread
+    cv::Ptr<cv::FaceRecognizerSF> acquire()
+    {
+        std::unique_lock<std::mutex> guard = timedLock(m_mutex);
+        if (m_nets.empty()) {
+            guard.unlock();
+            return cv::FaceRecognizerSF::create(m_model, "");
+        }
+        cv::Ptr<cv::FaceRecognizerSF> n = m_nets.back();
+        m_nets.pop_back();
+        return n;
+    }
+
+    void release(cv::Ptr<cv::FaceRecognizerSF> n)
+    {
+        std::unique_lock<std::mutex> guard = timedLock(m_mutex);
+        m_nets.push_back(n);
+    }
+
+    std::string m_model;
+    std::shared_ptr<const FaceShapePredictor> m_sp;
+    std::mutex m_mutex;
+    std::vector<cv::Ptr<cv::FaceRecognizerSF>> m_nets;
+};
+
+std::shared_ptr<RecognizerBackend> createRecognizerBackend(
+        const BackendConfig &config,
+        std::shared_ptr<const FaceShapePredictor> sp,
+        std::shared_ptr<const facenet::anet_type> net)
+{
+    switch (config.recognizer) {
+        case RECOGNIZER_BACKEND_RESNET:
+            if (!sp || !net) return nullptr;
+            return std::make_shared<ResNetRecognizerBackend>(sp, net);
+        case RECOGNIZER_BACKEND_RESNET_ENGINE: {
+            if (!sp || !net) return nullptr;
+            std::shared_ptr<const FaceNetEngine> engine = faceNetEngine(net);
+            if (!engine) return nullptr;
+            return std::make_shared<EngineRecognizerBackend>(sp, net, engine);
+        }
+        case RECOGNIZER_BACKEND_SFACE:
+            try {
+                cv::Ptr<cv::FaceRecognizerSF> first =
+                        cv::FaceRecognizerSF::create(config.recognizerModel, "");
+                if (first.empty()) return nullptr;
+                return std::make_shared<SFaceRecognizerBackend>(
+                        config.recognizerModel, first, sp);
+            }
+            catch (cv::Exception &e) {
+                return nullptr;
+            }
+        default:
+            return nullptr;
+    }
+}
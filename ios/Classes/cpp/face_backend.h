@@ -0,0 +1,137 @@
+#ifndef FACE_BACKEND_H
+#define FACE_BACKEND_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include <dlib/image_processing.h>
+#include "face_net.h"
+#include "face_net_engine.h"
+#include "face_shape_predictor.h"
+
+enum DetectorBackendType {
+    DETECTOR_BACKEND_HOG = 0,       // dlib frontal_face_detector
+    DETECTOR_BACKEND_YUNET,         // OpenCV FaceDetectorYN (ONNX model)
+    DETECTOR_BACKEND_COUNT
+};
+
+enum RecognizerBackendType {
+    RECOGNIZER_BACKEND_RESNET = 0,  // dlib ResNet (facenet::anet_type)
+    RECOGNIZER_BACKEND_SFACE,       // OpenCV FaceRecognizerSF (ONNX model)
+    RECOGNIZER_BACKEND_RESNET_ENGINE,   // dlib ResNet weights run by FaceNetEngine
+    RECOGNIZER_BACKEND_COUNT
+};
+
+/*
+ * The backends used by the pipelines, chosen when the models are loaded.
+ * The ONNX models are read from local files:
+ * face_detection_yunet_*.onnx and face_recognition_sface_*.onnx of the
+ * OpenCV model zoo
+ */
+struct BackendConfig {
+    int32_t detector = DETECTOR_BACKEND_HOG;
+    std::string detectorModel;
+    int32_t recognizer = RECOGNIZER_BACKEND_RESNET;
+    std::string recognizerModel;
+};
+
+/*
+ * Face detector behind FaceDetector and FaceRecognition. An instance is
+ * used by one thread at a time.
+ * The detections are returned with the landmarks of the backend as parts,
+ * if it has them (YuNet: right eye, left eye, nose tip, right and left
+ * mouth corner), without parts otherwise
+ */
+class DetectorBackend
+{
+public:
+    virtual ~DetectorBackend() {}
+
+    // faces in [rgb] (CV_8UC3)
+    virtual std::vector<dlib::full_object_detection> detect(cv::Mat &rgb) = 0;
+
+    /*
+     * QualityGovernor knob: image pyramid levels, 0 = all. Ignored by
+     * the backends without a pyramid
+     */
+    virtual void setPyramidLevels(int32_t /*levels*/) {}
+};
+
+/*
+ * Face alignment and descriptors behind FaceRecognition. Thread safe.
+ * Descriptors of different backends can't be compared with each other
+ * (except RESNET and RESNET_ENGINE, which run the same weights): the
+ * gallery must be filled again after changing backend. They are all
+ * scaled so that two faces of the same person are closer than 0.6
+ */
+class RecognizerBackend
+{
+public:
+    virtual ~RecognizerBackend() {}
+
+    /*
+     * Aligned [chip] of the face [det] found in [rgb] and its [shape]:
+     * dlib 5 points layout, used by faceQuality() and FaceTracker.
+     * Return false if the face can't be aligned
+     */
+    virtual bool align(cv::Mat &rgb, const dlib::full_object_detection &det,
+                       dlib::full_object_detection &shape,
+                       dlib::matrix<dlib::rgb_pixel> &chip) = 0;
+
+    virtual dlib::matrix<float,0,1> descriptor(
+            const dlib::matrix<dlib::rgb_pixel> &chip) = 0;
+
+    /*
+     * Descriptors of the [chips] of different faces, in their order. By
+     * default descriptor() of each chip on the TaskScheduler workers
+     */
+    virtual std::vector<dlib::matrix<float,0,1>> descriptors(
+            const std::vector<const dlib::matrix<dlib::rgb_pixel> *> &chips);
+
+    // mean descriptor of the [chips] of the same face (ie. jittered)
+    virtual dlib::matrix<float,0,1> meanDescriptor(
+            const std::vector<dlib::matrix<dlib::rgb_pixel>> &chips) = 0;
+
+    /*
+     * Compute the descriptors at [precision] (EnginePrecision), calibrated
+     * on the [calibration] chips of align(). Refused, and [report]ed, if
+     * a pair of the [heldOut] chips changes its match decision at
+     * [threshold] (see checkQuantization()). Only RESNET_ENGINE has
+     * another precision than ENGINE_PRECISION_FP32
+     */
+    virtual bool setPrecision(int32_t precision,
+                              const std::vector<dlib::matrix<dlib::rgb_pixel>> &/*calibration*/,
+                              const std::vector<dlib::matrix<dlib::rgb_pixel>> &/*heldOut*/,
+                              float /*threshold*/, QuantizationReport &report)
+    {
+        report = QuantizationReport();
+        report.precision = precision;
+        report.applied = precision == ENGINE_PRECISION_FP32;
+        return report.applied;
+    }
+};
+
+/*
+ * Detection rectangles of [faces]
+ */
+std::vector<dlib::rectangle> detectionRects(
+        const std::vector<dlib::full_object_detection> &faces);
+
+/*
+ * New detector for [config]. Return null if its model can't be loaded
+ */
+std::unique_ptr<DetectorBackend> createDetectorBackend(const BackendConfig &config);
+
+/*
+ * New recognizer for [config]. The dlib 5 points shape predictor [sp]
+ * aligns the faces detected without landmarks, [net] is the ResNet
+ * weights. Return null if a model is missing or can't be loaded
+ */
+std::shared_ptr<RecognizerBackend> createRecognizerBackend(
+        const BackendConfig &config,
+        std::shared_ptr<const FaceShapePredictor> sp,
+        std::shared_ptr<const facenet::anet_type> net);
+
+#endif // FACE_BACKEND_H
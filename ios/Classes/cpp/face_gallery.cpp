@@ -0,0 +1,51 @@
+#include "face_gallery.h"
+
+FaceGallery::FaceGallery()
+    : m_snapshot(std::make_shared<GallerySnapshot>())
+{
+}
+
+void FaceGallery::publish(std::shared_ptr<GallerySnapshot> s)
+{
+    s->version = snapshot()->version + 1;
+    std::atomic_store(&m_snapshot, Snapshot(std::move(s)));
+}
+
+int32_t FaceGallery::add(const std::string &name,
+                         const dlib::matrix<float,0,1> &descriptor,
+                         const dlib::matrix<dlib::rgb_pixel> &chip)
+{
+    std::lock_guard<std::mutex> guard(m_writeMutex);
+    std::shared_ptr<GallerySnapshot> s =
+            std::make_shared<GallerySnapshot>(*snapshot());
+
+    GalleryFace face;
+    face.id = m_nextId++;
+    face.name = name;
+    face.face_descriptor = descriptor;
+    face.faceDlib = chip;
+    s->faces.push_back(std::move(face));
+
+    int32_t id = s->faces.back().id;
+    publish(std::move(s));
+    return id;
+}
+
+int32_t FaceGallery::remove(const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(m_writeMutex);
+    Snapshot current = snapshot();
+    std::shared_ptr<GallerySnapshot> s = std::make_shared<GallerySnapshot>();
+    for (const auto &face : current->faces)
+        if (face.name != name) s->faces.push_back(face);
+
+    int32_t removed = current->faces.size() - s->faces.size();
+    if (removed > 0) publish(std::move(s));
+    return removed;
+}
+
+void FaceGallery::clear()
+{
+    std::lock_guard<std::mutex> guard(m_writeMutex);
+    publish(std::make_shared<GallerySnapshot>());
+}
@@ -0,0 +1,65 @@
+#ifndef FACE_GALLERY_H
+#define FACE_GALLERY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+
+struct GalleryFace {
+    int32_t id;                             // unique id inside the gallery
+    std::string name;
+    dlib::matrix<float,0,1> face_descriptor;
+    dlib::matrix<dlib::rgb_pixel> faceDlib; // chip used to enrol the face
+};
+
+/*
+ * Immutable version of the gallery. Readers keep it alive as long as they
+ * hold the shared_ptr, even if a writer publishes a new version meanwhile.
+ */
+struct GallerySnapshot {
+    uint64_t version = 0;
+    std::vector<GalleryFace> faces;
+};
+
+/*
+ * Known faces with read-copy-update publication: readers grab the current
+ * snapshot without waiting for writers, writers copy the current snapshot,
+ * modify the copy and publish it as a new version.
+ */
+class FaceGallery
+{
+public:
+    typedef std::shared_ptr<const GallerySnapshot> Snapshot;
+
+    FaceGallery();
+
+    Snapshot snapshot() const {return std::atomic_load(&m_snapshot);}
+
+    /*
+     * Add a face and return its id
+     */
+    int32_t add(const std::string &name,
+                const dlib::matrix<float,0,1> &descriptor,
+                const dlib::matrix<dlib::rgb_pixel> &chip);
+
+    /*
+     * Remove all the faces named [name] and return how many were removed
+     */
+    int32_t remove(const std::string &name);
+
+    void clear();
+
+private:
+    void publish(std::shared_ptr<GallerySnapshot> s);
+
+    Snapshot m_snapshot;
+    std::mutex m_writeMutex;    // serializes writers only
+    int32_t m_nextId = 1;
+};
+
+#endif // FACE_GALLERY_H
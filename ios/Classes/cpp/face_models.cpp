@@ -0,0 +1,238 @@
+#include "face_models.h"
+#include "face_net_blob.h"
+#include "shape_predictor_blob.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// visitor of foldAffineLayers()
+class AffineFolder
+{
+public:
+    template <typename T>
+    void fold(T &) const
+    {
+        // not an affine layer over a convolution
+    }
+
+    template <long nf, long nr, long nc, int sy, int sx, int py, int px,
+              typename U, typename E>
+    void fold(dlib::add_layer<dlib::affine_,
+                              dlib::add_layer<dlib::con_<nf, nr, nc, sy, sx, py, px>, U>,
+                              E> &l) const
+    {
+        dlib::affine_ &affine = l.layer_details();
+        if (affine.is_disabled()) return;
+        auto &conv = l.subnet().layer_details();
+        if (conv.bias_is_disabled()) conv.enable_bias();
+
+        // the filters, then one bias per filter
+        const long filters = conv.num_filters();
+        dlib::tensor &params = conv.get_layer_params();
+        const long filterSize = (params.size() - filters) / filters;
+        DLIB_CASSERT(affine.get_gamma().size() == (size_t)filters);
+        const float *gamma = affine.get_gamma().host();
+        const float *beta = affine.get_beta().host();
+        float *p = params.host();
+        float *bias = p + params.size() - filters;
+        for (long n = 0; n < filters; ++n) {
+            float *f = p + n * filterSize;
+            for (long i = 0; i < filterSize; ++i)
+                f[i] *= gamma[n];
+            bias[n] = bias[n] * gamma[n] + beta[n];
+        }
+        affine.disable();
+    }
+
+    template <typename InputLayer>
+    void operator()(size_t, InputLayer &) const {}
+
+    template <typename T, typename U, typename E>
+    void operator()(size_t, dlib::add_layer<T, U, E> &l) const
+    {
+        fold(l);
+    }
+};
+
+// visitor of faceNetEngine(): the weights, from the output to the input
+class EngineReader
+{
+public:
+    EngineReader(std::vector<ConvWeights> &convs, std::vector<float> &fc)
+        : m_convs(convs), m_fc(fc) {}
+
+    template <typename T>
+    void read(const T &) {}
+
+    // the convolutions all have an affine layer over them, folded here if
+    // it is still enabled
+    template <long nf, long nr, long nc, int sy, int sx, int py, int px,
+              typename U, typename E>
+    void read(const dlib::add_layer<dlib::affine_,
+                                    dlib::add_layer<dlib::con_<nf, nr, nc, sy, sx, py, px>, U>,
+                                    E> &l)
+    {
+        const dlib::affine_ &affine = l.layer_details();
+        const auto &conv = l.subnet().layer_details();
+        const dlib::tensor &params = conv.get_layer_params();
+        const long filterSize = (params.size() - nf) / nf;
+
+        ConvWeights w;
+        w.outC = nf;
+        w.inC = filterSize / (nr * nc);
+        w.k = nr;
+        w.stride = sy;
+        w.pad = py;
+        w.filters.assign(params.host(), params.host() + nf * filterSize);
+        if (conv.bias_is_disabled())
+            w.bias.assign(nf, 0.0f);
+        else
+            w.bias.assign(params.host() + nf * filterSize, params.host() + params.size());
+        if (nr != nc || sy != sx || py != px) w.k = 0;     // rejected by the engine
+
+        if (!affine.is_disabled()) {
+            const float *gamma = affine.get_gamma().get().host();
+            const float *beta = affine.get_beta().get().host();
+            for (long n = 0; n < nf; ++n) {
+                for (long i = 0; i < filterSize; ++i)
+                    w.filters[n * filterSize + i] *= gamma[n];
+                w.bias[n] = w.bias[n] * gamma[n] + beta[n];
+            }
+        }
+        m_convs.push_back(std::move(w));
+    }
+
+    template <unsigned long no, typename U, typename E>
+    void read(const dlib::add_layer<dlib::fc_<no, dlib::FC_NO_BIAS>, U, E> &l)
+    {
+        const dlib::tensor &params = l.layer_details().get_layer_params();
+        m_fc.assign(params.host(), params.host() + params.size());
+    }
+
+    template <typename InputLayer>
+    void operator()(size_t, const InputLayer &) {}
+
+    template <typename T, typename U, typename E>
+    void operator()(size_t, const dlib::add_layer<T, U, E> &l)
+    {
+        read(l);
+    }
+
+private:
+    std::vector<ConvWeights> &m_convs;
+    std::vector<float> &m_fc;
+};
+
+} // namespace
+
+void foldAffineLayers(facenet::anet_type &net)
+{
+    // dlib::fuse_layers() does the same but doesn't scale the bias
+    dlib::visit_layers(net, AffineFolder());
+}
+
+std::shared_ptr<const FaceShapePredictor> loadShapePredictor(
+        const char *data, int64_t size)
+{
+    if (data == nullptr || size <= 0) return nullptr;
+    std::shared_ptr<std::vector<char>> blob = std::make_shared<std::vector<char>>();
+    if (isShapePredictorBlob(data, size)) {
+        blob->assign(data, data + size);
+    } else {
+        ShapeBlobOptions options;
+        options.leafEncoding = SHAPE_LEAVES_FP32;
+        if (!packShapePredictor(data, size, options, *blob)) return nullptr;
+    }
+    std::shared_ptr<const FaceShapePredictor> sp =
+            std::make_shared<FaceShapePredictor>(blob->data(), blob->size(), blob);
+    return sp->isValid() ? sp : nullptr;
+}
+
+std::shared_ptr<const FaceShapePredictor> loadShapePredictorFile(const std::string &path)
+{
+    std::shared_ptr<const MappedFile> file = std::make_shared<MappedFile>(path);
+    if (!file->isOpen()) return nullptr;
+    if (!isShapePredictorBlob(file->data(), file->size()))
+        return loadShapePredictor(file->data(), file->size());
+    std::shared_ptr<const FaceShapePredictor> sp =
+            std::make_shared<FaceShapePredictor>(file->data(), file->size(), file);
+    return sp->isValid() ? sp : nullptr;
+}
+
+std::shared_ptr<const facenet::anet_type> loadFaceNet(
+        const char *data, int64_t size, bool fold)
+{
+    if (data == nullptr || size <= 0) return nullptr;
+    std::shared_ptr<facenet::anet_type> net;
+    if (isFaceNetBlob(data, size)) {
+        net = readFaceNetBlob(data, size);
+        if (!net) return nullptr;
+    } else {
+        net = std::make_shared<facenet::anet_type>();
+        std::vector<int8_t> buf(data, data + size);
+        dlib::deserialize(buf) >> *net;
+    }
+    if (fold) foldAffineLayers(*net);
+    return net;
+}
+
+std::shared_ptr<const facenet::anet_type> loadFaceNetFile(
+        const std::string &path, bool fold)
+{
+    MappedFile file(path);
+    if (!file.isOpen()) return nullptr;
+    return loadFaceNet(file.data(), file.size(), fold);
+}
+
+static void readEngineWeights(const facenet::anet_type &net,
+                              std::vector<ConvWeights> &convs,
+                              std::vector<float> &fc)
+{
+    dlib::visit_layers(net, EngineReader(convs, fc));
+    std::reverse(convs.begin(), convs.end());
+}
+
+std::shared_ptr<const FaceNetEngine> faceNetEngine(
+        std::shared_ptr<const facenet::anet_type> net)
+{
+    if (!net) return nullptr;
+
+    // one engine per network while it's in use
+    static std::mutex mutex;
+    static std::weak_ptr<const facenet::anet_type> cachedNet;
+    static std::weak_ptr<const FaceNetEngine> cachedEngine;
+    std::lock_guard<std::mutex> guard(mutex);
+    std::shared_ptr<const FaceNetEngine> engine = cachedEngine.lock();
+    if (engine && cachedNet.lock() == net) return engine;
+
+    std::vector<ConvWeights> convs;
+    std::vector<float> fc;
+    readEngineWeights(*net, convs, fc);
+    engine = std::make_shared<FaceNetEngine>(convs, fc);
+    if (!engine->isValid()) return nullptr;
+    cachedNet = net;
+    cachedEngine = engine;
+    return engine;
+}
+
+std::shared_ptr<const FaceNetEngine> quantizedFaceNetEngine(
+        std::shared_ptr<const facenet::anet_type> net,
+        const std::vector<const uint8_t *> &calibration)
+{
+    std::shared_ptr<const FaceNetEngine> reference = faceNetEngine(net);
+    if (!reference || calibration.empty()) return nullptr;
+
+    std::vector<float> inputRanges;
+    for (const uint8_t *chip : calibration)
+        reference->calibrate(chip, inputRanges);
+    std::vector<ConvWeights> convs;
+    std::vector<float> fc;
+    readEngineWeights(*net, convs, fc);
+    std::shared_ptr<const FaceNetEngine> engine =
+            std::make_shared<FaceNetEngine>(convs, fc, inputRanges);
+    return engine->isValid() ? engine : nullptr;
+}
@@ -0,0 +1,82 @@
+#ifndef FACE_MODELS_H
+#define FACE_MODELS_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dlib/image_processing.h>
+#include "face_net.h"
+#include "face_backend.h"
+#include "face_net_engine.h"
+
+/*
+ * Read-only model weights. They are loaded once and shared by all the
+ * pipelines: FaceShapePredictor can be used by many threads at once and
+ * the recognition network is only copied by the pipelines which run it.
+ */
+struct FaceModels {
+    std::shared_ptr<const FaceShapePredictor> detectorShapePredictor;   // 68 points
+    std::shared_ptr<const FaceShapePredictor> recognizerShapePredictor; // 5 points
+    std::shared_ptr<const facenet::anet_type> net;
+    BackendConfig backends;     // built by every pipeline
+};
+
+/*
+ * Deserialize the model stored in [data]. Return null if [data] is null.
+ * The shape predictor is a dlib .dat model, packed with
+ * SHAPE_LEAVES_FP32 (the same landmarks), or a blob of
+ * shape_predictor_blob.h, copied once. Return null if the blob is invalid.
+ * The network is a dlib .dat model or a blob of face_net_blob.h. Its
+ * affine layers are folded into the convolutions unless [fold] is false
+ * (see foldAffineLayers())
+ */
+std::shared_ptr<const FaceShapePredictor> loadShapePredictor(
+        const char *data, int64_t size);
+
+std::shared_ptr<const facenet::anet_type> loadFaceNet(
+        const char *data, int64_t size, bool fold = true);
+
+/*
+ * loadShapePredictor() of the file at [path], memory mapped: a blob is
+ * read in place, the pages of the leaves when they are reached. Return
+ * null if it can't be read
+ */
+std::shared_ptr<const FaceShapePredictor> loadShapePredictorFile(
+        const std::string &path);
+
+/*
+ * loadFaceNet() of the file at [path], memory mapped: a blob is copied
+ * once, from the page cache to the tensors. Return null if it can't be
+ * read
+ */
+std::shared_ptr<const facenet::anet_type> loadFaceNetFile(
+        const std::string &path, bool fold = true);
+
+/*
+ * Fold every affine layer of [net] into the convolution under it:
+ * gamma scales the filters and the bias, beta is added to the bias, and
+ * the affine layer is disabled. The descriptors are the same up to float
+ * rounding, without the 29 passes of the affine layers over the
+ * activations. [net] must be loaded
+ */
+void foldAffineLayers(facenet::anet_type &net);
+
+/*
+ * FaceNetEngine running the weights of [net], shared by the callers while
+ * it's in use. Return null if [net] is null or not an anet_type
+ */
+std::shared_ptr<const FaceNetEngine> faceNetEngine(
+        std::shared_ptr<const facenet::anet_type> net);
+
+/*
+ * ENGINE_PRECISION_INT8 FaceNetEngine of [net], its activations
+ * calibrated on the [calibration] chips (150x150 RGB, see
+ * FaceNetEngine::run()). Return null if [net] is null or not an
+ * anet_type, or without chips
+ */
+std::shared_ptr<const FaceNetEngine> quantizedFaceNetEngine(
+        std::shared_ptr<const facenet::anet_type> net,
+        const std::vector<const uint8_t *> &calibration);
+
+#endif // FACE_MODELS_H
@@ -0,0 +1,226 @@
+#include "face_net_blob.h"
+
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// visitor of writeFaceNetBlob(): moves the parameters of the layers out
+// of the network, the skeleton is what is left
+class ParamsExtractor
+{
+public:
+    ParamsExtractor(std::vector<FaceNetBlobLayer> &table,
+                    std::vector<std::vector<float>> &params)
+        : m_table(table), m_params(params) {}
+
+    template <typename InputLayer>
+    void operator()(size_t, InputLayer &) {}
+
+    template <typename T, typename U, typename E>
+    void operator()(size_t i, dlib::add_layer<T, U, E> &l)
+    {
+        // the trainable parameters only: the affine layers have none
+        dlib::resizable_tensor *params =
+                dynamic_cast<dlib::resizable_tensor *>(&l.layer_details().get_layer_params());
+        if (params == nullptr || params->size() == 0) return;
+
+        FaceNetBlobLayer entry = {};
+        entry.layer = i;
+        entry.shape[0] = params->num_samples();
+        entry.shape[1] = params->k();
+        entry.shape[2] = params->nr();
+        entry.shape[3] = params->nc();
+        m_table.push_back(entry);
+        m_params.emplace_back(params->host(), params->host() + params->size());
+        params->clear();
+    }
+
+private:
+    std::vector<FaceNetBlobLayer> &m_table;
+    std::vector<std::vector<float>> &m_params;
+};
+
+// a layer of the skeleton which needs parameters, and their geometry
+struct ParamsLayer {
+    size_t layer;
+    dlib::resizable_tensor *params;
+    bool conv;
+    long outputs;           // con_: filters, fc_: outputs
+    long window;            // con_: nr * nc
+    bool bias;
+};
+
+// visitor of readFaceNetBlob(): the con_ and fc_ layers of the skeleton,
+// from the output to the input. The other layers have no parameters
+// (the affine layers keep theirs in the skeleton)
+class ParamsLayers
+{
+public:
+    explicit ParamsLayers(std::vector<ParamsLayer> &layers) : m_layers(layers) {}
+
+    template <typename InputLayer>
+    void operator()(size_t, InputLayer &) {}
+
+    template <typename T, typename U, typename E>
+    void operator()(size_t, dlib::add_layer<T, U, E> &) {}
+
+    template <long nf, long nr, long nc, int sy, int sx, int py, int px,
+              typename U, typename E>
+    void operator()(size_t i, dlib::add_layer<dlib::con_<nf, nr, nc, sy, sx, py, px>, U, E> &l)
+    {
+        auto &d = l.layer_details();
+        m_layers.push_back({i, dynamic_cast<dlib::resizable_tensor *>(&d.get_layer_params()),
+                            true, d.num_filters(), d.nr() * d.nc(), !d.bias_is_disabled()});
+    }
+
+    template <unsigned long no, dlib::fc_bias_mode mode, typename U, typename E>
+    void operator()(size_t i, dlib::add_layer<dlib::fc_<no, mode>, U, E> &l)
+    {
+        auto &d = l.layer_details();
+        m_layers.push_back({i, dynamic_cast<dlib::resizable_tensor *>(&d.get_layer_params()),
+                            false, (long)d.get_num_outputs(), 1,
+                            mode == dlib::FC_HAS_BIAS && !d.bias_is_disabled()});
+    }
+
+private:
+    std::vector<ParamsLayer> &m_layers;
+};
+
+uint64_t align(uint64_t offset)
+{
+    return (offset + FACE_NET_BLOB_ALIGNMENT - 1) / FACE_NET_BLOB_ALIGNMENT
+           * FACE_NET_BLOB_ALIGNMENT;
+}
+
+} // namespace
+
+bool writeFaceNetBlob(const facenet::anet_type &net, std::ostream &out)
+{
+    facenet::anet_type skeleton = net;
+    std::vector<FaceNetBlobLayer> table;
+    std::vector<std::vector<float>> params;
+    dlib::visit_layers(skeleton, ParamsExtractor(table, params));
+    std::ostringstream serialized;
+    dlib::serialize(skeleton, serialized);
+    const std::string skeletonBytes = serialized.str();
+
+    FaceNetBlobHeader header = {};
+    memcpy(header.magic, FACE_NET_BLOB_MAGIC, sizeof(header.magic));
+    header.version = FACE_NET_BLOB_VERSION;
+    header.layerCount = table.size();
+    header.tableOffset = sizeof(header);
+    header.skeletonOffset = header.tableOffset + table.size() * sizeof(FaceNetBlobLayer);
+    header.skeletonSize = skeletonBytes.size();
+    header.dataOffset = align(header.skeletonOffset + header.skeletonSize);
+    uint64_t offset = header.dataOffset;
+    for (size_t i = 0; i < table.size(); ++i) {
+        table[i].offset = offset;
+        offset = align(offset + params[i].size() * sizeof(float));
+    }
+    header.dataSize = offset - header.dataOffset;
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(table.data()),
+              table.size() * sizeof(FaceNetBlobLayer));
+    out.write(skeletonBytes.data(), skeletonBytes.size());
+    uint64_t written = header.skeletonOffset + header.skeletonSize;
+    const char zeros[FACE_NET_BLOB_ALIGNMENT] = {0};
+    for (size_t i = 0; i < table.size(); ++i) {
+        out.write(zeros, table[i].offset - written);
+        out.write(reinterpret_cast<const char *>(params[i].data()),
+                  params[i].size() * sizeof(float));
+        written = table[i].offset + params[i].size() * sizeof(float);
+    }
+    out.write(zeros, header.dataOffset + header.dataSize - written);
+    return (bool)out;
+}
+
+bool isFaceNetBlob(const char *data, int64_t size)
+{
+    return data != nullptr && size >= (int64_t)sizeof(FaceNetBlobHeader)
+           && memcmp(data, FACE_NET_BLOB_MAGIC, 8) == 0;
+}
+
+std::shared_ptr<facenet::anet_type> readFaceNetBlob(const char *data, int64_t size)
+{
+    if (!isFaceNetBlob(data, size)) return nullptr;
+    FaceNetBlobHeader header;
+    memcpy(&header, data, sizeof(header));
+    const uint64_t end = size;
+    // [offset] and [bytes] inside the blob, written without overflow
+    auto inside = [end](uint64_t offset, uint64_t bytes) {
+        return offset <= end && bytes <= end - offset;
+    };
+    if (header.version != FACE_NET_BLOB_VERSION
+            || !inside(header.tableOffset,
+                       (uint64_t)header.layerCount * sizeof(FaceNetBlobLayer))
+            || !inside(header.skeletonOffset, header.skeletonSize)
+            || !inside(header.dataOffset, header.dataSize))
+        return nullptr;
+
+    std::vector<FaceNetBlobLayer> table(header.layerCount);
+    memcpy(table.data(), data + header.tableOffset, table.size() * sizeof(FaceNetBlobLayer));
+    std::vector<uint64_t> counts(table.size());
+    for (size_t i = 0; i < table.size(); ++i) {
+        const FaceNetBlobLayer &entry = table[i];
+        // bounded by the blob before every product: no overflow
+        uint64_t count = 1;
+        for (int32_t d : entry.shape) {
+            if (d < 0 || (d > 0 && count > end / sizeof(float) / (uint64_t)d))
+                return nullptr;
+            count *= d;
+        }
+        counts[i] = count;
+        // in the order of the layers, aligned and without overlap
+        const uint64_t next = i + 1 < table.size() ? table[i + 1].offset
+                                                   : header.dataOffset + header.dataSize;
+        if ((i > 0 && entry.layer <= table[i - 1].layer)
+                || entry.offset % FACE_NET_BLOB_ALIGNMENT != 0
+                || entry.offset < header.dataOffset
+                || entry.offset > next
+                || count > (next - entry.offset) / sizeof(float))
+            return nullptr;
+    }
+
+    std::shared_ptr<facenet::anet_type> net = std::make_shared<facenet::anet_type>();
+    std::vector<int8_t> skeleton(data + header.skeletonOffset,
+                                 data + header.skeletonOffset + header.skeletonSize);
+    dlib::deserialize(skeleton) >> *net;
+
+    // every layer with parameters has its entry, of the size the layer
+    // computes from its input: the channels of the previous con_, from
+    // the 3 of the RGB input. The fc_ input is pooled to 1x1
+    std::vector<ParamsLayer> layers;
+    dlib::visit_layers(*net, ParamsLayers(layers));
+    if (layers.size() != table.size()) return nullptr;
+    long channels = 3;
+    for (size_t i = layers.size(); i-- > 0; ) {
+        const ParamsLayer &layer = layers[i];
+        const FaceNetBlobLayer &entry = table[i];
+        if (layer.params == nullptr || entry.layer != layer.layer) return nullptr;
+        int64_t expected[4];
+        if (layer.conv) {
+            expected[0] = channels * layer.window * layer.outputs
+                          + (layer.bias ? layer.outputs : 0);
+            expected[1] = expected[2] = expected[3] = 1;
+            channels = layer.outputs;
+        } else {
+            expected[0] = channels + (layer.bias ? 1 : 0);
+            expected[1] = layer.outputs;
+            expected[2] = expected[3] = 1;
+            channels = layer.outputs;
+        }
+        for (int d = 0; d < 4; ++d)
+            if (entry.shape[d] != expected[d]) return nullptr;
+    }
+
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const FaceNetBlobLayer &entry = table[i];
+        dlib::resizable_tensor &params = *layers[i].params;
+        params.set_size(entry.shape[0], entry.shape[1], entry.shape[2], entry.shape[3]);
+        memcpy(params.host(), data + entry.offset, counts[i] * sizeof(float));
+    }
+    return net;
+}
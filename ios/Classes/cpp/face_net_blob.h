@@ -0,0 +1,68 @@
+#ifndef FACE_NET_BLOB_H
+#define FACE_NET_BLOB_H
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include "face_net.h"
+
+/*
+ * Flat weight file of the recognition network (.fnb), loaded without
+ * parsing: dlib::deserialize() of the .dat model reads its 5.6M floats one
+ * by one from a copy of the whole file.
+ *
+ * File layout (little endian):
+ *   FaceNetBlobHeader
+ *   the layer table: [layerCount] FaceNetBlobLayer
+ *   the skeleton: the network serialized by dlib without the parameters
+ *   of the layers of the table (a few KB: shapes, settings and the
+ *   affine layers)
+ *   the parameters of the layers of the table, as floats, each one at an
+ *   offset multiple of FACE_NET_BLOB_ALIGNMENT
+ * A layer is loaded with one memcpy from the blob, ie. from its mmap
+ * (see loadFaceNetFile()). Written by face_model_convert
+ * (linux/benchmark)
+ */
+
+#pragma pack(push, 1)
+struct FaceNetBlobHeader {
+    char magic[8];              // FACE_NET_BLOB_MAGIC, not null terminated
+    uint32_t version;           // FACE_NET_BLOB_VERSION
+    uint32_t layerCount;
+    uint64_t tableOffset;
+    uint64_t skeletonOffset;
+    uint64_t skeletonSize;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint8_t reserved[8];
+};
+
+struct FaceNetBlobLayer {
+    uint32_t layer;             // index of the layer for dlib::visit_layers()
+    int32_t shape[4];           // num_samples, k, nr, nc of its parameters
+    uint32_t reserved;
+    uint64_t offset;            // of its floats, from the start of the blob
+};
+#pragma pack(pop)
+
+#define FACE_NET_BLOB_MAGIC "FNETBLOB"
+#define FACE_NET_BLOB_VERSION 1
+#define FACE_NET_BLOB_ALIGNMENT 64
+
+/*
+ * Write the loaded [net] to [out] in the blob format, its affine layers
+ * as they are (see foldAffineLayers()). Return false if it can't be
+ * written
+ */
+bool writeFaceNetBlob(const facenet::anet_type &net, std::ostream &out);
+
+// true if [data] starts with the header of a blob
+bool isFaceNetBlob(const char *data, int64_t size);
+
+/*
+ * Network of the blob [data], which can be released after the call.
+ * Return null if the blob is truncated or doesn't match anet_type
+ */
+std::shared_ptr<facenet::anet_type> readFaceNetBlob(const char *data, int64_t size);
+
+#endif // FACE_NET_BLOB_H
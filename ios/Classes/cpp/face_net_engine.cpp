@@ -0,0 +1,933 @@
+#include "face_net_engine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include "task_scheduler.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ENGINE_NEON
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ENGINE_AVX2
+#endif
+
+// micro-kernel tile: MR output channels x NR output pixels
+static const int MR = 8;
+static const int NR = 8;
+
+// smallest task given to a worker, in multiply-adds
+static const int64_t MIN_TASK_COST = 1 << 17;
+
+// input_rgb_image of dlib: (pixel - mean) / 256
+static const float MEAN_RGB[3] = {122.782f, 117.001f, 104.298f};
+
+// residual blocks of face_net.h from level4 to level0: filters and stride
+// of their first convolution
+static const struct {
+    int filters;
+    int stride;
+} BLOCKS[] = {
+    {32, 1}, {32, 1}, {32, 1},
+    {64, 2}, {64, 1}, {64, 1}, {64, 1},
+    {128, 2}, {128, 1}, {128, 1},
+    {256, 2}, {256, 1}, {256, 1},
+    {256, 2},
+};
+static const int BLOCK_COUNT = sizeof(BLOCKS) / sizeof(BLOCKS[0]);
+
+typedef void (*Kernel)(int K, const float *a, const float *b, float *acc);
+typedef void (*Int8Kernel)(int K4, const int8_t *a, const int8_t *b, int32_t *acc);
+
+// 4 int8 values as one int32, to be broadcast
+static inline int32_t load4(const int8_t *p)
+{
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+#if !defined(ENGINE_NEON)
+/*
+ * [acc] (MR x NR, row major) = [a] (K x MR panel) x [b] (K x NR panel)
+ */
+static void kernelScalar(int K, const float *a, const float *b, float *acc)
+{
+    float c[MR * NR] = {0};
+    for (int k = 0; k < K; ++k, a += MR, b += NR)
+        for (int r = 0; r < MR; ++r)
+            for (int j = 0; j < NR; ++j)
+                c[r * NR + j] += a[r] * b[j];
+    memcpy(acc, c, sizeof(c));
+}
+
+/*
+ * [acc] (MR x NR, row major) = [a] x [b], int8 panels of K4 groups of 4
+ * values: MR x 4 filter values then NR x 4 input values per group
+ */
+static void kernelInt8Scalar(int K4, const int8_t *a, const int8_t *b, int32_t *acc)
+{
+    int32_t c[MR * NR] = {0};
+    for (int k = 0; k < K4; ++k, a += MR * 4, b += NR * 4)
+        for (int r = 0; r < MR; ++r)
+            for (int j = 0; j < NR; ++j)
+                c[r * NR + j] += a[r * 4] * b[j * 4] + a[r * 4 + 1] * b[j * 4 + 1]
+                                 + a[r * 4 + 2] * b[j * 4 + 2] + a[r * 4 + 3] * b[j * 4 + 3];
+    memcpy(acc, c, sizeof(c));
+}
+#endif
+
+#if defined(ENGINE_NEON)
+#if defined(__aarch64__)
+#define FMA_LANE(c, b, a, lane) vfmaq_laneq_f32(c, b, a, lane)
+#else
+#define FMA_LANE(c, b, a, lane) \
+        vmlaq_lane_f32(c, b, (lane) < 2 ? vget_low_f32(a) : vget_high_f32(a), (lane) & 1)
+#endif
+
+static void kernelNeon(int K, const float *a, const float *b, float *acc)
+{
+    float32x4_t c00 = vdupq_n_f32(0), c01 = c00, c10 = c00, c11 = c00,
+                c20 = c00, c21 = c00, c30 = c00, c31 = c00,
+                c40 = c00, c41 = c00, c50 = c00, c51 = c00,
+                c60 = c00, c61 = c00, c70 = c00, c71 = c00;
+    for (int k = 0; k < K; ++k, a += MR, b += NR) {
+        float32x4_t b0 = vld1q_f32(b), b1 = vld1q_f32(b + 4);
+        float32x4_t a0 = vld1q_f32(a), a1 = vld1q_f32(a + 4);
+        c00 = FMA_LANE(c00, b0, a0, 0); c01 = FMA_LANE(c01, b1, a0, 0);
+        c10 = FMA_LANE(c10, b0, a0, 1); c11 = FMA_LANE(c11, b1, a0, 1);
+        c20 = FMA_LANE(c20, b0, a0, 2); c21 = FMA_LANE(c21, b1, a0, 2);
+        c30 = FMA_LANE(c30, b0, a0, 3); c31 = FMA_LANE(c31, b1, a0, 3);
+        c40 = FMA_LANE(c40, b0, a1, 0); c41 = FMA_LANE(c41, b1, a1, 0);
+        c50 = FMA_LANE(c50, b0, a1, 1); c51 = FMA_LANE(c51, b1, a1, 1);
+        c60 = FMA_LANE(c60, b0, a1, 2); c61 = FMA_LANE(c61, b1, a1, 2);
+        c70 = FMA_LANE(c70, b0, a1, 3); c71 = FMA_LANE(c71, b1, a1, 3);
+    }
+    vst1q_f32(acc, c00);      vst1q_f32(acc + 4, c01);
+    vst1q_f32(acc + 8, c10);  vst1q_f32(acc + 12, c11);
+    vst1q_f32(acc + 16, c20); vst1q_f32(acc + 20, c21);
+    vst1q_f32(acc + 24, c30); vst1q_f32(acc + 28, c31);
+    vst1q_f32(acc + 32, c40); vst1q_f32(acc + 36, c41);
+    vst1q_f32(acc + 40, c50); vst1q_f32(acc + 44, c51);
+    vst1q_f32(acc + 48, c60); vst1q_f32(acc + 52, c61);
+    vst1q_f32(acc + 56, c70); vst1q_f32(acc + 60, c71);
+}
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_DOTPROD)
+#define ENGINE_SDOT
+static void kernelInt8Neon(int K4, const int8_t *a, const int8_t *b, int32_t *acc)
+{
+    int32x4_t c00 = vdupq_n_s32(0), c01 = c00, c10 = c00, c11 = c00,
+              c20 = c00, c21 = c00, c30 = c00, c31 = c00,
+              c40 = c00, c41 = c00, c50 = c00, c51 = c00,
+              c60 = c00, c61 = c00, c70 = c00, c71 = c00;
+    for (int k = 0; k < K4; ++k, a += MR * 4, b += NR * 4) {
+        int8x16_t b0 = vld1q_s8(b), b1 = vld1q_s8(b + 16);
+        int8x16_t a0 = vld1q_s8(a), a1 = vld1q_s8(a + 16);
+        c00 = vdotq_laneq_s32(c00, b0, a0, 0); c01 = vdotq_laneq_s32(c01, b1, a0, 0);
+        c10 = vdotq_laneq_s32(c10, b0, a0, 1); c11 = vdotq_laneq_s32(c11, b1, a0, 1);
+        c20 = vdotq_laneq_s32(c20, b0, a0, 2); c21 = vdotq_laneq_s32(c21, b1, a0, 2);
+        c30 = vdotq_laneq_s32(c30, b0, a0, 3); c31 = vdotq_laneq_s32(c31, b1, a0, 3);
+        c40 = vdotq_laneq_s32(c40, b0, a1, 0); c41 = vdotq_laneq_s32(c41, b1, a1, 0);
+        c50 = vdotq_laneq_s32(c50, b0, a1, 1); c51 = vdotq_laneq_s32(c51, b1, a1, 1);
+        c60 = vdotq_laneq_s32(c60, b0, a1, 2); c61 = vdotq_laneq_s32(c61, b1, a1, 2);
+        c70 = vdotq_laneq_s32(c70, b0, a1, 3); c71 = vdotq_laneq_s32(c71, b1, a1, 3);
+    }
+    vst1q_s32(acc, c00);      vst1q_s32(acc + 4, c01);
+    vst1q_s32(acc + 8, c10);  vst1q_s32(acc + 12, c11);
+    vst1q_s32(acc + 16, c20); vst1q_s32(acc + 20, c21);
+    vst1q_s32(acc + 24, c30); vst1q_s32(acc + 28, c31);
+    vst1q_s32(acc + 32, c40); vst1q_s32(acc + 36, c41);
+    vst1q_s32(acc + 40, c50); vst1q_s32(acc + 44, c51);
+    vst1q_s32(acc + 48, c60); vst1q_s32(acc + 52, c61);
+    vst1q_s32(acc + 56, c70); vst1q_s32(acc + 60, c71);
+}
+#else
+// without sdot: int16 products summed by pairs into int32, half of the
+// rows at a time to keep the accumulators in registers
+static void kernelInt8Neon(int K4, const int8_t *a, const int8_t *b, int32_t *acc)
+{
+    for (int half = 0; half < 2; ++half) {
+        // [row][pair of columns]: the sums of 2 values of the 2 columns
+        int32x4_t c[4][4];
+        for (int r = 0; r < 4; ++r)
+            for (int p = 0; p < 4; ++p)
+                c[r][p] = vdupq_n_s32(0);
+        const int8_t *pa = a + half * 16, *pb = b;
+        for (int k = 0; k < K4; ++k, pa += MR * 4, pb += NR * 4) {
+            int8x16_t b0 = vld1q_s8(pb), b1 = vld1q_s8(pb + 16);
+            for (int r = 0; r < 4; ++r) {
+                int8x8_t av = vreinterpret_s8_s32(vdup_n_s32(load4(pa + r * 4)));
+                c[r][0] = vpadalq_s16(c[r][0], vmull_s8(vget_low_s8(b0), av));
+                c[r][1] = vpadalq_s16(c[r][1], vmull_s8(vget_high_s8(b0), av));
+                c[r][2] = vpadalq_s16(c[r][2], vmull_s8(vget_low_s8(b1), av));
+                c[r][3] = vpadalq_s16(c[r][3], vmull_s8(vget_high_s8(b1), av));
+            }
+        }
+        for (int r = 0; r < 4; ++r)
+            for (int p = 0; p < 4; ++p)
+                vst1_s32(acc + (half * 4 + r) * NR + p * 2,
+                         vpadd_s32(vget_low_s32(c[r][p]), vget_high_s32(c[r][p])));
+    }
+}
+#endif
+#endif
+
+#if defined(ENGINE_AVX2)
+// built for AVX2 whatever the flags of the build, only called when the
+// CPU has it
+__attribute__((target("avx2,fma")))
+static void kernelAvx2(int K, const float *a, const float *b, float *acc)
+{
+    __m256 c0 = _mm256_setzero_ps(), c1 = c0, c2 = c0, c3 = c0,
+           c4 = c0, c5 = c0, c6 = c0, c7 = c0;
+    for (int k = 0; k < K; ++k, a += MR, b += NR) {
+        __m256 bv = _mm256_loadu_ps(b);
+        c0 = _mm256_fmadd_ps(_mm256_broadcast_ss(a), bv, c0);
+        c1 = _mm256_fmadd_ps(_mm256_broadcast_ss(a + 1), bv, c1);
+        c2 = _mm256_fmadd_ps(_mm256_broadcast_ss(a + 2), bv, c2);
+        c3 = _mm256_fmadd_ps(_mm256_broadcast_ss(a + 3), bv, c3);
+        c4 = _mm256_fmadd_ps(_mm256_broadcast_ss(a + 4), bv, c4);
+        c5 = _mm256_fmadd_ps(_mm256_broadcast_ss(a + 5), bv, c5);
+        c6 = _mm256_fmadd_ps(_mm256_broadcast_ss(a + 6), bv, c6);
+        c7 = _mm256_fmadd_ps(_mm256_broadcast_ss(a + 7), bv, c7);
+    }
+    _mm256_storeu_ps(acc, c0);
+    _mm256_storeu_ps(acc + 8, c1);
+    _mm256_storeu_ps(acc + 16, c2);
+    _mm256_storeu_ps(acc + 24, c3);
+    _mm256_storeu_ps(acc + 32, c4);
+    _mm256_storeu_ps(acc + 40, c5);
+    _mm256_storeu_ps(acc + 48, c6);
+    _mm256_storeu_ps(acc + 56, c7);
+}
+
+// the inputs are the unsigned operand of maddubs: with 7 bits their
+// int16 sums of pairs can't saturate
+__attribute__((target("avx2,fma")))
+static void kernelInt8Avx2(int K4, const int8_t *a, const int8_t *b, int32_t *acc)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i c[MR];
+    for (int r = 0; r < MR; ++r)
+        c[r] = _mm256_setzero_si256();
+    for (int k = 0; k < K4; ++k, a += MR * 4, b += NR * 4) {
+        __m256i bv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+        for (int r = 0; r < MR; ++r) {
+            __m256i pairs = _mm256_maddubs_epi16(bv, _mm256_set1_epi32(load4(a + r * 4)));
+            c[r] = _mm256_add_epi32(c[r], _mm256_madd_epi16(pairs, ones));
+        }
+    }
+    for (int r = 0; r < MR; ++r)
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + r * NR), c[r]);
+}
+
+static bool hasAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+static Kernel pickKernel(const char **name)
+{
+#if defined(ENGINE_NEON)
+    *name = "neon";
+    return kernelNeon;
+#else
+#if defined(ENGINE_AVX2)
+    if (hasAvx2()) {
+        *name = "avx2";
+        return kernelAvx2;
+    }
+#endif
+    *name = "scalar";
+    return kernelScalar;
+#endif
+}
+
+static Int8Kernel pickInt8Kernel(const char **name)
+{
+#if defined(ENGINE_NEON)
+#if defined(ENGINE_SDOT)
+    *name = "neon-sdot";
+#else
+    *name = "neon-int8";
+#endif
+    return kernelInt8Neon;
+#else
+#if defined(ENGINE_AVX2)
+    if (hasAvx2()) {
+        *name = "avx2-int8";
+        return kernelInt8Avx2;
+    }
+#endif
+    *name = "scalar-int8";
+    return kernelInt8Scalar;
+#endif
+}
+
+static const char *s_kernelName = nullptr;
+static const Kernel s_kernel = pickKernel(&s_kernelName);
+static const char *s_int8KernelName = nullptr;
+static const Int8Kernel s_int8Kernel = pickInt8Kernel(&s_int8KernelName);
+
+const char *FaceNetEngine::kernelName(int32_t precision)
+{
+    return precision == ENGINE_PRECISION_INT8 ? s_int8KernelName : s_kernelName;
+}
+
+// see FaceNetEngine::setThreads()
+static std::atomic<int32_t> s_threads(0);
+
+void FaceNetEngine::setThreads(int32_t threads)
+{
+    s_threads.store(threads < 0 ? 0 : threads);
+}
+
+int32_t FaceNetEngine::getThreads()
+{
+    return s_threads.load();
+}
+
+/*
+ * fn(i) for i in [0, count), split on the threads when it's worth it.
+ * [cost] is the multiply-adds of one index. [fn] is given to the threads
+ * by reference: its captures are never copied to the heap
+ */
+template <typename Fn>
+static void parallelRange(int64_t count, int64_t cost, const Fn &fn)
+{
+    int64_t grain = std::max<int64_t>(1, MIN_TASK_COST / std::max<int64_t>(1, cost));
+    int32_t threads = s_threads.load(std::memory_order_relaxed);
+    if (count <= grain || threads == 1) {
+        for (int64_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+    TaskScheduler::instance().forkJoin(0, count, std::cref(fn), grain, threads,
+                                       PRIORITY_LATENCY);
+}
+
+/*
+ * Pack the M x K row major matrix [src] in panels of MR rows: K x MR each
+ */
+static void packA(const float *src, int M, int K, float *dst)
+{
+    for (int mp = 0; mp < M / MR; ++mp)
+        for (int k = 0; k < K; ++k)
+            for (int r = 0; r < MR; ++r)
+                *dst++ = src[(size_t)(mp * MR + r) * K + k];
+}
+
+static int panels(int n)
+{
+    return (n + NR - 1) / NR;
+}
+
+/*
+ * Transformed 3x3 filter [g] of Winograd F(2x2,3x3): u = G g G^T
+ */
+static void winogradFilter(const float *g, float *u)
+{
+    float gg[4][3];
+    for (int c = 0; c < 3; ++c) {
+        gg[0][c] = g[c];
+        gg[1][c] = (g[c] + g[3 + c] + g[6 + c]) * 0.5f;
+        gg[2][c] = (g[c] - g[3 + c] + g[6 + c]) * 0.5f;
+        gg[3][c] = g[6 + c];
+    }
+    for (int r = 0; r < 4; ++r) {
+        u[r * 4] = gg[r][0];
+        u[r * 4 + 1] = (gg[r][0] + gg[r][1] + gg[r][2]) * 0.5f;
+        u[r * 4 + 2] = (gg[r][0] - gg[r][1] + gg[r][2]) * 0.5f;
+        u[r * 4 + 3] = gg[r][2];
+    }
+}
+
+/*
+ * Pack the M x K row major filters [src] for the int8 kernels: one int8
+ * scale per filter in [scales], groups of 4 values of a filter in panels
+ * of MR filters, K rounded up to 4 with zeros
+ */
+static void packInt8(const float *src, int M, int K,
+                     std::vector<int8_t> &dst, std::vector<float> &scales)
+{
+    const int K4 = (K + 3) / 4;
+    dst.assign((size_t)M * K4 * 4, 0);
+    scales.resize(M);
+    for (int o = 0; o < M; ++o) {
+        const float *f = src + (size_t)o * K;
+        float range = 0;
+        for (int k = 0; k < K; ++k)
+            range = std::max(range, std::fabs(f[k]));
+        scales[o] = range > 0 ? range / 127 : 1;
+        int8_t *panel = &dst[(size_t)(o / MR) * K4 * MR * 4] + (o % MR) * 4;
+        for (int k = 0; k < K; ++k)
+            panel[(k / 4) * MR * 4 + k % 4] = (int8_t)std::lround(f[k] / scales[o]);
+    }
+}
+
+FaceNetEngine::FaceNetEngine(const std::vector<ConvWeights> &convs,
+                             const std::vector<float> &fc,
+                             const std::vector<float> &inputRanges)
+{
+    if (convs.size() != 1 + 2 * BLOCK_COUNT
+            || fc.size() != 256 * DESCRIPTOR_SIZE
+            || (!inputRanges.empty() && inputRanges.size() != convs.size()))
+        return;
+    if (!inputRanges.empty()) m_precision = ENGINE_PRECISION_INT8;
+
+    // shapes of face_net.h, from the 150x150 chip
+    int c = 3, h = CHIP_SIZE, w = CHIP_SIZE;
+    auto addLayer = [&](const ConvWeights &cw, int outC, int k, int stride) -> bool {
+        int pad = stride == 1 ? k / 2 : 0;
+        if (cw.inC != c || cw.outC != outC || cw.k != k || cw.stride != stride
+                || cw.pad != pad || cw.bias.size() != (size_t)outC
+                || cw.filters.size() != (size_t)outC * c * k * k)
+            return false;
+
+        Layer l;
+        l.inC = c; l.outC = outC; l.k = k; l.stride = stride; l.pad = pad;
+        l.inH = h; l.inW = w;
+        l.outH = (h + 2 * pad - k) / stride + 1;
+        l.outW = (w + 2 * pad - k) / stride + 1;
+        l.mode = k == 3 && stride == 1 ? CONV_WINOGRAD : CONV_GEMM;
+        // the first convolution stays in float: its input is signed and
+        // it has 3 channels only
+        if (m_precision == ENGINE_PRECISION_INT8 && !m_layers.empty())
+            l.mode = CONV_INT8;
+        l.bias = cw.bias;
+        if (l.mode == CONV_INT8) {
+            packInt8(cw.filters.data(), outC, c * k * k, l.packed8, l.scales);
+            // 7 bits inputs, see kernelInt8Avx2()
+            float range = inputRanges[m_layers.size()];
+            float inputStep = range > 0 ? range / 127 : 1;
+            l.inputScale = 1 / inputStep;
+            for (auto &scale : l.scales)
+                scale *= inputStep;
+        }
+        else if (l.mode == CONV_GEMM) {
+            int K = c * k * k;
+            l.packed.resize((size_t)outC * K);
+            packA(cw.filters.data(), outC, K, l.packed.data());
+        }
+        else {
+            // 16 matrices outC x inC of transformed filters
+            std::vector<float> u((size_t)16 * outC * c);
+            float t[16];
+            for (int o = 0; o < outC; ++o)
+                for (int i = 0; i < c; ++i) {
+                    winogradFilter(&cw.filters[((size_t)o * c + i) * 9], t);
+                    for (int xi = 0; xi < 16; ++xi)
+                        u[((size_t)xi * outC + o) * c + i] = t[xi];
+                }
+            l.packed.resize(u.size());
+            for (int xi = 0; xi < 16; ++xi)
+                packA(&u[(size_t)xi * outC * c], outC, c,
+                      &l.packed[(size_t)xi * outC * c]);
+        }
+        if (!m_layers.empty())
+            m_actSize = std::max(m_actSize, (size_t)outC * l.outH * l.outW);
+        m_layers.push_back(std::move(l));
+        c = outC; h = m_layers.back().outH; w = m_layers.back().outW;
+        return true;
+    };
+
+    if (!addLayer(convs[0], 32, 7, 2)) return;
+    // max_pool<3,3,2,2>
+    h = (h - 3) / 2 + 1;
+    w = (w - 3) / 2 + 1;
+    m_actSize = (size_t)c * h * w;
+    for (int b = 0; b < BLOCK_COUNT; ++b) {
+        int inH = h, inW = w;
+        if (!addLayer(convs[1 + 2 * b], BLOCKS[b].filters, 3, BLOCKS[b].stride)
+                || !addLayer(convs[2 + 2 * b], BLOCKS[b].filters, 3, 1))
+            return;
+        if (BLOCKS[b].stride != 1) {
+            // add_prev of the block and the avg_pool<2,2,2,2> of its input
+            h = std::max(h, (inH - 2) / 2 + 1);
+            w = std::max(w, (inW - 2) / 2 + 1);
+            m_actSize = std::max(m_actSize, (size_t)c * h * w);
+        }
+    }
+    if (c != 256) return;
+    m_fc = fc;
+    m_valid = true;
+    reserve(1);
+}
+
+int FaceNetEngine::batchBucket(int count)
+{
+    int bucket = 1;
+    while (bucket < count && bucket < MAX_BATCH)
+        bucket *= 2;
+    return bucket;
+}
+
+static int bucketIndex(int bucket)
+{
+    int index = 0;
+    while ((1 << index) < bucket)
+        ++index;
+    return index;
+}
+
+std::unique_ptr<FaceNetEngine::Workspace> FaceNetEngine::newWorkspace(int batch) const
+{
+    // the first convolution runs chip by chip, the other layers on the
+    // whole batch
+    size_t pack = 0, tiles = 0, pack8 = 0;
+    for (size_t i = 0; i < m_layers.size(); ++i) {
+        const Layer &l = m_layers[i];
+        const int K = l.inC * l.k * l.k;
+        const int chips = i == 0 ? 1 : batch;
+        if (l.mode == CONV_INT8)
+            pack8 = std::max(pack8, (size_t)((K + 3) / 4) * 4
+                                    * panels(l.outH * l.outW * chips) * NR);
+        else if (l.mode == CONV_GEMM)
+            pack = std::max(pack, (size_t)K * panels(l.outH * l.outW * chips) * NR);
+        else {
+            int T = ((l.outH + 1) / 2) * ((l.outW + 1) / 2) * chips;
+            pack = std::max(pack, (size_t)16 * l.inC * panels(T) * NR);
+            tiles = std::max(tiles, (size_t)16 * l.outC * T);
+        }
+    }
+
+    const Layer &stem = m_layers[0];
+    std::unique_ptr<Workspace> ws(new Workspace());
+    ws->batch = batch;
+    ws->input.resize((size_t)stem.inC * stem.inH * stem.inW);
+    ws->stem.resize((size_t)stem.outC * stem.outH * stem.outW);
+    for (auto &a : ws->act) a.resize(m_actSize * batch);
+    ws->pack.resize(pack);
+    ws->tiles.resize(tiles);
+    ws->pack8.resize(pack8);
+    return ws;
+}
+
+std::unique_ptr<FaceNetEngine::Workspace> FaceNetEngine::acquireWorkspace(int batch) const
+{
+    {
+        std::lock_guard<std::mutex> guard(m_poolMutex);
+        std::vector<std::unique_ptr<Workspace>> &pool = m_pools[bucketIndex(batch)];
+        if (!pool.empty()) {
+            std::unique_ptr<Workspace> ws = std::move(pool.back());
+            pool.pop_back();
+            return ws;
+        }
+    }
+    return newWorkspace(batch);
+}
+
+void FaceNetEngine::releaseWorkspace(std::unique_ptr<Workspace> ws) const
+{
+    std::lock_guard<std::mutex> guard(m_poolMutex);
+    m_pools[bucketIndex(ws->batch)].push_back(std::move(ws));
+}
+
+void FaceNetEngine::reserve(int batch) const
+{
+    if (!m_valid) return;
+    batch = batchBucket(batch);
+    {
+        std::lock_guard<std::mutex> guard(m_poolMutex);
+        if (!m_pools[bucketIndex(batch)].empty()) return;
+    }
+    releaseWorkspace(newWorkspace(batch));
+}
+
+void FaceNetEngine::conv(const Layer &l, int batch, const float *in, float *out,
+                         const float *residual, bool relu, Workspace &ws) const
+{
+    if (l.mode == CONV_WINOGRAD)
+        convWinograd(l, batch, in, out, residual, relu, ws);
+    else if (l.mode == CONV_INT8)
+        convInt8(l, batch, in, out, residual, relu, ws);
+    else
+        convGemm(l, batch, in, out, residual, relu, ws);
+}
+
+void FaceNetEngine::convGemm(const Layer &l, int batch, const float *in, float *out,
+                             const float *residual, bool relu, Workspace &ws) const
+{
+    const int K = l.inC * l.k * l.k;
+    const int N = l.outH * l.outW;
+    // the columns: the pixels of every chip
+    const int columns = N * batch;
+    const int nPanels = panels(columns);
+    const size_t inSize = (size_t)l.inC * l.inH * l.inW;
+    float *packed = ws.pack.data();
+
+    // im2col straight into the K x NR panels, zeros past the borders
+    parallelRange(nPanels, (int64_t)K * NR, [&](int64_t np) {
+        const float *src[NR];
+        int iy[NR], ix[NR];
+        for (int j = 0; j < NR; ++j) {
+            int n = (int)np * NR + j, p = n % N;
+            src[j] = n < columns ? in + (n / N) * inSize : nullptr;
+            iy[j] = (p / l.outW) * l.stride - l.pad;
+            ix[j] = (p % l.outW) * l.stride - l.pad;
+        }
+        float *dst = packed + (size_t)np * K * NR;
+        for (int ic = 0; ic < l.inC; ++ic) {
+            const size_t plane = (size_t)ic * l.inH * l.inW;
+            for (int ky = 0; ky < l.k; ++ky)
+                for (int kx = 0; kx < l.k; ++kx, dst += NR)
+                    for (int j = 0; j < NR; ++j) {
+                        int y = iy[j] + ky, x = ix[j] + kx;
+                        dst[j] = src[j] && y >= 0 && y < l.inH && x >= 0 && x < l.inW
+                                 ? src[j][plane + y * l.inW + x] : 0.0f;
+                    }
+        }
+    });
+
+    const int mPanels = l.outC / MR;
+    parallelRange((int64_t)mPanels * nPanels, (int64_t)MR * NR * K, [&](int64_t t) {
+        int mp = (int)(t % mPanels), np = (int)(t / mPanels);
+        float acc[MR * NR];
+        s_kernel(K, &l.packed[(size_t)mp * K * MR], packed + (size_t)np * K * NR, acc);
+        int cols = std::min(NR, columns - np * NR);
+        size_t offset[NR];
+        for (int j = 0; j < cols; ++j) {
+            int n = np * NR + j;
+            offset[j] = (size_t)(n / N) * l.outC * N + n % N;
+        }
+        for (int r = 0; r < MR; ++r) {
+            int o = mp * MR + r;
+            for (int j = 0; j < cols; ++j) {
+                size_t i = offset[j] + (size_t)o * N;
+                float v = acc[r * NR + j] + l.bias[o];
+                if (residual) v += residual[i];
+                out[i] = relu && v < 0 ? 0.0f : v;
+            }
+        }
+    });
+}
+
+void FaceNetEngine::convInt8(const Layer &l, int batch, const float *in, float *out,
+                             const float *residual, bool relu, Workspace &ws) const
+{
+    const int K = l.inC * l.k * l.k;
+    const int K4 = (K + 3) / 4;
+    const int N = l.outH * l.outW;
+    const int columns = N * batch;
+    const int nPanels = panels(columns);
+    const size_t inSize = (size_t)l.inC * l.inH * l.inW;
+    int8_t *packed = ws.pack8.data();
+
+    // im2col of the quantized inputs in groups of 4 values per column
+    parallelRange(nPanels, (int64_t)K * NR, [&](int64_t np) {
+        const float *src[NR];
+        int iy[NR], ix[NR];
+        for (int j = 0; j < NR; ++j) {
+            int n = (int)np * NR + j, p = n % N;
+            src[j] = n < columns ? in + (n / N) * inSize : nullptr;
+            iy[j] = (p / l.outW) * l.stride - l.pad;
+            ix[j] = (p % l.outW) * l.stride - l.pad;
+        }
+        int8_t *dst = packed + (size_t)np * K4 * NR * 4;
+        memset(dst, 0, (size_t)K4 * NR * 4);
+        int kk = 0;
+        for (int ic = 0; ic < l.inC; ++ic) {
+            const size_t plane = (size_t)ic * l.inH * l.inW;
+            for (int ky = 0; ky < l.k; ++ky)
+                for (int kx = 0; kx < l.k; ++kx, ++kk) {
+                    int8_t *group = dst + (kk / 4) * NR * 4 + kk % 4;
+                    for (int j = 0; j < NR; ++j) {
+                        int y = iy[j] + ky, x = ix[j] + kx;
+                        if (!src[j] || y < 0 || y >= l.inH || x < 0 || x >= l.inW)
+                            continue;
+                        // the inputs are >= 0: after a relu
+                        float q = src[j][plane + y * l.inW + x] * l.inputScale + 0.5f;
+                        group[j * 4] = (int8_t)(q <= 0 ? 0 : q >= 127 ? 127 : (int)q);
+                    }
+                }
+        }
+    });
+
+    const int mPanels = l.outC / MR;
+    parallelRange((int64_t)mPanels * nPanels, (int64_t)MR * NR * K, [&](int64_t t) {
+        int mp = (int)(t % mPanels), np = (int)(t / mPanels);
+        int32_t acc[MR * NR];
+        s_int8Kernel(K4, &l.packed8[(size_t)mp * K4 * MR * 4],
+                     packed + (size_t)np * K4 * NR * 4, acc);
+        int cols = std::min(NR, columns - np * NR);
+        size_t offset[NR];
+        for (int j = 0; j < cols; ++j) {
+            int n = np * NR + j;
+            offset[j] = (size_t)(n / N) * l.outC * N + n % N;
+        }
+        for (int r = 0; r < MR; ++r) {
+            int o = mp * MR + r;
+            for (int j = 0; j < cols; ++j) {
+                size_t i = offset[j] + (size_t)o * N;
+                float v = acc[r * NR + j] * l.scales[o] + l.bias[o];
+                if (residual) v += residual[i];
+                out[i] = relu && v < 0 ? 0.0f : v;
+            }
+        }
+    });
+}
+
+void FaceNetEngine::convWinograd(const Layer &l, int batch, const float *in, float *out,
+                                 const float *residual, bool relu, Workspace &ws) const
+{
+    const int tilesH = (l.outH + 1) / 2, tilesW = (l.outW + 1) / 2;
+    // tiles of a chip, of the batch
+    const int T = tilesH * tilesW;
+    const int batchTiles = T * batch;
+    const int nPanels = panels(batchTiles);
+    const size_t panelSize = (size_t)l.inC * NR;
+    const size_t inSize = (size_t)l.inC * l.inH * l.inW;
+    const size_t outSize = (size_t)l.outH * l.outW;
+    // v[xi]: inC x batchTiles in panels, 16 of them
+    float *v = ws.pack.data();
+    const size_t vSize = nPanels * panelSize;
+    // m[xi]: outC x batchTiles
+    float *m = ws.tiles.data();
+    const size_t mSize = (size_t)l.outC * batchTiles;
+
+    // input tiles: v = B^T d B, d the 4x4 input at (2 ty - 1, 2 tx - 1)
+    memset(v, 0, 16 * vSize * sizeof(float));
+    parallelRange((int64_t)batch * l.inC, (int64_t)T * 32, [&](int64_t i) {
+        int chip = (int)(i / l.inC), ic = (int)(i % l.inC);
+        const float *src = in + chip * inSize + (size_t)ic * l.inH * l.inW;
+        for (int t = 0; t < T; ++t) {
+            int y0 = (t / tilesW) * 2 - 1, x0 = (t % tilesW) * 2 - 1;
+            float d[4][4];
+            for (int r = 0; r < 4; ++r)
+                for (int c = 0; c < 4; ++c) {
+                    int y = y0 + r, x = x0 + c;
+                    d[r][c] = y >= 0 && y < l.inH && x >= 0 && x < l.inW
+                              ? src[y * l.inW + x] : 0.0f;
+                }
+            float b[4][4];
+            for (int c = 0; c < 4; ++c) {
+                b[0][c] = d[0][c] - d[2][c];
+                b[1][c] = d[1][c] + d[2][c];
+                b[2][c] = d[2][c] - d[1][c];
+                b[3][c] = d[1][c] - d[3][c];
+            }
+            int bt = chip * T + t;
+            float *dst = v + (bt / NR) * panelSize + ic * NR + bt % NR;
+            for (int r = 0; r < 4; ++r) {
+                dst[(r * 4) * vSize] = b[r][0] - b[r][2];
+                dst[(r * 4 + 1) * vSize] = b[r][1] + b[r][2];
+                dst[(r * 4 + 2) * vSize] = b[r][2] - b[r][1];
+                dst[(r * 4 + 3) * vSize] = b[r][1] - b[r][3];
+            }
+        }
+    });
+
+    // 16 GEMMs m[xi] = u[xi] v[xi]
+    const int mPanels = l.outC / MR;
+    const int64_t perXi = (int64_t)mPanels * nPanels;
+    parallelRange(16 * perXi, (int64_t)MR * NR * l.inC, [&](int64_t t) {
+        int xi = (int)(t / perXi);
+        int mp = (int)(t % perXi % mPanels), np = (int)(t % perXi / mPanels);
+        float acc[MR * NR];
+        s_kernel(l.inC,
+                 &l.packed[(size_t)xi * l.outC * l.inC + (size_t)mp * l.inC * MR],
+                 v + xi * vSize + np * panelSize, acc);
+        int cols = std::min(NR, batchTiles - np * NR);
+        float *dst = m + xi * mSize + (size_t)mp * MR * batchTiles + np * NR;
+        for (int r = 0; r < MR; ++r)
+            memcpy(dst + (size_t)r * batchTiles, acc + r * NR, cols * sizeof(float));
+    });
+
+    // output tiles: y = A^T m A
+    parallelRange((int64_t)batch * l.outC, (int64_t)T * 24, [&](int64_t i) {
+        int chip = (int)(i / l.outC), o = (int)(i % l.outC);
+        const float *src = m + (size_t)o * batchTiles + chip * T;
+        size_t offset = ((size_t)chip * l.outC + o) * outSize;
+        float *dst = out + offset;
+        const float *res = residual ? residual + offset : nullptr;
+        for (int t = 0; t < T; ++t) {
+            float s[4][4];
+            for (int xi = 0; xi < 16; ++xi)
+                s[xi / 4][xi % 4] = src[xi * mSize + t];
+            float a[2][4];
+            for (int c = 0; c < 4; ++c) {
+                a[0][c] = s[0][c] + s[1][c] + s[2][c];
+                a[1][c] = s[1][c] - s[2][c] - s[3][c];
+            }
+            int y0 = (t / tilesW) * 2, x0 = (t % tilesW) * 2;
+            for (int r = 0; r < 2 && y0 + r < l.outH; ++r) {
+                float y[2] = {a[r][0] + a[r][1] + a[r][2],
+                              a[r][1] - a[r][2] - a[r][3]};
+                for (int c = 0; c < 2 && x0 + c < l.outW; ++c) {
+                    int p = (y0 + r) * l.outW + x0 + c;
+                    float val = y[c] + l.bias[o];
+                    if (res) val += res[p];
+                    dst[p] = relu && val < 0 ? 0.0f : val;
+                }
+            }
+        }
+    });
+}
+
+void FaceNetEngine::run(const uint8_t *rgb, float *descriptor) const
+{
+    forward(&rgb, 1, descriptor, nullptr);
+}
+
+void FaceNetEngine::runBatch(const uint8_t *const *chips, int count,
+                             float *descriptors) const
+{
+    for (int i = 0; i < count; i += MAX_BATCH)
+        forward(chips + i, std::min(MAX_BATCH, count - i),
+                descriptors + (size_t)i * DESCRIPTOR_SIZE, nullptr);
+}
+
+void FaceNetEngine::calibrate(const uint8_t *rgb, std::vector<float> &inputRanges) const
+{
+    inputRanges.resize(m_layers.size(), 0.0f);
+    float descriptor[DESCRIPTOR_SIZE];
+    forward(&rgb, 1, descriptor, &inputRanges);
+}
+
+void FaceNetEngine::forward(const uint8_t *const *chips, int count, float *descriptors,
+                            std::vector<float> *inputRanges) const
+{
+    if (!m_valid || count <= 0) return;
+    std::unique_ptr<Workspace> ws = acquireWorkspace(batchBucket(count));
+    auto convLayer = [&](size_t i, int batch, const float *in, float *out,
+                         const float *residual, bool relu) {
+        const Layer &l = m_layers[i];
+        if (inputRanges) {
+            float &range = (*inputRanges)[i];
+            for (size_t n = 0, size = (size_t)batch * l.inC * l.inH * l.inW; n < size; ++n)
+                range = std::max(range, std::fabs(in[n]));
+        }
+        conv(l, batch, in, out, residual, relu, *ws);
+    };
+    float *x = ws->act[0].data(), *y = ws->act[1].data(),
+          *z = ws->act[2].data(), *s = ws->act[3].data();
+
+    // con<32,7,7,2,2>, relu, max_pool<3,3,2,2> chip by chip: its output is
+    // the largest activation
+    const Layer &stem = m_layers[0];
+    int c = stem.outC;
+    int h = (stem.outH - 3) / 2 + 1, w = (stem.outW - 3) / 2 + 1;
+    const int plane = CHIP_SIZE * CHIP_SIZE;
+    float *input = ws->input.data(), *stemOut = ws->stem.data();
+    for (int chip = 0; chip < count; ++chip) {
+        const uint8_t *rgb = chips[chip];
+        for (int i = 0; i < plane; ++i)
+            for (int ch = 0; ch < 3; ++ch)
+                input[ch * plane + i] = (rgb[i * 3 + ch] - MEAN_RGB[ch]) / 256.0f;
+        convLayer(0, 1, input, stemOut, nullptr, true);
+        for (int ch = 0; ch < c; ++ch) {
+            const float *src = stemOut + ch * stem.outH * stem.outW;
+            float *dst = x + ((size_t)chip * c + ch) * h * w;
+            for (int r = 0; r < h; ++r)
+                for (int col = 0; col < w; ++col) {
+                    const float *p = src + (r * 2) * stem.outW + col * 2;
+                    float v = p[0];
+                    for (int dy = 0; dy < 3; ++dy)
+                        for (int dx = 0; dx < 3; ++dx)
+                            v = std::max(v, p[dy * stem.outW + dx]);
+                    dst[r * w + col] = v;
+                }
+        }
+    }
+
+    for (int b = 0; b < BLOCK_COUNT; ++b) {
+        const Layer &l1 = m_layers[1 + 2 * b], &l2 = m_layers[2 + 2 * b];
+        convLayer(1 + 2 * b, count, x, y, nullptr, true);
+        if (l1.stride == 1) {
+            // relu(block + input)
+            convLayer(2 + 2 * b, count, y, z, x, true);
+            std::swap(x, z);
+            continue;
+        }
+
+        // avg_pool<2,2,2,2> of the input, added to the block with zeros
+        // where their shapes differ
+        convLayer(2 + 2 * b, count, y, z, nullptr, false);
+        int sh = (h - 2) / 2 + 1, sw = (w - 2) / 2 + 1;
+        int oc = std::max(c, l2.outC);
+        int oh = std::max(sh, l2.outH), ow = std::max(sw, l2.outW);
+        for (int chip = 0; chip < count; ++chip) {
+            const float *in = x + (size_t)chip * c * h * w;
+            const float *block = z + (size_t)chip * l2.outC * l2.outH * l2.outW;
+            float *dst = y + (size_t)chip * oc * oh * ow;
+            for (int ch = 0; ch < c; ++ch)
+                for (int r = 0; r < sh; ++r)
+                    for (int col = 0; col < sw; ++col) {
+                        const float *p = in + (ch * h + r * 2) * w + col * 2;
+                        s[(ch * sh + r) * sw + col] = (p[0] + p[1] + p[w] + p[w + 1]) * 0.25f;
+                    }
+            for (int ch = 0; ch < oc; ++ch)
+                for (int r = 0; r < oh; ++r)
+                    for (int col = 0; col < ow; ++col) {
+                        float v = 0;
+                        if (ch < l2.outC && r < l2.outH && col < l2.outW)
+                            v += block[(ch * l2.outH + r) * l2.outW + col];
+                        if (ch < c && r < sh && col < sw)
+                            v += s[(ch * sh + r) * sw + col];
+                        dst[(ch * oh + r) * ow + col] = std::max(v, 0.0f);
+                    }
+        }
+        std::swap(x, y);
+        c = oc; h = oh; w = ow;
+    }
+
+    // avg_pool_everything, fc_no_bias<128>
+    for (int chip = 0; chip < count; ++chip) {
+        const float *in = x + (size_t)chip * c * h * w;
+        float pooled[256];
+        for (int ch = 0; ch < c; ++ch) {
+            float sum = 0;
+            for (int i = 0; i < h * w; ++i) sum += in[ch * h * w + i];
+            pooled[ch] = sum / (h * w);
+        }
+        float *descriptor = descriptors + (size_t)chip * DESCRIPTOR_SIZE;
+        std::fill(descriptor, descriptor + DESCRIPTOR_SIZE, 0.0f);
+        for (int i = 0; i < c; ++i) {
+            const float *row = &m_fc[(size_t)i * DESCRIPTOR_SIZE];
+            for (int j = 0; j < DESCRIPTOR_SIZE; ++j)
+                descriptor[j] += pooled[i] * row[j];
+        }
+    }
+    releaseWorkspace(std::move(ws));
+}
+
+QuantizationReport checkQuantization(const FaceNetEngine &reference,
+                                     const FaceNetEngine &quantized,
+                                     const std::vector<const uint8_t *> &heldOut,
+                                     float threshold)
+{
+    const int D = FaceNetEngine::DESCRIPTOR_SIZE;
+    const size_t n = heldOut.size();
+    QuantizationReport report = {};
+    report.precision = quantized.getPrecision();
+    report.heldOutChips = (int32_t)n;
+
+    auto distance = [D](const float *a, const float *b) {
+        float sum = 0;
+        for (int i = 0; i < D; ++i)
+            sum += (a[i] - b[i]) * (a[i] - b[i]);
+        return std::sqrt(sum);
+    };
+
+    std::vector<float> ref(n * D), q(n * D);
+    for (size_t i = 0; i < n; ++i) {
+        reference.run(heldOut[i], &ref[i * D]);
+        quantized.run(heldOut[i], &q[i * D]);
+        float drift = distance(&ref[i * D], &q[i * D]);
+        report.maxDrift = std::max(report.maxDrift, drift);
+        report.meanDrift += drift / n;
+    }
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = i + 1; j < n; ++j) {
+            bool match = distance(&ref[i * D], &ref[j * D]) < threshold;
+            bool quantizedMatch = distance(&q[i * D], &q[j * D]) < threshold;
+            ++report.pairs;
+            if (match != quantizedMatch) ++report.flips;
+        }
+    return report;
+}
@@ -0,0 +1,210 @@
+#ifndef FACE_NET_ENGINE_H
+#define FACE_NET_ENGINE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum EnginePrecision {
+    ENGINE_PRECISION_FP32 = 0,
+    ENGINE_PRECISION_INT8,      // calibrated, see FaceNetEngine
+    ENGINE_PRECISION_COUNT
+};
+
+/*
+ * Drift of an int8 engine from the float32 one on held-out chips (see
+ * checkQuantization()). Returned to Dart as is (FFI struct)
+ */
+struct QuantizationReport {
+    int32_t applied;            // 1: the recognizer runs at the requested precision
+    int32_t precision;          // EnginePrecision requested
+    int32_t calibrationChips;
+    int32_t heldOutChips;
+    int32_t pairs;              // held-out pairs compared at the threshold
+    int32_t flips;              // pairs whose match / no match decision changed
+    float maxDrift;             // largest distance to the float32 descriptor
+    float meanDrift;
+};
+
+/*
+ * Weights of a convolution of the recognition network, dlib layout: the
+ * [outC][inC][k][k] filters then one bias per filter, with the affine
+ * layer over it already folded in (see foldAffineLayers())
+ */
+struct ConvWeights {
+    int inC = 0;
+    int outC = 0;
+    int k = 0;
+    int stride = 1;
+    int pad = 0;
+    std::vector<float> filters;
+    std::vector<float> bias;
+};
+
+/*
+ * Inference of facenet::anet_type without dlib: the forward pass of the
+ * descriptors, tuned for the CPU.
+ * The convolutions are GEMMs over weights packed once in panels of the
+ * micro-kernel (NEON on ARM, AVX2/FMA on x86 when the CPU has it, plain
+ * C++ otherwise), the 3x3 stride 1 ones use Winograd F(2x2,3x3): 16
+ * multiplications per 4 outputs instead of 36. The other inputs are packed
+ * straight from the activations (im2col). The GEMM tiles and the
+ * transforms are split on setThreads() threads of the TaskScheduler, even
+ * for a single chip. Batches of chips run
+ * layer by layer: the pixels of all the chips are the columns of one GEMM,
+ * the weights are read once per batch.
+ * The descriptors match dlib's up to float rounding (see benchDescriptors()
+ * in the benchmark).
+ *
+ * ENGINE_PRECISION_INT8 runs the convolutions after the first one on int8
+ * weights (one scale per filter) and 7 bits activations (one scale per
+ * layer, from the largest input seen on calibration chips, the inputs are
+ * all after a relu). They are GEMMs with int32 sums: maddubs on AVX2,
+ * sdot on ARM built with dotprod, widening multiplies on the other NEON
+ * CPUs. The bias, the residual additions and the pooling stay in float
+ */
+class FaceNetEngine
+{
+public:
+    static const int CHIP_SIZE = 150;
+    static const int DESCRIPTOR_SIZE = 128;
+    // largest batch computed at once by runBatch()
+    static const int MAX_BATCH = 8;
+
+    /*
+     * [convs] in the input to output order of face_net.h (the first
+     * convolution, then the two of every residual block) and the
+     * 256 x 128 weights of the last fully connected layer [fc].
+     * isValid() is false if they don't have the shapes of anet_type.
+     * With the [inputRanges] of calibrate() the engine is
+     * ENGINE_PRECISION_INT8
+     */
+    FaceNetEngine(const std::vector<ConvWeights> &convs,
+                  const std::vector<float> &fc,
+                  const std::vector<float> &inputRanges = std::vector<float>());
+
+    bool isValid() const {return m_valid;}
+    int32_t getPrecision() const {return m_precision;}
+
+    /*
+     * [descriptor] (DESCRIPTOR_SIZE values) of a CHIP_SIZE x CHIP_SIZE
+     * RGB chip [rgb] (interleaved bytes, ie. dlib::matrix<rgb_pixel>).
+     * Thread safe: the calls use their own workspace
+     */
+    void run(const uint8_t *rgb, float *descriptor) const;
+
+    /*
+     * run() of the [count] [chips] at once: [descriptors] is count x
+     * DESCRIPTOR_SIZE values. A batch is padded to its bucket (1, 2, 4 or
+     * MAX_BATCH chips, larger ones are split) whose workspace is planned
+     * at init and then reused: a bucket reserve()d, or run once, doesn't
+     * allocate anymore. The padding isn't computed
+     */
+    void runBatch(const uint8_t *const *chips, int count, float *descriptors) const;
+
+    /*
+     * Allocate a workspace for the bucket of [batch] if it has none. The
+     * one of a single chip is allocated by the constructor
+     */
+    void reserve(int batch) const;
+
+    // bucket of a batch of [count] chips
+    static int batchBucket(int count);
+
+    /*
+     * run() [rgb] and raise [inputRanges] (one per convolution) to the
+     * largest absolute input of every convolution
+     */
+    void calibrate(const uint8_t *rgb, std::vector<float> &inputRanges) const;
+
+    /*
+     * Threads splitting every layer of a forward pass, the calling one
+     * included, for all the engines: 1 runs a pass on the calling thread
+     * only, <= 0 (default) on all the workers of the TaskScheduler
+     */
+    static void setThreads(int32_t threads);
+    static int32_t getThreads();
+
+    // micro-kernel used on this CPU at [precision], ie. "avx2"
+    static const char *kernelName(int32_t precision = ENGINE_PRECISION_FP32);
+
+private:
+    enum ConvMode {
+        CONV_GEMM,          // im2col + GEMM
+        CONV_WINOGRAD,      // 3x3 stride 1
+        CONV_INT8           // im2col + int8 GEMM
+    };
+
+    struct Layer {
+        int inC, outC, k, stride, pad;
+        int inH, inW, outH, outW;
+        ConvMode mode;
+        // CONV_GEMM: outC x (inC k k), CONV_WINOGRAD: 16 outC x inC, in
+        // panels of the micro-kernel
+        std::vector<float> packed;
+        std::vector<float> bias;
+        // CONV_INT8: outC x (inC k k) rounded up to 4, groups of 4 values
+        // of a filter in panels of the micro-kernel
+        std::vector<int8_t> packed8;
+        std::vector<float> scales;  // of the int32 sums, per filter
+        float inputScale = 1;       // float input to int8
+    };
+
+    // buffers of a batch bucket, see newWorkspace()
+    struct Workspace {
+        int batch = 0;
+        std::vector<float> input;   // one normalized chip
+        std::vector<float> stem;    // first convolution of one chip
+        std::vector<float> act[4];  // activations of the batch
+        std::vector<float> pack;    // im2col or Winograd input tiles
+        std::vector<float> tiles;   // Winograd output tiles
+        std::vector<int8_t> pack8;  // int8 im2col
+    };
+
+    static const int BUCKET_COUNT = 4;  // 1, 2, 4, MAX_BATCH
+
+    // at most MAX_BATCH [chips]
+    void forward(const uint8_t *const *chips, int count, float *descriptors,
+                 std::vector<float> *inputRanges) const;
+
+    /*
+     * [out] = [l]([in]) + bias (+ [residual] of the shape of [out]),
+     * then relu if [relu], for the [batch] chips one after the other in
+     * [in], [out] and [residual]
+     */
+    void conv(const Layer &l, int batch, const float *in, float *out,
+              const float *residual, bool relu, Workspace &ws) const;
+    void convGemm(const Layer &l, int batch, const float *in, float *out,
+                  const float *residual, bool relu, Workspace &ws) const;
+    void convWinograd(const Layer &l, int batch, const float *in, float *out,
+                      const float *residual, bool relu, Workspace &ws) const;
+    void convInt8(const Layer &l, int batch, const float *in, float *out,
+                  const float *residual, bool relu, Workspace &ws) const;
+
+    // workspace of the bucket [batch], sized for the largest layer
+    std::unique_ptr<Workspace> newWorkspace(int batch) const;
+    std::unique_ptr<Workspace> acquireWorkspace(int batch) const;
+    void releaseWorkspace(std::unique_ptr<Workspace> ws) const;
+
+    bool m_valid = false;
+    int32_t m_precision = ENGINE_PRECISION_FP32;
+    std::vector<Layer> m_layers;
+    std::vector<float> m_fc;
+    size_t m_actSize = 0;       // largest activation of a chip after the stem
+
+    mutable std::mutex m_poolMutex;
+    mutable std::vector<std::unique_ptr<Workspace>> m_pools[BUCKET_COUNT];
+};
+
+/*
+ * Compare the descriptors of [quantized] with the ones of [reference] on
+ * the [heldOut] chips: their distance, and the pairs of chips which match
+ * (distance < [threshold]) with one engine and not with the other
+ */
+QuantizationReport checkQuantization(const FaceNetEngine &reference,
+                                     const FaceNetEngine &quantized,
+                                     const std::vector<const uint8_t *> &heldOut,
+                                     float threshold);
+
+#endif // FACE_NET_ENGINE_H
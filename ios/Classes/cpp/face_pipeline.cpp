@@ -0,0 +1,121 @@
+#include "face_pipeline.h"
+
+FacePipeline::FacePipeline(std::shared_ptr<const FaceModels> models)
+    : models(models)
+{
+    // the legacy API sets the models later with the init functions
+    if (models == nullptr) return;
+    detector.setShapePredictor(models->detectorShapePredictor);
+    detector.setBackend(models->backends);
+    recognition.setModels(models->recognizerShapePredictor, models->net);
+    recognition.setBackends(models->backends);
+}
+
+bool FacePipeline::configure(PipelineOption option, double value)
+{
+    switch (option) {
+        case OPT_DETECTOR_SCALE_FACTOR:
+            detector.setScaleFactor(value);
+            break;
+        case OPT_DETECTOR_COLOR_SPACE:
+            detector.setInputColorSpace((ColorSpace)(int32_t)value);
+            break;
+        case OPT_DETECTOR_ROTATION:
+            detector.setRotation((int32_t)value);
+            break;
+        case OPT_DETECTOR_FLIP:
+            detector.setFlip((int32_t)value);
+            break;
+        case OPT_DETECTOR_ANTISHAKE_SAMPLES:
+            detector.setAntiShakeSamples((int32_t)value);
+            break;
+        case OPT_DETECTOR_ONLY_RECTANGLE:
+            detector.setGetOnlyRectangle(value != 0);
+            break;
+        case OPT_RECOGNIZER_SCALE_FACTOR:
+            recognition.setScaleFactor(value);
+            break;
+        case OPT_RECOGNIZER_COLOR_SPACE:
+            recognition.setInputColorSpace((ColorSpace)(int32_t)value);
+            break;
+        case OPT_RECOGNIZER_ROTATION:
+            recognition.setRotation((int32_t)value);
+            break;
+        case OPT_RECOGNIZER_FLIP:
+            recognition.setFlip((int32_t)value);
+            break;
+        case OPT_RECOGNIZER_REFRESH_INTERVAL:
+            recognition.setRefreshInterval((int32_t)value);
+            break;
+        case OPT_RECOGNIZER_MIN_QUALITY:
+            recognition.setMinQuality(value);
+            break;
+        case OPT_RECOGNIZER_JITTER_ITERATIONS:
+            recognition.setJitterIterations((int32_t)value);
+            break;
+        case OPT_STAGED_MAX_IN_FLIGHT:
+            // the frames still in the stages are discarded
+            m_stagedMaxInFlight = (int32_t)value;
+            m_staged.reset();
+            break;
+        case OPT_GOVERNOR_BUDGET_MS:
+            governor.setBudget(value);
+            break;
+        case OPT_DETECTOR_MOTION_GATE:
+            detector.setMotionGate(value != 0);
+            break;
+        case OPT_RECOGNIZER_MOTION_GATE:
+            recognition.setMotionGate(value != 0);
+            break;
+        case OPT_MOTION_THRESHOLD:
+            detector.setMotionThreshold((int32_t)value);
+            recognition.setMotionThreshold((int32_t)value);
+            break;
+        case OPT_PRESENCE_ENABLED:
+            presence.setEnabled(value != 0);
+            break;
+        case OPT_PRESENCE_IDLE_WIDTH:
+            presence.setIdleWidth((int32_t)value);
+            break;
+        case OPT_PRESENCE_IDLE_STRIDE:
+            presence.setIdleStride((int32_t)value);
+            break;
+        case OPT_PRESENCE_EMPTY_FRAMES:
+            presence.setEmptyFrames((int32_t)value);
+            break;
+        case OPT_DETECTOR_PREFILTER:
+            detector.setPrefilter((int32_t)value);
+            break;
+        case OPT_RECOGNIZER_PREFILTER:
+            recognition.setPrefilter((int32_t)value);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+StagedRecognizer &FacePipeline::stagedRecognizer()
+{
+    if (!m_staged)
+        m_staged.reset(new StagedRecognizer(recognition, gallery,
+                                            m_stagedMaxInFlight));
+    return *m_staged;
+}
+
+void FacePipeline::detectorFrameDone(int64_t durNs)
+{
+    governor.setLandmarkTracking(detector.tracksLandmarks());
+    if (!governor.detectorFrame(durNs)) return;
+    GovernorState state = governor.getState();
+    detector.setDetectScale(state.detectScale);
+    detector.setPyramidLevels(state.pyramidLevels);
+    detector.setDetectInterval(state.detectInterval);
+    detector.setSmoothingLimit(state.smoothingLimit);
+}
+
+void FacePipeline::recognizerFrameDone(int64_t durNs)
+{
+    if (!governor.recognizerFrame(durNs)) return;
+    recognition.setRefreshScale(governor.getState().refreshScale);
+}
@@ -0,0 +1,78 @@
+#ifndef FACE_PIPELINE_H
+#define FACE_PIPELINE_H
+
+#include <memory>
+#include "face_models.h"
+#include "facedetector.h"
+#include "facerecognition.h"
+#include "face_gallery.h"
+#include "staged_pipeline.h"
+#include "quality_governor.h"
+#include "presence_monitor.h"
+
+/*
+ * Options accepted by FacePipeline::configure()
+ */
+enum PipelineOption {
+    OPT_DETECTOR_SCALE_FACTOR = 0,
+    OPT_DETECTOR_COLOR_SPACE,
+    OPT_DETECTOR_ROTATION,
+    OPT_DETECTOR_FLIP,
+    OPT_DETECTOR_ANTISHAKE_SAMPLES,
+    OPT_DETECTOR_ONLY_RECTANGLE,
+    OPT_RECOGNIZER_SCALE_FACTOR,
+    OPT_RECOGNIZER_COLOR_SPACE,
+    OPT_RECOGNIZER_ROTATION,
+    OPT_RECOGNIZER_FLIP,
+    OPT_RECOGNIZER_REFRESH_INTERVAL,
+    OPT_RECOGNIZER_MIN_QUALITY,
+    OPT_RECOGNIZER_JITTER_ITERATIONS,
+    OPT_STAGED_MAX_IN_FLIGHT,
+    OPT_GOVERNOR_BUDGET_MS,
+    OPT_DETECTOR_MOTION_GATE,
+    OPT_RECOGNIZER_MOTION_GATE,
+    OPT_MOTION_THRESHOLD,
+    OPT_PRESENCE_ENABLED,
+    OPT_PRESENCE_IDLE_WIDTH,
+    OPT_PRESENCE_IDLE_STRIDE,
+    OPT_PRESENCE_EMPTY_FRAMES,
+    OPT_DETECTOR_PREFILTER,
+    OPT_RECOGNIZER_PREFILTER
+};
+
+/*
+ * An independent detection and recognition pipeline. Every pipeline keeps
+ * its own tracking, smoothing and gallery state while the model weights
+ * are shared with the other pipelines created with the same FaceModels.
+ * Different pipelines can be used at the same time by different threads.
+ */
+struct FacePipeline {
+    explicit FacePipeline(std::shared_ptr<const FaceModels> models);
+
+    bool configure(PipelineOption option, double value);
+
+    // created on first use
+    StagedRecognizer &stagedRecognizer();
+
+    /*
+     * Report the duration of a detector or recognizer frame to the
+     * governor and apply its decisions. Called by the thread running
+     * that side, between two frames
+     */
+    void detectorFrameDone(int64_t durNs);
+    void recognizerFrameDone(int64_t durNs);
+
+    std::shared_ptr<const FaceModels> models;
+    FaceDetector detector;
+    FaceRecognition recognition;
+    FaceGallery gallery;
+    QualityGovernor governor;
+    PresenceMonitor presence;
+
+private:
+    int32_t m_stagedMaxInFlight = 4;
+    // declared last: it uses recognition and gallery until destroyed
+    std::unique_ptr<StagedRecognizer> m_staged;
+};
+
+#endif // FACE_PIPELINE_H
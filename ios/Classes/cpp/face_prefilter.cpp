@@ -0,0 +1,109 @@
+#include "face_prefilter.h"
+
+#include <algorithm>
+#include <string>
+#include <opencv2/core/persistence.hpp>
+#include <opencv2/imgproc.hpp>
+
+// longest side of the image given to the cascade: its 24px window then
+// finds faces from ~7% of the frame
+static const int CASCADE_SIZE = 320;
+// longest side of the skin thumbnail
+static const int SKIN_SIZE = 160;
+// smallest skin blob, in thumbnail pixels
+static const int MIN_SKIN_AREA = 40;
+
+// [src] reduced to [size] pixels on its longest side
+static cv::Mat reduce(const cv::Mat &src, int size, double &scale)
+{
+    scale = std::min(1.0, (double)size / std::max(src.cols, src.rows));
+    if (scale >= 1) return src;
+    cv::Mat small;
+    cv::resize(src, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    return small;
+}
+
+static cv::Rect scaleRect(const cv::Rect &r, double scale)
+{
+    return cv::Rect(r.x / scale, r.y / scale, r.width / scale, r.height / scale);
+}
+
+bool FacePrefilter::loadCascade(const char *xml, int64_t size)
+{
+    if (xml == nullptr || size <= 0) return false;
+    std::unique_ptr<cv::CascadeClassifier> cascade(new cv::CascadeClassifier());
+    try {
+        cv::FileStorage fs(std::string(xml, size),
+                           cv::FileStorage::READ | cv::FileStorage::MEMORY);
+        if (!fs.isOpened() || !cascade->read(fs.getFirstTopLevelNode()))
+            return false;
+    }
+    catch (cv::Exception &e) {
+        return false;
+    }
+    m_cascade = std::move(cascade);
+    return true;
+}
+
+void FacePrefilter::setMode(int32_t mode)
+{
+    m_mode = mode >= 0 && mode < PREFILTER_COUNT ? mode : PREFILTER_NONE;
+}
+
+MotionRegions FacePrefilter::candidates(const cv::Mat &rgb)
+{
+    switch (m_mode) {
+        case PREFILTER_CASCADE:
+            return cascadeCandidates(rgb);
+        case PREFILTER_SKIN:
+            return skinCandidates(rgb);
+        default:
+            return MotionRegions();
+    }
+}
+
+MotionRegions FacePrefilter::cascadeCandidates(const cv::Mat &rgb)
+{
+    MotionRegions regions;
+    if (!m_cascade || m_cascade->empty()) return regions;
+
+    double scale;
+    cv::Mat gray;
+    cv::cvtColor(reduce(rgb, CASCADE_SIZE, scale), gray, cv::COLOR_RGB2GRAY);
+    cv::equalizeHist(gray, gray);
+
+    // few neighbors: false candidates only cost a HOG verification
+    std::vector<cv::Rect> faces;
+    m_cascade->detectMultiScale(gray, faces, 1.1, 2, 0, cv::Size(24, 24));
+    regions.full = false;
+    for (auto &f : faces)
+        regions.rects.push_back(scaleRect(f, scale));
+    return regions;
+}
+
+MotionRegions FacePrefilter::skinCandidates(const cv::Mat &rgb)
+{
+    MotionRegions regions;
+    if (rgb.channels() != 3) return regions;
+
+    double scale;
+    cv::Mat ycrcb, mask;
+    cv::cvtColor(reduce(rgb, SKIN_SIZE, scale), ycrcb, cv::COLOR_RGB2YCrCb);
+    // wide range of skin tones: recall first
+    cv::inRange(ycrcb, cv::Scalar(0, 133, 77), cv::Scalar(255, 180, 135), mask);
+    cv::morphologyEx(mask, mask, cv::MORPH_OPEN, cv::Mat());
+    cv::dilate(mask, mask, cv::Mat(), cv::Point(-1, -1), 2);
+
+    cv::Mat labels, stats, centroids;
+    int n = cv::connectedComponentsWithStats(mask, labels, stats, centroids);
+    regions.full = false;
+    for (int i = 1; i < n; ++i) {
+        if (stats.at<int>(i, cv::CC_STAT_AREA) < MIN_SKIN_AREA) continue;
+        regions.rects.push_back(scaleRect(cv::Rect(
+                stats.at<int>(i, cv::CC_STAT_LEFT),
+                stats.at<int>(i, cv::CC_STAT_TOP),
+                stats.at<int>(i, cv::CC_STAT_WIDTH),
+                stats.at<int>(i, cv::CC_STAT_HEIGHT)), scale));
+    }
+    return regions;
+}
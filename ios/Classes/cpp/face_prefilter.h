@@ -0,0 +1,54 @@
+#ifndef FACE_PREFILTER_H
+#define FACE_PREFILTER_H
+
+#include <cstdint>
+#include <memory>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/objdetect.hpp>
+#include "motion_gate.h"
+
+enum PrefilterMode {
+    PREFILTER_NONE = 0,     // HOG on the whole frame
+    PREFILTER_CASCADE,      // OpenCV Haar/LBP cascade candidates
+    PREFILTER_SKIN,         // skin color blobs candidates
+    PREFILTER_COUNT
+};
+
+/*
+ * First stage of a coarse-to-fine detector: a cheap detector tuned for
+ * recall proposes candidate regions and the HOG detector only verifies
+ * them (see detectInRegions()).
+ * The cascade runs on a gray image reduced to CASCADE_SIZE pixels, the
+ * skin filter on a YCrCb thumbnail. Both fall back to the whole frame
+ * when they can't be used (no cascade loaded, gray input).
+ */
+class FacePrefilter
+{
+public:
+    FacePrefilter() {}
+
+    /*
+     * Load a cascade classifier from the bytes of its XML file (ie. the
+     * haarcascade_frontalface_* or lbpcascade_frontalface* files of
+     * OpenCV). Return false if it can't be parsed
+     */
+    bool loadCascade(const char *xml, int64_t size);
+
+    void setMode(int32_t mode);
+    int32_t getMode() const {return m_mode;}
+
+    /*
+     * Candidate face regions of [rgb]. MotionRegions::full when the
+     * prefilter is off: the whole frame must be scanned
+     */
+    MotionRegions candidates(const cv::Mat &rgb);
+
+private:
+    MotionRegions cascadeCandidates(const cv::Mat &rgb);
+    MotionRegions skinCandidates(const cv::Mat &rgb);
+
+    int32_t m_mode = PREFILTER_NONE;
+    std::unique_ptr<cv::CascadeClassifier> m_cascade;
+};
+
+#endif // FACE_PREFILTER_H
@@ -0,0 +1,121 @@
+#include "face_quality.h"
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+// values giving the best partial score
+#define SHARPNESS_GOOD 100.0f   // Laplacian variance of a sharp chip
+#define SIZE_MIN 40.0f          // face width under which the score is 0
+#define SIZE_GOOD 100.0f        // face width over which the score is 1
+#define YAW_MAX 45.0f           // degrees at which the pose score is 0
+#define PITCH_MAX 35.0f
+
+static float clamp01(float v) {
+    return std::min(1.0f, std::max(0.0f, v));
+}
+
+/*
+ * Estimate yaw and pitch fitting 6 of the 68 landmarks to a generic
+ * 3D face model
+ */
+static void poseFrom68(const dlib::full_object_detection &shape,
+                       cv::Size frameSize,
+                       float &yaw, float &pitch)
+{
+    static const std::vector<cv::Point3d> model = {
+        cv::Point3d(   0.0,    0.0,    0.0),    // 30 nose tip
+        cv::Point3d(   0.0, -330.0,  -65.0),    //  8 chin
+        cv::Point3d(-225.0,  170.0, -135.0),    // 36 left eye left corner
+        cv::Point3d( 225.0,  170.0, -135.0),    // 45 right eye right corner
+        cv::Point3d(-150.0, -150.0, -125.0),    // 48 left mouth corner
+        cv::Point3d( 150.0, -150.0, -125.0)     // 54 right mouth corner
+    };
+    static const int parts[] = {30, 8, 36, 45, 48, 54};
+
+    std::vector<cv::Point2d> image;
+    for (int p : parts)
+        image.push_back(cv::Point2d(shape.part(p).x(), shape.part(p).y()));
+
+    double focal = frameSize.width;
+    cv::Mat camera = (cv::Mat_<double>(3, 3) <<
+                      focal, 0, frameSize.width / 2.0,
+                      0, focal, frameSize.height / 2.0,
+                      0, 0, 1);
+    cv::Mat rvec, tvec;
+    if (!cv::solvePnP(model, image, camera, cv::Mat(), rvec, tvec)) return;
+
+    cv::Mat rot, mtxR, mtxQ;
+    cv::Rodrigues(rvec, rot);
+    cv::Vec3d euler = cv::RQDecomp3x3(rot, mtxR, mtxQ);
+
+    // the model Y axis points up while the image one points down:
+    // a frontal face gives a pitch near +-180
+    double p = euler[0];
+    p = p > 0 ? 180.0 - p : -180.0 - p;
+    pitch = p;
+    yaw = euler[1];
+}
+
+/*
+ * Estimate only the yaw using the nose position between the eyes
+ */
+static void poseFrom5(const dlib::full_object_detection &shape,
+                      float &yaw, float &pitch)
+{
+    double eyeA = (shape.part(0).x() + shape.part(1).x()) / 2.0;
+    double eyeB = (shape.part(2).x() + shape.part(3).x()) / 2.0;
+    if (eyeA == eyeB) return;
+    double t = (shape.part(4).x() - eyeA) / (eyeB - eyeA);
+    yaw = std::asin(std::min(1.0, std::max(-1.0, 2.0 * t - 1.0))) * 180.0 / M_PI;
+    pitch = 0;
+}
+
+FaceQuality faceQuality(const dlib::matrix<dlib::rgb_pixel> &chip,
+                        const dlib::full_object_detection &shape,
+                        cv::Size frameSize)
+{
+    FaceQuality q;
+    if (chip.size() == 0) return q;
+
+    cv::Mat gray(chip.nr(), chip.nc(), CV_8UC1);
+    for (long r = 0; r < chip.nr(); ++r) {
+        uchar *row = gray.ptr<uchar>(r);
+        for (long c = 0; c < chip.nc(); ++c) {
+            const dlib::rgb_pixel &p = chip(r, c);
+            row[c] = (uchar)((p.red * 77 + p.green * 150 + p.blue * 29) >> 8);
+        }
+    }
+
+    // sharpness
+    cv::Mat lap;
+    cv::Laplacian(gray, lap, CV_32F);
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(lap, mean, stddev);
+    q.sharpness = stddev[0] * stddev[0];
+
+    // exposure: penalize dark, bright and clipped chips
+    cv::meanStdDev(gray, mean, stddev);
+    q.exposure = mean[0];
+    int clipped = cv::countNonZero(gray < 10) + cv::countNonZero(gray > 245);
+    float clippedRatio = (float)clipped / gray.total();
+
+    q.size = shape.get_rect().width();
+
+    if (shape.num_parts() == 68)
+        poseFrom68(shape, frameSize, q.yaw, q.pitch);
+    else if (shape.num_parts() == 5)
+        poseFrom5(shape, q.yaw, q.pitch);
+
+    float sharpnessScore = clamp01(q.sharpness / SHARPNESS_GOOD);
+    float sizeScore = clamp01((q.size - SIZE_MIN) / (SIZE_GOOD - SIZE_MIN));
+    // full score for mean levels in [88..168]
+    float exposureScore = clamp01(1.0f - (std::abs(q.exposure - 128.0f) - 40.0f) / 80.0f)
+                          * clamp01(1.0f - clippedRatio * 2.0f);
+    float poseScore = clamp01(1.0f - std::max(std::abs(q.yaw) / YAW_MAX,
+                                              std::abs(q.pitch) / PITCH_MAX));
+
+    q.score = sharpnessScore * sizeScore * exposureScore * poseScore;
+    return q;
+}
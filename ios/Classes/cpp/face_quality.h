@@ -0,0 +1,31 @@
+#ifndef FACE_QUALITY_H
+#define FACE_QUALITY_H
+
+#include <opencv2/core/mat.hpp>
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+#include <dlib/image_processing/full_object_detection.h>
+
+struct FaceQuality {
+    float sharpness = 0;    // variance of the Laplacian of the chip
+    float size = 0;         // face width in source pixels
+    float exposure = 0;     // mean gray level of the chip [0..255]
+    float yaw = 0;          // degrees, 0 = frontal
+    float pitch = 0;        // degrees, 0 = frontal
+    float score = 0;        // overall quality [0..1]
+};
+
+/*
+ * Cheap quality estimation of a face before running the recognition
+ * network on it.
+ * [chip] is the 150x150 aligned face, [shape] the landmarks (68 or 5 points)
+ * in [frameSize] coordinates.
+ * With 68 landmarks yaw and pitch are estimated with cv::solvePnP against a
+ * generic 3D face model, with 5 landmarks only yaw is estimated from the
+ * nose position between the eyes.
+ */
+FaceQuality faceQuality(const dlib::matrix<dlib::rgb_pixel> &chip,
+                        const dlib::full_object_detection &shape,
+                        cv::Size frameSize);
+
+#endif // FACE_QUALITY_H
@@ -0,0 +1,187 @@
+#include "face_shape_predictor.h"
+
+#include <cstring>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define SHAPE_NEON
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SHAPE_F16C
+#endif
+
+namespace {
+
+// finite half floats only, as written by packShapePredictor()
+inline float halfToFloat(uint16_t h)
+{
+    // normal: the exponent rebiased by 127 - 15, subnormal: the mantissa
+    // scaled by 2^-24. No float subnormal, which is slow on some CPUs
+    const uint32_t normal = ((uint32_t)(h & 0x7fff) << 13) + 0x38000000;
+    const float subnormal = (float)(h & 0x3ff) * 5.9604644775390625e-8f;
+    uint32_t bits;
+    memcpy(&bits, &subnormal, sizeof(bits));
+    const uint32_t isNormal = 0u - (uint32_t)((h & 0x7c00) != 0);   // without branch
+    bits = (normal & isNormal) | (bits & ~isNormal);
+    bits |= (uint32_t)(h & 0x8000) << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// shape[k] += v[k], [values] half floats
+typedef void (*HalfAdder)(const uint16_t *v, uint32_t values, float *shape);
+
+void addHalfScalar(const uint16_t *v, uint32_t values, float *shape)
+{
+    for (uint32_t k = 0; k < values; ++k)
+        shape[k] += halfToFloat(v[k]);
+}
+
+#if defined(SHAPE_NEON)
+// the half conversions are part of ARMv8
+void addHalfNeon(const uint16_t *v, uint32_t values, float *shape)
+{
+    uint32_t k = 0;
+    for (; k + 4 <= values; k += 4) {
+        float32x4_t x = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(v + k)));
+        vst1q_f32(shape + k, vaddq_f32(vld1q_f32(shape + k), x));
+    }
+    for (; k < values; ++k)
+        shape[k] += halfToFloat(v[k]);
+}
+#endif
+
+#if defined(SHAPE_F16C)
+// built for F16C whatever the flags of the build, only called when the
+// CPU has AVX2 (all of them have F16C)
+__attribute__((target("avx,f16c")))
+void addHalfF16c(const uint16_t *v, uint32_t values, float *shape)
+{
+    uint32_t k = 0;
+    for (; k + 8 <= values; k += 8) {
+        __m256 x = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + k)));
+        _mm256_storeu_ps(shape + k, _mm256_add_ps(_mm256_loadu_ps(shape + k), x));
+    }
+    for (; k < values; ++k)
+        shape[k] += halfToFloat(v[k]);
+}
+#endif
+
+HalfAdder pickHalfAdder()
+{
+#if defined(SHAPE_NEON)
+    return addHalfNeon;
+#else
+#if defined(SHAPE_F16C)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return addHalfF16c;
+#endif
+    return addHalfScalar;
+#endif
+}
+
+const HalfAdder s_addHalf = pickHalfAdder();
+
+} // namespace
+
+FaceShapePredictor::FaceShapePredictor(const char *data, int64_t size,
+                                       std::shared_ptr<const void> owner)
+    : m_owner(owner)
+{
+    memset(&m_header, 0, sizeof(m_header));
+    if (!isShapePredictorBlob(data, size)
+            || reinterpret_cast<uintptr_t>(data) % sizeof(float) != 0)
+        return;
+    memcpy(&m_header, data, sizeof(m_header));
+    const ShapeBlobHeader &h = m_header;
+    if (h.version != SHAPE_BLOB_VERSION || h.leafEncoding >= SHAPE_LEAVES_COUNT
+            || h.parts == 0 || h.treeDepth > 16 || h.size > (uint64_t)size)
+        return;
+
+    const uint64_t leaves = (uint64_t)1 << h.treeDepth;
+    const uint64_t values = 2 * (uint64_t)h.parts;
+    const uint64_t leafSize = values * (h.leafEncoding == SHAPE_LEAVES_FP16 ? sizeof(uint16_t) :
+                                        h.leafEncoding == SHAPE_LEAVES_INT8 ? sizeof(int8_t) :
+                                        sizeof(float));
+    // [count] items of [bytes] at the aligned [offset], inside the blob
+    auto inside = [&h](uint64_t offset, uint64_t count, uint64_t bytes) {
+        return offset % SHAPE_BLOB_ALIGNMENT == 0 && offset >= sizeof(h)
+               && offset <= h.size && count <= (h.size - offset) / bytes;
+    };
+    if (!inside(h.shapeOffset, values, sizeof(float))
+            || !inside(h.cascadeOffset, h.cascadeCount, sizeof(ShapeBlobCascade))
+            || !inside(h.featureOffset, h.featureCount, sizeof(ShapeBlobFeature))
+            || !inside(h.splitOffset, h.treeCount * (leaves - 1), sizeof(ShapeBlobSplit))
+            || !inside(h.leafOffset, h.treeCount * leaves, leafSize)
+            || (h.leafEncoding == SHAPE_LEAVES_INT8
+                && !inside(h.scaleOffset, h.treeCount * leaves, sizeof(float))))
+        return;
+    m_cascades = reinterpret_cast<const ShapeBlobCascade *>(data + h.cascadeOffset);
+    m_features = reinterpret_cast<const ShapeBlobFeature *>(data + h.featureOffset);
+    m_splits = reinterpret_cast<const ShapeBlobSplit *>(data + h.splitOffset);
+    m_leaves = data + h.leafOffset;
+    if (h.leafEncoding == SHAPE_LEAVES_INT8)
+        m_scales = reinterpret_cast<const float *>(data + h.scaleOffset);
+
+    // the indexes read by operator(): one pass over the features and the
+    // splits, the leaves are only read when they are reached
+    for (uint32_t i = 0; i < h.featureCount; ++i)
+        if (m_features[i].anchor >= h.parts) return;
+    for (uint32_t c = 0; c < h.cascadeCount; ++c) {
+        const ShapeBlobCascade &cascade = m_cascades[c];
+        if ((uint64_t)cascade.firstTree + cascade.treeCount > h.treeCount
+                || (uint64_t)cascade.firstFeature + cascade.featureCount > h.featureCount)
+            return;
+        const ShapeBlobSplit *s = m_splits + (uint64_t)cascade.firstTree * (leaves - 1);
+        const uint64_t splits = (uint64_t)cascade.treeCount * (leaves - 1);
+        for (uint64_t i = 0; i < splits; ++i)
+            if (s[i].idx1 >= cascade.featureCount || s[i].idx2 >= cascade.featureCount)
+                return;
+    }
+
+    m_initialShape.set_size(values);
+    memcpy(&m_initialShape(0), data + h.shapeOffset, values * sizeof(float));
+    m_valid = true;
+}
+
+void FaceShapePredictor::addTrees(const ShapeBlobCascade &cascade,
+                                  const float *features, float *shape) const
+{
+    const uint32_t leaves = 1u << m_header.treeDepth;
+    const uint32_t splits = leaves - 1;
+    const uint32_t values = 2 * m_header.parts;
+    const uint32_t end = cascade.firstTree + cascade.treeCount;
+    for (uint32_t t = cascade.firstTree; t < end; ++t) {
+        const ShapeBlobSplit *s = m_splits + (uint64_t)t * splits;
+        uint32_t i = 0;
+        while (i < splits) {
+            if (features[s[i].idx1] - features[s[i].idx2] > s[i].thresh)
+                i = 2 * i + 1;
+            else
+                i = 2 * i + 2;
+        }
+        const uint64_t leaf = (uint64_t)t * leaves + i - splits;
+
+        switch (m_header.leafEncoding) {
+            case SHAPE_LEAVES_FP32: {
+                const float *v = reinterpret_cast<const float *>(m_leaves) + leaf * values;
+                for (uint32_t k = 0; k < values; ++k)
+                    shape[k] += v[k];
+                break;
+            }
+            case SHAPE_LEAVES_FP16:
+                s_addHalf(reinterpret_cast<const uint16_t *>(m_leaves) + leaf * values,
+                          values, shape);
+                break;
+            default: {
+                const int8_t *v = reinterpret_cast<const int8_t *>(m_leaves) + leaf * values;
+                const float scale = m_scales[leaf];
+                for (uint32_t k = 0; k < values; ++k)
+                    shape[k] += v[k] * scale;
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef FACE_SHAPE_PREDICTOR_H
+#define FACE_SHAPE_PREDICTOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <dlib/image_processing.h>
+#include "shape_predictor_blob.h"
+
+/*
+ * Landmarks of the pipelines: the cascades of regression trees of a
+ * dlib::shape_predictor, evaluated in place from the tables of a blob
+ * (shape_predictor_blob.h), ie. from its memory map.
+ * The landmarks are dlib's with SHAPE_LEAVES_FP32 (a .dat model packed
+ * when it's loaded), within a fraction of a pixel with the compact
+ * encodings (see benchShapePredictorBlob() in the benchmark). The half
+ * float leaves are converted by NEON on ARM64, by F16C on x86 CPUs with
+ * AVX2.
+ * Can be used by many threads at once
+ */
+class FaceShapePredictor
+{
+public:
+    /*
+     * Predictor reading the blob [data], kept alive by [owner] (its
+     * MappedFile or buffer). isValid() is false if the blob is truncated
+     * or inconsistent
+     */
+    FaceShapePredictor(const char *data, int64_t size, std::shared_ptr<const void> owner);
+
+    bool isValid() const {return m_valid;}
+    unsigned long num_parts() const {return m_header.parts;}
+    int32_t leafEncoding() const {return m_header.leafEncoding;}
+    // bytes of the blob
+    int64_t size() const {return m_header.size;}
+
+    // landmarks of the face [rect] of [img], as dlib::shape_predictor
+    template <typename image_type>
+    dlib::full_object_detection operator()(const image_type &img,
+                                           const dlib::rectangle &rect) const
+    {
+        dlib::matrix<float,0,1> shape = m_initialShape;
+        const dlib::point_transform_affine toImage = dlib::impl::unnormalizing_tform(rect);
+        const dlib::rectangle area = dlib::get_rect(img);
+        dlib::const_image_view<image_type> view(img);
+        std::vector<float> features;
+        for (uint32_t c = 0; c < m_header.cascadeCount; ++c) {
+            const ShapeBlobCascade &cascade = m_cascades[c];
+            // the pixels of the cascade, moved with the current shape
+            const dlib::matrix<float,2,2> tform = dlib::matrix_cast<float>(
+                    dlib::impl::find_tform_between_shapes(m_initialShape, shape).get_m());
+            const ShapeBlobFeature *f = m_features + cascade.firstFeature;
+            features.resize(cascade.featureCount);
+            for (uint32_t i = 0; i < cascade.featureCount; ++i) {
+                dlib::point p = toImage(tform * dlib::vector<float,2>(f[i].dx, f[i].dy)
+                                        + dlib::impl::location(shape, f[i].anchor));
+                if (area.contains(p))
+                    features[i] = dlib::get_pixel_intensity(view[p.y()][p.x()]);
+                else
+                    features[i] = 0;
+            }
+            addTrees(cascade, features.data(), &shape(0));
+        }
+
+        std::vector<dlib::point> parts(m_header.parts);
+        for (unsigned long i = 0; i < parts.size(); ++i)
+            parts[i] = toImage(dlib::impl::location(shape, i));
+        return dlib::full_object_detection(rect, parts);
+    }
+
+private:
+    // add the leaves reached in the trees of [cascade] by its [features] to [shape]
+    void addTrees(const ShapeBlobCascade &cascade, const float *features, float *shape) const;
+
+    std::shared_ptr<const void> m_owner;
+    ShapeBlobHeader m_header;
+    bool m_valid = false;
+    dlib::matrix<float,0,1> m_initialShape;
+    const ShapeBlobCascade *m_cascades = nullptr;
+    const ShapeBlobFeature *m_features = nullptr;
+    const ShapeBlobSplit *m_splits = nullptr;
+    const char *m_leaves = nullptr;
+    const float *m_scales = nullptr;
+};
+
+#endif // FACE_SHAPE_PREDICTOR_H
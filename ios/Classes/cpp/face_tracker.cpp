@@ -0,0 +1,119 @@
+#include "face_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <dlib/matrix.h>
+#include <dlib/optimization/max_cost_assignment.h>
+
+// the assignment solver needs integer costs
+#define SCORE_SCALE 1000
+
+FaceTracker::FaceTracker()
+{
+}
+
+bool FaceTracker::hasTrack(int32_t id) const {
+    for (const auto &track : m_tracks)
+        if (track.id == id) return true;
+    return false;
+}
+
+void FaceTracker::clear() {
+    m_tracks.clear();
+}
+
+/*
+ * Return the similarity [0..1] between [track] and a detection.
+ * It is the IoU of the rectangles, or the landmarks similarity if
+ * this is better (ie. fast moving faces where the rectangles barely overlap)
+ */
+float FaceTracker::score(const FaceTrack &track,
+                         const dlib::rectangle &rect,
+                         const dlib::full_object_detection *shape) const
+{
+    float inter = track.rect.intersect(rect).area();
+    float uni = track.rect.area() + rect.area() - inter;
+    float iou = uni > 0 ? inter / uni : 0;
+
+    if (shape == nullptr ||
+            shape->num_parts() == 0 ||
+            shape->num_parts() != track.landmarks.size())
+        return iou;
+
+    double dist = 0;
+    for (unsigned long n = 0; n < shape->num_parts(); ++n)
+        dist += dlib::length(shape->part(n) - track.landmarks[n]);
+    dist /= shape->num_parts();
+
+    // a mean displacement of half the face diagonal gives no similarity
+    double diag = std::sqrt((double)track.rect.width() * track.rect.width() +
+                            (double)track.rect.height() * track.rect.height());
+    float landmarksScore = diag > 0 ? std::max(0.0, 1.0 - dist / (diag * 0.5)) : 0;
+
+    return std::max(iou, landmarksScore);
+}
+
+std::vector<int32_t> FaceTracker::update(
+        const std::vector<dlib::rectangle> &detections,
+        const std::vector<dlib::full_object_detection> *shapes)
+{
+    std::vector<int32_t> ids(detections.size(), -1);
+    std::vector<bool> trackMatched(m_tracks.size(), false);
+
+    if (!m_tracks.empty() && !detections.empty()) {
+        // max_cost_assignment needs a square matrix: pad with zero scores
+        long n = std::max(m_tracks.size(), detections.size());
+        dlib::matrix<long> cost = dlib::zeros_matrix<long>(n, n);
+        for (size_t t = 0; t < m_tracks.size(); ++t) {
+            for (size_t d = 0; d < detections.size(); ++d) {
+                cost(t, d) = std::lround(SCORE_SCALE *
+                        score(m_tracks[t], detections[d],
+                              shapes == nullptr ? nullptr : &(*shapes)[d]));
+            }
+        }
+
+        std::vector<long> assignment = dlib::max_cost_assignment(cost);
+        for (size_t t = 0; t < m_tracks.size(); ++t) {
+            size_t d = assignment[t];
+            if (d >= detections.size() ||
+                    cost(t, d) < m_minScore * SCORE_SCALE)
+                continue;
+            ids[d] = m_tracks[t].id;
+            trackMatched[t] = true;
+        }
+    }
+
+    // update matched tracks and age the others
+    for (size_t t = 0; t < m_tracks.size(); ++t) {
+        m_tracks[t].age++;
+        if (!trackMatched[t]) m_tracks[t].missedFrames++;
+    }
+    for (size_t d = 0; d < detections.size(); ++d) {
+        FaceTrack *track = nullptr;
+        if (ids[d] == -1) {
+            m_tracks.push_back(FaceTrack());
+            track = &m_tracks.back();
+            track->id = m_nextId++;
+            ids[d] = track->id;
+        } else {
+            for (auto &t : m_tracks)
+                if (t.id == ids[d]) track = &t;
+        }
+        track->rect = detections[d];
+        track->missedFrames = 0;
+        track->landmarks.clear();
+        if (shapes != nullptr) {
+            for (unsigned long n = 0; n < (*shapes)[d].num_parts(); ++n)
+                track->landmarks.push_back((*shapes)[d].part(n));
+        }
+    }
+
+    // forget faces not seen for a while
+    m_tracks.erase(std::remove_if(m_tracks.begin(), m_tracks.end(),
+                        [this](const FaceTrack &t) {
+                            return t.missedFrames > m_maxMissedFrames;
+                        }),
+                   m_tracks.end());
+
+    return ids;
+}
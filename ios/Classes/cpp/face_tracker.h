@@ -0,0 +1,67 @@
+#ifndef FACE_TRACKER_H
+#define FACE_TRACKER_H
+
+#include <cstdint>
+#include <vector>
+#include <dlib/geometry/rectangle.h>
+#include <dlib/image_processing/full_object_detection.h>
+
+struct FaceTrack {
+    int32_t id;                    // persistent id returned to the caller
+    dlib::rectangle rect;          // last rectangle seen for this face
+    std::vector<dlib::point> landmarks; // last landmarks seen (can be empty)
+    int32_t missedFrames = 0;      // consecutive frames without a detection
+    int32_t age = 0;               // frames since the track was created
+};
+
+/*
+ * Associate the faces found in consecutive frames so that every person keeps
+ * the same id while in front of the camera.
+ * Detections are matched to the existing tracks maximizing the IoU of the
+ * rectangles (or the landmarks similarity when available) with the
+ * Hungarian algorithm (dlib::max_cost_assignment).
+ */
+class FaceTracker
+{
+public:
+    FaceTracker();
+
+    /*
+     * Minimum score [0..1] a detection must have with a track to be
+     * considered the same face
+     */
+    void setMinScore(float minScore) {m_minScore = minScore;}
+
+    /*
+     * Number of consecutive frames a track is kept alive without detections
+     */
+    void setMaxMissedFrames(int32_t maxMissedFrames)
+        {m_maxMissedFrames = maxMissedFrames;}
+
+    /*
+     * Match [detections] with the current tracks and return the track id
+     * of each detection. [shapes], if not null, must have the same size of
+     * [detections] and are used to refine the matching score.
+     */
+    std::vector<int32_t> update(
+            const std::vector<dlib::rectangle> &detections,
+            const std::vector<dlib::full_object_detection> *shapes = nullptr);
+
+    const std::vector<FaceTrack> &getTracks() const {return m_tracks;}
+
+    bool hasTrack(int32_t id) const;
+
+    void clear();
+
+private:
+    float score(const FaceTrack &track,
+                const dlib::rectangle &rect,
+                const dlib::full_object_detection *shape) const;
+
+    std::vector<FaceTrack> m_tracks;
+    int32_t m_nextId = 1;
+    float m_minScore = 0.3f;
+    int32_t m_maxMissedFrames = 5;
+};
+
+#endif // FACE_TRACKER_H
@@ -1,42 +1,80 @@
 #include "facedetector.h"
 #include "common.h"
 #include "face_common.h"
+#include "face_models.h"
+#include "pipeline_stats.h"
+#include "task_scheduler.h"
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/mat.hpp>
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/opencv.h>
 
-size_t FixedQueue::m_size = 1;
-
 FaceDetector::FaceDetector()
 {
 }
 
 void FaceDetector::initShapePredictor(char *sp, int64_t size) {
-    // We need a face detector.  We will use this to get bounding boxes for
-    // each face in an image.
-    detector = dlib::get_frontal_face_detector();
-
-    std::vector<int8_t> data(sp, sp + size);
-
     // And we also need a shape_predictor.  This is the tool that will predict face
     // landmark positions given an image and face bounding box.  Here we are just
     // loading the model from the shape_predictor_68_face_landmarks.dat file you gave
     // as a command line argument.
-    dlib::deserialize(data) >> shapePredictor;
+    setShapePredictor(loadShapePredictor(sp, size));
 }
 
-void FaceDetector::initShapePredictor(std::string pathToShapePredictor) {
-    // We need a face detector.  We will use this to get bounding boxes for
-    // each face in an image.
-    detector = dlib::get_frontal_face_detector();
-
+bool FaceDetector::initShapePredictor(std::string pathToShapePredictor) {
     // And we also need a shape_predictor.  This is the tool that will predict face
     // landmark positions given an image and face bounding box.  Here we are just
     // loading the model from the shape_predictor_68_face_landmarks.dat file you gave
     // as a command line argument.
-    dlib::deserialize(pathToShapePredictor) >> shapePredictor;
+    // the file is memory mapped, a .dat model or a blob (see
+    // shape_predictor_blob.h)
+    std::shared_ptr<const FaceShapePredictor> sp = loadShapePredictorFile(pathToShapePredictor);
+    setShapePredictor(sp);
+    return sp != nullptr;
+}
+
+void FaceDetector::setShapePredictor(
+        std::shared_ptr<const FaceShapePredictor> sp) {
+    // We need a face detector.  We will use this to get bounding boxes for
+    // each face in an image.
+    if (!m_backend) setBackend(BackendConfig());
+    shapePredictor = sp;
+}
+
+bool FaceDetector::setBackend(const BackendConfig &config) {
+    std::unique_ptr<DetectorBackend> backend = createDetectorBackend(config);
+    if (!backend) return false;
+    backend->setPyramidLevels(m_pyramidLevels);
+    m_backend = std::move(backend);
+    return true;
+}
+
+void FaceDetector::setPyramidLevels(int32_t levels) {
+    m_pyramidLevels = levels < 0 ? 0 : levels;
+    if (m_backend) m_backend->setPyramidLevels(m_pyramidLevels);
+}
+
+std::vector<dlib::rectangle> FaceDetector::detectRects(cv::Mat &src) {
+    if (!m_backend) return std::vector<dlib::rectangle>();
+    if (m_detectScale <= 0 || m_detectScale >= 1)
+        return detectionRects(m_backend->detect(src));
+
+    cv::Mat small;
+    cv::resize(src, small, cv::Size(), m_detectScale, m_detectScale,
+               cv::INTER_AREA);
+    std::vector<dlib::rectangle> faces = detectionRects(m_backend->detect(small));
+    for (auto &r : faces)
+        r = dlib::rectangle(r.left() / m_detectScale, r.top() / m_detectScale,
+                            r.right() / m_detectScale, r.bottom() / m_detectScale);
+    return faces;
+}
+
+static dlib::dpoint centroid(const dlib::full_object_detection &shape) {
+    dlib::dpoint c(0, 0);
+    for (unsigned long i = 0; i < shape.num_parts(); ++i)
+        c += shape.part(i);
+    return shape.num_parts() ? c / (double)shape.num_parts() : c;
 }
 
 
@@ -126,20 +164,90 @@ void FaceDetector::getFacePosePoints(cv::Mat &src,
 
     dlib::cv_image<dlib::rgb_pixel> imgBig(src);
 
-    std::vector<dlib::rectangle> faces = detector(imgBig);
+    std::vector<dlib::rectangle> faces;
+    // landmarks of [faces] in the previous frame when tracking
+    std::vector<dlib::full_object_detection> lastShapes;
+    std::vector<dlib::full_object_detection> faceShapes;
+    // the detection and the landmarks on the fast cores
+    TaskScheduler::instance().runPlaced([&]() {
+        // a static scene keeps the faces of the previous frame
+        MotionRegions motion = m_motionGate.update(src);
+        bool still = !motion.full && motion.rects.empty();
+        if (still) STATS_COUNT(COUNTER_MOTION_SKIPS, 1);
+
+        if (!still && (m_detectInterval <= 1 || m_framesToDetect <= 0
+                       || !tracksLandmarks())) {
+            STATS_SCOPE(STAGE_DETECT);
+            std::vector<dlib::rectangle> tracked;
+            for (auto &s : shapes)
+                if (s.found) tracked.push_back(s.rects);
+            if (motion.full && m_prefilter.getMode() != PREFILTER_NONE) {
+                STATS_SCOPE(STAGE_PREFILTER);
+                motion = m_prefilter.candidates(src);
+            }
+            faces = detectInRegions(src, motion, tracked,
+                    [this](cv::Mat &img) {return detectRects(img);});
+            m_framesToDetect = m_detectInterval - 1;
+        } else {
+            // follow the faces found in the previous frame
+            for (auto &s : shapes) {
+                if (!s.found) continue;
+                faces.push_back(s.rects);
+                lastShapes.push_back(s.shapes);
+            }
+            m_framesToDetect--;
+        }
+        STATS_COUNT(COUNTER_FACES, faces.size());
 
-//    shapes.size must be the same of faces.size
-    if (shapes.size() != faces.size()) {
-        for (size_t i=0; i< std::max(shapes.size(), faces.size()); i++) {
-            if (faces.size() > shapes.size())
-                shapes.push_back(Shapes());
-            else {
-                if (faces.size() != shapes.size())
-                    shapes.pop_back();
+        // Landmark detection on small image
+        if (!m_getOnlyRectangle && shapePredictor) {
+            for (unsigned long i = 0; i < faces.size(); ++i) {
+                STATS_SCOPE(STAGE_LANDMARKS);
+                faceShapes.push_back((*shapePredictor)(imgBig, faces[i]));
             }
         }
+    }, PRIORITY_LATENCY);
+
+    // a tracked rectangle moves with its landmarks
+    for (unsigned long i = 0; i < lastShapes.size() && i < faceShapes.size(); ++i) {
+        if (lastShapes[i].num_parts() != faceShapes[i].num_parts()) continue;
+        dlib::dpoint shift = centroid(faceShapes[i]) - centroid(lastShapes[i]);
+        faces[i] = dlib::translate_rect(faces[i], dlib::point(shift));
     }
 
+    // Give each face the id of the track it belongs to, so the per-face
+    // state (ie. the anti-shake queue) follows the same person even if
+    // dlib returns the faces in a different order
+    std::vector<int32_t> ids;
+    {
+        STATS_SCOPE(STAGE_TRACK);
+        ids = m_tracker.update(
+                faces, faceShapes.empty() ? nullptr : &faceShapes);
+    }
+
+    std::vector<Shapes> newShapes(faces.size());
+    for (unsigned long i = 0; i < faces.size(); ++i) {
+        for (auto &s : shapes) {
+            if (s.trackId == ids[i]) {
+                newShapes[i] = std::move(s);
+                break;
+            }
+        }
+        newShapes[i].trackId = ids[i];
+        newShapes[i].found = true;
+        newShapes[i].antiShakeQueue.setSize(getSmoothingSamples());
+    }
+    // keep the state of faces temporarily lost by the detector
+    for (auto &s : shapes) {
+        if (s.trackId == -1 || !m_tracker.hasTrack(s.trackId)) continue;
+        bool alreadyFound = false;
+        for (auto id : ids) alreadyFound |= (id == s.trackId);
+        if (alreadyFound) continue;
+        s.found = false;
+        newShapes.push_back(std::move(s));
+    }
+    shapes = std::move(newShapes);
+
     // std::cout<<"NATIVE********" << "FACES found: "<< faces.size() <<
     //            " - SHAPES:" << shapes.size() <<
     //            std::endl;
@@ -147,9 +255,8 @@ void FaceDetector::getFacePosePoints(cv::Mat &src,
     // Find the pose of each face.
     for (unsigned long i = 0; i < faces.size(); ++i)
     {
-        // Landmark detection on small image
-        if (!m_getOnlyRectangle)
-            shapes[i].shapes   = shapePredictor(imgBig, faces[i]);
+        if (!faceShapes.empty())
+            shapes[i].shapes   = faceShapes[i];
 
         shapes[i].rects    = faces[i];
         shapes[i].r        = cv::Rect(cv::Point(faces[i].left(),faces[i].top()),
@@ -183,6 +290,17 @@ void FaceDetector::getFacePosePoints(cv::Mat &src,
 
 }
 
+/*
+ * Return the track ids of the first [faceCount] faces found by the last
+ * getFacePosePoints() call, in the same order of the returned points
+ */
+std::vector<int32_t> FaceDetector::getTrackIds(int32_t faceCount) {
+    std::vector<int32_t> ids;
+    for (int32_t i = 0; i < faceCount && i < (int32_t)shapes.size(); ++i)
+        ids.push_back(shapes[i].trackId);
+    return ids;
+}
+
 /*
  *
  */
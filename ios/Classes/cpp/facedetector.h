@@ -4,11 +4,16 @@
 #include "common.h"
 #include "fixed_queue.h"
 #include "face_common.h"
+#include "face_tracker.h"
+#include "motion_gate.h"
+#include "face_prefilter.h"
+#include "face_backend.h"
 
 #include <opencv2/core/mat.hpp>
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/image_processing.h>
 #include <stdio.h>
+#include <memory>
 
 
 struct Shapes {
@@ -18,7 +23,8 @@ struct Shapes {
     cv::Mat skinMask;                   // skin Mat representing the face skin (not used yet)
     cv::Rect r;                         // enlarged rect to fit whole head (not used yet)
     FixedQueue antiShakeQueue;
-    bool found;
+    int32_t trackId = -1;               // persistent id given by FaceTracker
+    bool found;                         // true if detected in the last frame
 };
 
 
@@ -26,22 +32,82 @@ class FaceDetector : public FaceCommon
 {
 public:
     FaceDetector();
-    void initShapePredictor(std::string pathToShapePredictor);
+    // return false if the model can't be loaded
+    bool initShapePredictor(std::string pathToShapePredictor);
     void initShapePredictor(char *sp, int64_t size);
 
+    /*
+     * Use a shape predictor shared with other detectors
+     */
+    void setShapePredictor(std::shared_ptr<const FaceShapePredictor> sp);
+
+    /*
+     * Detector backend (see face_backend.h), HOG by default. The
+     * landmarks still come from the shape predictor.
+     * Return false if the model of [config] can't be loaded: the backend
+     * is then unchanged
+     */
+    bool setBackend(const BackendConfig &config);
+
     void setAntiShakeSamples(int32_t antiShakeSamples)
     {
-        FixedQueue().setSize(antiShakeSamples);
+        m_antiShakeSamples = antiShakeSamples;
+        for (auto &s : shapes)
+            s.antiShakeQueue.setSize(getSmoothingSamples());
     };
 
+    int32_t getAntiShakeSamples() {return m_antiShakeSamples;}
+
+    /*
+     * Cost knobs, set by QualityGovernor.
+     * [scale] (<= 1) resizes the image for the detector only: the
+     * points keep the coordinates of the adjusted source.
+     * [levels] limits the HOG pyramid levels (0 = all): the largest faces
+     * are missed with few levels.
+     * With [interval] > 1 the detector runs every [interval] frames and
+     * the frames between follow the faces of the previous frame with the
+     * landmarks only. Ignored without landmarks (see tracksLandmarks()):
+     * the rectangles would freeze between detections.
+     * [samples] caps the anti-shake samples (0 = no cap)
+     */
+    void setDetectScale(double scale) {m_detectScale = scale;}
+    void setPyramidLevels(int32_t levels);
+    void setDetectInterval(int32_t interval) {m_detectInterval = interval;}
+    void setSmoothingLimit(int32_t samples) {m_smoothingLimit = samples;}
+
+    /*
+     * Skip the detection of unchanged frames and scan only the changed
+     * regions and the tracked faces of the others (see motion_gate.h)
+     */
+    void setMotionGate(bool enabled) {m_motionGate.setEnabled(enabled);}
+    void setMotionThreshold(int32_t threshold)
+        {m_motionGate.setThreshold(threshold);}
+
+    /*
+     * Coarse-to-fine detection: the frames scanned in full are first
+     * reduced to the candidates of a cheap prefilter (PrefilterMode) and
+     * the HOG detector only verifies them (see face_prefilter.h).
+     * PREFILTER_CASCADE needs loadPrefilterCascade()
+     */
+    void setPrefilter(int32_t mode) {m_prefilter.setMode(mode);}
+    bool loadPrefilterCascade(const char *xml, int64_t size)
+        {return m_prefilter.loadCascade(xml, size);}
+
     void setGetOnlyRectangle(bool onlyRect) {
         m_getOnlyRectangle = onlyRect;
+        shapes.clear();
+        m_tracker.clear();
     }
 
     bool getGetOnlyRectangle() {
         return m_getOnlyRectangle;
     }
 
+    // true if the frames between detections can follow the landmarks
+    bool tracksLandmarks() {
+        return !m_getOnlyRectangle && shapePredictor != nullptr;
+    }
+
     void adjustSource(cv::Mat &src);
 
     void getFacePosePoints(cv::Mat &src,
@@ -53,18 +119,40 @@ public:
                      const std::vector<int32_t> points,
                      const int numberOfFacePoints);
 
+    // ids of the faces returned by the last getFacePosePoints() call
+    std::vector<int32_t> getTrackIds(int32_t faceCount);
+
+    // faces found in the last frame first, then the ones still tracked
+    // but not detected (found == false)
     std::vector<Shapes> shapes;
 
 private:
+    // HOG detection at m_detectScale, in adjusted source coordinates
+    std::vector<dlib::rectangle> detectRects(cv::Mat &src);
+
+    int32_t getSmoothingSamples() {
+        return m_smoothingLimit > 0 && m_smoothingLimit < m_antiShakeSamples
+                ? m_smoothingLimit : m_antiShakeSamples;
+    }
+
     void draw_polyline(cv::Mat &img,
                        const std::vector<int32_t> points,
                        const int start, const int end,
                        bool isClosed = false);
 
 
-    dlib::frontal_face_detector detector;
-    dlib::shape_predictor shapePredictor;
+    std::unique_ptr<DetectorBackend> m_backend;
+    std::shared_ptr<const FaceShapePredictor> shapePredictor;
+    FaceTracker m_tracker;
+    int32_t m_antiShakeSamples = 1;
     bool m_getOnlyRectangle = true;
+    double m_detectScale = 1;
+    int32_t m_pyramidLevels = 0;
+    int32_t m_detectInterval = 1;
+    int32_t m_framesToDetect = 0;
+    int32_t m_smoothingLimit = 0;
+    MotionGate m_motionGate;
+    FacePrefilter m_prefilter;
 };
 
 #endif // FACEDETECTOR_H
@@ -1,18 +1,29 @@
 #include "facerecognition.h"
+#include "face_quality.h"
+#include "face_models.h"
+#include "pipeline_stats.h"
+#include "task_scheduler.h"
 
 #include <atomic>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/mat.hpp>
 #include <dlib/image_io.h>
 #include <dlib/opencv.h>
 #include <dlib/dnn.h>
 #include <dlib/misc_api.h>
+#include <dlib/threads.h>
 
 using namespace dlib;
 using namespace std;
 
 // threshold under which a face is considered matched
 #define LENGTH_THRESHOLD 0.6
+// gallery faces compared by one task of matchFaces()
+#define MATCH_CHUNK 4096
+// gallery faces calibrating setPrecision(), and jittered copies of each
+#define CALIBRATION_FACES 32
+#define CALIBRATION_JITTER 3
 
 FaceRecognition::FaceRecognition()
 {
@@ -20,32 +31,99 @@ FaceRecognition::FaceRecognition()
 
 void FaceRecognition::initFaceRecognition(char *sp, int64_t spSize,
                                           char *fr, int64_t frSize) {
-    // We need a face detector.  We will use this to get bounding boxes for
-    // each face in an image.
-    detector = get_frontal_face_detector();
-
     // And we also need a shape_predictor.  This is the tool that will predict face
     // landmark positions given an image and face bounding box.  Here we are just
     // loading the model from the shape_predictor_68_face_landmarks.dat file you gave
     // as a command line argument.
-    std::vector<int8_t> data(sp, sp + spSize);
-    deserialize(data) >> shapePredictor;
-    data = std::vector<int8_t>(fr, fr + frSize);
-    deserialize(data) >> net;
+    setModels(loadShapePredictor(sp, spSize), loadFaceNet(fr, frSize));
 }
 
-void FaceRecognition::initFaceRecognition(std::string pathToShapePredictor,
+bool FaceRecognition::initFaceRecognition(std::string pathToShapePredictor,
                                           std::string pathToFaceRecognition) {
-    // We need a face detector. We will use this to get bounding boxes for
-    // each face in an image.
-    detector = get_frontal_face_detector();
-
     // And we also need a shape_predictor.  This is the tool that will predict face
     // landmark positions given an image and face bounding box.  Here we are just
     // loading the model from the shape_predictor_68_face_landmarks.dat file you gave
     // as a command line argument.
-    deserialize(pathToShapePredictor) >> shapePredictor;
-    deserialize(pathToFaceRecognition) >> net;
+    // the files are memory mapped, .dat models or blobs (see
+    // shape_predictor_blob.h and face_net_blob.h)
+    std::shared_ptr<const FaceShapePredictor> sp = loadShapePredictorFile(pathToShapePredictor);
+    std::shared_ptr<const anet_type> fr = loadFaceNetFile(pathToFaceRecognition);
+    setModels(sp, fr);
+    return sp != nullptr && fr != nullptr;
+}
+
+void FaceRecognition::setModels(std::shared_ptr<const FaceShapePredictor> sp,
+                                std::shared_ptr<const anet_type> fr) {
+    BackendConfig config;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        shapePredictor = sp;
+        net = fr;
+        config = m_backends;
+    }
+    if (!setBackends(config)) {
+        // a backend model which can't be loaded anymore
+        setBackends(BackendConfig());
+    }
+}
+
+bool FaceRecognition::setBackends(const BackendConfig &config) {
+    // We need a face detector. We will use this to get bounding boxes for
+    // each face in an image.
+    std::unique_ptr<DetectorBackend> detector = createDetectorBackend(config);
+    std::shared_ptr<const FaceShapePredictor> sp;
+    std::shared_ptr<const anet_type> fr;
+    {
+        std::unique_lock<std::mutex> guard = timedLock(_mutex);
+        sp = shapePredictor;
+        fr = net;
+    }
+    std::shared_ptr<RecognizerBackend> recognizer = createRecognizerBackend(config, sp, fr);
+    // the ResNet backend only waits for initFaceRecognition()
+    if (!detector || (!recognizer && config.recognizer != RECOGNIZER_BACKEND_RESNET))
+        return false;
+
+    {
+        std::unique_lock<std::mutex> guard = timedLock(m_detectorMutex);
+        m_detector = std::move(detector);
+    }
+    std::unique_lock<std::mutex> guard = timedLock(_mutex);
+    m_recognizer = recognizer;
+    m_backends = config;
+    m_cache.clear();
+    return true;
+}
+
+bool FaceRecognition::setPrecision(int32_t precision,
+                                   const std::vector<GalleryFace> &gallery,
+                                   QuantizationReport &report) {
+    report = QuantizationReport();
+    report.precision = precision;
+    std::shared_ptr<RecognizerBackend> recognizer = getRecognizer();
+    if (!recognizer) return false;
+
+    // the chips and their jittered copies, one on two held out
+    std::vector<matrix<rgb_pixel>> calibration, heldOut;
+    size_t n = 0;
+    for (size_t i = 0; i < gallery.size() && i < CALIBRATION_FACES; ++i) {
+        const matrix<rgb_pixel> &chip = gallery[i].faceDlib;
+        if (chip.size() == 0) continue;
+        std::vector<matrix<rgb_pixel>> copies = jitter_image(chip, CALIBRATION_JITTER);
+        copies.push_back(chip);
+        for (auto &c : copies)
+            (n++ % 2 == 0 ? calibration : heldOut).push_back(std::move(c));
+    }
+    if (!recognizer->setPrecision(precision, calibration, heldOut,
+                                  LENGTH_THRESHOLD, report))
+        return false;
+    std::unique_lock<std::mutex> guard = timedLock(_mutex);
+    m_cache.clear();
+    return true;
+}
+
+std::shared_ptr<RecognizerBackend> FaceRecognition::getRecognizer() {
+    std::unique_lock<std::mutex> guard = timedLock(_mutex);
+    return m_recognizer;
 }
 
 
@@ -179,7 +257,11 @@ void FaceRecognition::train(string dir)
     // mini-batches into dlib::pipes.
     dlib::pipe<std::vector<matrix<rgb_pixel>>> qimages(4);
     dlib::pipe<std::vector<unsigned long>> qlabels(4);
-    auto data_loader = [&qimages, &qlabels, &objs](time_t seed, FaceRecognition *me)
+    // The loaders block on the full pipes for the whole training, so they
+    // own threads rather than holding scheduler workers. The lock keeps the
+    // images and the labels of a batch together
+    std::mutex enqueueMutex;
+    auto data_loader = [this, &qimages, &qlabels, &objs, &enqueueMutex](time_t seed)
     {
         dlib::rand rnd(time(0)+seed);
         std::vector<matrix<rgb_pixel>> images;
@@ -188,9 +270,10 @@ void FaceRecognition::train(string dir)
         {
             try
             {
-                me->load_mini_batch(5, 5, rnd, objs, images, labels);
-                qimages.enqueue(images);
-                qlabels.enqueue(labels);
+                load_mini_batch(5, 5, rnd, objs, images, labels);
+                std::lock_guard<std::mutex> guard(enqueueMutex);
+                if (qimages.enqueue(images))
+                    qlabels.enqueue(labels);
             }
             catch(std::exception& e)
             {
@@ -199,13 +282,26 @@ void FaceRecognition::train(string dir)
             }
         }
     };
+    // Disables the pipes and joins the loaders however train() returns,
+    // so that a throwing train_one_step() or serialize() doesn't leave
+    // them blocked
+    struct Loaders {
+        Loaders(dlib::pipe<std::vector<matrix<rgb_pixel>>> &images,
+                dlib::pipe<std::vector<unsigned long>> &labels)
+            : qimages(images), qlabels(labels) {}
+        ~Loaders() {
+            qimages.disable();
+            qlabels.disable();
+            for (auto &t : threads) t.join();
+        }
+        dlib::pipe<std::vector<matrix<rgb_pixel>>> &qimages;
+        dlib::pipe<std::vector<unsigned long>> &qlabels;
+        std::vector<std::thread> threads;
+    } loaders(qimages, qlabels);
     // Run the data_loader from 5 threads.  You should set the number of threads
     // relative to the number of CPU cores you have.
-    std::thread data_loader1([data_loader, this](){ data_loader(1, this); });
-    std::thread data_loader2([data_loader, this](){ data_loader(2, this); });
-    std::thread data_loader3([data_loader, this](){ data_loader(3, this); });
-    std::thread data_loader4([data_loader, this](){ data_loader(4, this); });
-    std::thread data_loader5([data_loader, this](){ data_loader(5, this); });
+    for (int seed = 1; seed <= 5; ++seed)
+        loaders.threads.emplace_back([data_loader, seed]() { data_loader(seed); });
 
 
     // Here we do the training.  We keep passing mini-batches to the trainer until the
@@ -225,14 +321,7 @@ void FaceRecognition::train(string dir)
     net.clean();
     serialize("metric_network_renset.dat") << net;
 
-    // stop all the data loading threads and wait for them to terminate.
-    qimages.disable();
-    qlabels.disable();
-    data_loader1.join();
-    data_loader2.join();
-    data_loader3.join();
-    data_loader4.join();
-    data_loader5.join();
+    // the data loading threads are stopped by ~Loaders()
 }
 
 void FaceRecognition::adjustSource(cv::Mat &src) {
@@ -243,27 +332,116 @@ void FaceRecognition::adjustSource(cv::Mat &src) {
 // ----------------------------------------------------------------------------------------
 // Capture faces in [img] and return them at 150x150px RGB inside ReconFace struct
 // ----------------------------------------------------------------------------------------
-std::vector<ReconFace> FaceRecognition::detectFaces(cv::Mat &img)
+std::vector<ReconFace> FaceRecognition::detectFaces(cv::Mat &img, bool gated)
 {
     adjustSource(img);
+    // the detection and the landmarks on the fast cores
+    std::vector<ReconFace> faces;
+    TaskScheduler::instance().runPlaced([&]() {
+        faces = extractFaces(img, detectRects(img, gated), gated);
+    }, PRIORITY_LATENCY);
+    return faces;
+}
+
+void FaceRecognition::setMotionGate(bool enabled)
+{
+    std::unique_lock<std::mutex> guard = timedLock(m_detectorMutex);
+    m_motionGate.setEnabled(enabled);
+}
+
+void FaceRecognition::setMotionThreshold(int32_t threshold)
+{
+    std::unique_lock<std::mutex> guard = timedLock(m_detectorMutex);
+    m_motionGate.setThreshold(threshold);
+}
+
+void FaceRecognition::setPrefilter(int32_t mode)
+{
+    std::unique_lock<std::mutex> guard = timedLock(m_detectorMutex);
+    m_prefilter.setMode(mode);
+}
+
+bool FaceRecognition::loadPrefilterCascade(const char *xml, int64_t size)
+{
+    std::unique_lock<std::mutex> guard = timedLock(m_detectorMutex);
+    return m_prefilter.loadCascade(xml, size);
+}
+
+std::vector<full_object_detection> FaceRecognition::detectRects(cv::Mat &img, bool gated)
+{
+    // faces seen in the last frame
+    std::vector<dlib::rectangle> tracked;
+    {
+        std::unique_lock<std::mutex> guard = timedLock(_mutex);
+        for (auto &track : m_tracker.getTracks())
+            if (track.missedFrames == 0) tracked.push_back(track.rect);
+    }
+
+    std::vector<full_object_detection> dets;
+    {
+        std::unique_lock<std::mutex> guard = timedLock(m_detectorMutex);
+        if (!m_detector) return dets;
+        MotionRegions motion;
+        if (gated) motion = m_motionGate.update(img);
+        if (!motion.full && motion.rects.empty()) {
+            // static scene: the tracked faces are still there
+            STATS_COUNT(COUNTER_MOTION_SKIPS, 1);
+            for (auto &r : tracked)
+                dets.push_back(full_object_detection(r));
+        } else {
+            if (gated && motion.full && m_prefilter.getMode() != PREFILTER_NONE) {
+                STATS_SCOPE(STAGE_PREFILTER);
+                motion = m_prefilter.candidates(img);
+            }
+            STATS_SCOPE(STAGE_DETECT);
+            dets = detectInRegions(img, motion, tracked, [this](cv::Mat &m) {
+                return m_detector->detect(m);
+            });
+        }
+    }
+    STATS_COUNT(COUNTER_FACES, dets.size());
+    return dets;
+}
 
-    cv_image<rgb_pixel> frame(img);
+std::vector<ReconFace> FaceRecognition::extractFaces(
+        cv::Mat &img, const std::vector<full_object_detection> &dets, bool gated)
+{
     std::vector<ReconFace> reconFaces;
-    for (auto face : detector(frame))
+    std::shared_ptr<RecognizerBackend> recognizer = getRecognizer();
+    if (!recognizer) return reconFaces;
+    std::vector<dlib::rectangle> rects;
+    std::vector<full_object_detection> shapes;
+    for (auto &face : dets)
     {
         ReconFace reconFace;
-        auto shape = shapePredictor(frame, face);
+        full_object_detection shape;
         matrix<rgb_pixel> face_chip;
-        extract_image_chip(
-                frame,
-                get_face_chip_details(shape, 150, 0.25),
-                face_chip);
+        // landmarks and aligned chip, as the backend wants them
+        if (!recognizer->align(img, face, shape, face_chip)) continue;
 
+        {
+            STATS_SCOPE(STAGE_QUALITY);
+            reconFace.quality = faceQuality(face_chip, shape, img.size()).score;
+        }
         reconFace.faceDlib = move(face_chip);
         reconFace.faceRect = shape.get_rect();
 
         reconFaces.push_back(reconFace);
+        rects.push_back(face.get_rect());
+        shapes.push_back(shape);
+    }
+
+    // tracked faces can reuse their descriptor in compareFaces(). A still
+    // image isn't part of the stream: its faces stay untracked (-1)
+    if (!gated) return reconFaces;
+    std::vector<int32_t> ids;
+    {
+        std::unique_lock<std::mutex> guard = timedLock(_mutex);
+        STATS_SCOPE(STAGE_TRACK);
+        ids = m_tracker.update(rects, &shapes);
     }
+    for (size_t i = 0; i < reconFaces.size(); ++i)
+        reconFaces[i].trackId = ids[i];
 
     return reconFaces;
 }
@@ -278,9 +456,12 @@ bool FaceRecognition::addFace(ReconFace &facesRecon,
 {
     if (facesRecon.faceDlib.nc() == 0 ||
             facesRecon.faceDlib.nr() == 0 ||
-            facesRecon.faceRect.is_empty()) return false;
+            facesRecon.faceRect.is_empty() ||
+            facesRecon.quality < m_minQuality) return false;
 
-    std::lock_guard<std::mutex> guard(_mutex);
+    // the backend lends a copy of the network: compareFaces() can run meanwhile
+    std::shared_ptr<RecognizerBackend> recognizer = getRecognizer();
+    if (!recognizer) return false;
 
     std::cout << "********************** FACE ADDING1" << std::endl;
     // This call asks the DNN to convert each face image in faces into a 128D vector.
@@ -288,12 +469,8 @@ bool FaceRecognition::addFace(ReconFace &facesRecon,
     // but vectors from different people will be far apart.  So we can use these vectors to
     // identify if a pair of images are from the same person or from different people.
     try {
-        facesRecon.face_descriptor =
-                        mean(
-                            mat(
-                                 net(
-                                     jitter_image(facesRecon.faceDlib, jitterIterations)
-                            )));
+        facesRecon.face_descriptor = recognizer->meanDescriptor(
+                jitter_image(facesRecon.faceDlib, jitterIterations));
 
         facesRecon.name = name;
     }
@@ -305,62 +482,124 @@ bool FaceRecognition::addFace(ReconFace &facesRecon,
     return true;
 }
 
-void getLossMetric(FaceRecognition *me, ReconFace &face) {
-    std::cout << "********************** FACE COMPARE3-a\n";
-    face.face_descriptor = me->net(face.faceDlib);
-    std::cout << "********************** FACE COMPARE3-b\n";
+// return the faces in [newFaces] whose descriptor is close to a face in
+// [gallery]. Faces without a descriptor are skipped
+std::vector<FaceMatch> FaceRecognition::matchFaces(
+        const std::vector<GalleryFace> &gallery,
+        const std::vector<ReconFace> &newFaces)
+{
+    std::vector<FaceMatch> matches;
+    for (int i = 0; i < newFaces.size(); ++i)
+    {
+        if (newFaces[i].face_descriptor.size() == 0) continue;
+        // large galleries are searched by chunks on the scheduler workers
+        int64_t chunks = std::max<int64_t>(1, gallery.size() / MATCH_CHUNK);
+        std::vector<int> chunkBest(chunks, -1);
+        std::vector<float> chunkLength(chunks, 0);
+        TaskScheduler::instance().parallelFor(0, chunks, [&](int64_t c) {
+            size_t end = c + 1 == chunks ? gallery.size() : (c + 1) * MATCH_CHUNK;
+            for (size_t j = c * MATCH_CHUNK; j < end; ++j)
+            {
+                // Faces are connected in the graph if they are close enough.  Here we check if
+                // the distance between two face descriptors is less than 0.6, which is the
+                // decision threshold the network was trained to use.  Although you can
+                // certainly use any other threshold you find useful.
+                float l = length(newFaces[i].face_descriptor-gallery[j].face_descriptor);
+
+                if (l < LENGTH_THRESHOLD && (chunkBest[c] == -1 || l < chunkLength[c])) {
+                    chunkBest[c] = j;
+                    chunkLength[c] = l;
+                }
+            }
+        });
+
+        int best = -1;
+        float bestLength = 0;
+        for (int64_t c = 0; c < chunks; ++c) {
+            if (chunkBest[c] != -1 && (best == -1 || chunkLength[c] < bestLength)) {
+                best = chunkBest[c];
+                bestLength = chunkLength[c];
+            }
+        }
+        if (best == -1) continue;
+
+        // FACE FOUND!!!
+        FaceMatch match;
+        match.galleryId = gallery[best].id;
+        match.name = gallery[best].name;
+        match.length = bestLength;
+        match.faceRect = newFaces[i].faceRect;
+        match.faceDlib = newFaces[i].faceDlib;
+        match.trackId = newFaces[i].trackId;
+        matches.push_back(std::move(match));
+    }
+    return matches;
 }
 
-// return the number of faces found and store them into [newFaces]
-// set [reconFaces.detected] to true if face is found
-void FaceRecognition::compareFaces(std::vector<ReconFace> &reconFaces,
-                                   std::vector<ReconFace> &newFaces,
-                                   int32_t *faceCount)
+// compute the descriptors of the good quality faces of [newFaces] which
+// don't have a cached descriptor
+void FaceRecognition::computeDescriptors(std::vector<ReconFace> &newFaces)
 {
-    if (reconFaces.size() == 0) return;
-    std::lock_guard<std::mutex> guard(_mutex);
+    std::shared_ptr<RecognizerBackend> recognizer = getRecognizer();
+    if (newFaces.size() == 0 || !recognizer) return;
 
-    for (int j = 0; j < reconFaces.size(); ++j)
-        reconFaces[j].detected = false;
-    if (newFaces.size() == 0) return;
+    std::vector<uint64_t> hashes(newFaces.size());
+    std::vector<int> toCompute;
+    {
+        std::unique_lock<std::mutex> guard = timedLock(_mutex);
+        std::vector<int32_t> aliveTracks;
+        for (auto &track : m_tracker.getTracks())
+            aliveTracks.push_back(track.id);
+        m_cache.nextFrame(aliveTracks);
 
-    *faceCount = 0;
-    try {
-        // build the descriptor of all faces found
-        std::vector<std::thread> threads;
+        // reuse the descriptors of the tracked faces which didn't change
         for (int i=0; i<newFaces.size(); ++i) {
-            threads.emplace_back(
-                std::thread([this, i, &newFaces] (anet_type net) {
-                    newFaces[i].face_descriptor = net(newFaces[i].faceDlib);
-                }, net)
-            );
+            // don't waste time on blurred, small, badly lit or turned faces
+            if (newFaces[i].quality < m_minQuality) {
+                STATS_COUNT(COUNTER_LOW_QUALITY, 1);
+                continue;
+            }
+            hashes[i] = RecognitionCache::chipHash(newFaces[i].faceDlib);
+            if (!m_cache.lookup(newFaces[i].trackId, hashes[i],
+                                newFaces[i].face_descriptor))
+                toCompute.push_back(i);
+            else
+                STATS_COUNT(COUNTER_CACHE_HITS, 1);
         }
+    }
 
-        std::for_each(threads.begin(), threads.end(), [](std::thread &t) 
-        {
-            if (t.joinable()) t.join();
-        });
+    // build the descriptor of all the other faces found
+    std::vector<const matrix<rgb_pixel> *> chips;
+    for (int i : toCompute)
+        chips.push_back(&newFaces[i].faceDlib);
+    std::vector<matrix<float,0,1>> descriptors = recognizer->descriptors(chips);
+    for (size_t n = 0; n < toCompute.size(); ++n)
+        newFaces[toCompute[n]].face_descriptor = descriptors[n];
+
+    {
+        std::unique_lock<std::mutex> guard = timedLock(_mutex);
+        for (int i : toCompute)
+            m_cache.store(newFaces[i].trackId, hashes[i],
+                          newFaces[i].face_descriptor);
+    }
+}
+
+// compute the descriptors of [newFaces] and return the ones matching
+// a face in [gallery]
+std::vector<FaceMatch> FaceRecognition::compareFaces(
+        const std::vector<GalleryFace> &gallery,
+        std::vector<ReconFace> &newFaces)
+{
+    std::vector<FaceMatch> matches;
+    if (gallery.size() == 0 || newFaces.size() == 0 || !getRecognizer())
+        return matches;
+
+    try {
+        computeDescriptors(newFaces);
 
-        for (int j = 0; j < reconFaces.size(); ++j)
         {
-            for (int i = 0; i < newFaces.size(); ++i)
-            {
-                // Faces are connected in the graph if they are close enough.  Here we check if
-                // the distance between two face descriptors is less than 0.6, which is the
-                // decision threshold the network was trained to use.  Although you can
-                // certainly use any other threshold you find useful.
-                float l = length(newFaces[i].face_descriptor-reconFaces[j].face_descriptor);
-
-                if (l < LENGTH_THRESHOLD){
-                    // FACE FOUND!!!
-                    (*faceCount)++;
-                    reconFaces[j].faceDlib = newFaces[i].faceDlib;
-                    reconFaces[j].detected = true;
-                    reconFaces[j].faceRect = newFaces[i].faceRect;
-                    reconFaces[j].length = l;
-                    break;
-                }
-            }
+            STATS_SCOPE(STAGE_MATCH);
+            matches = matchFaces(gallery, newFaces);
         }
 
 
@@ -409,6 +648,7 @@ void FaceRecognition::compareFaces(std::vector<ReconFace> &reconFaces,
         std::cout << "Native FaceRecognition::compareFaces()\n";
         cout << e.what() << endl;
     }
+    return matches;
 }
 
 
@@ -417,14 +657,18 @@ void FaceRecognition::compareFaces(std::vector<ReconFace> &reconFaces,
 std::vector<matrix<rgb_pixel>> FaceRecognition::jitter_image(
     const matrix<rgb_pixel>& img, int32_t iterations)
 {
-    // All this function does is make 100 copies of img, all slightly jittered by being
+    // All this function does is make [iterations] copies of img, all slightly jittered by being
     // zoomed, rotated, and translated a little bit differently. They are also randomly
     // mirrored left to right.
+    // The copies are made in parallel, each one with its own random generator.
     thread_local dlib::rand rnd;
+    const uint32_t seed = rnd.get_random_32bit_number();
 
-    std::vector<matrix<rgb_pixel>> crops;
-    for (int i = 0; i < iterations; ++i)
-        crops.push_back(dlib::jitter_image(img,rnd));
+    std::vector<matrix<rgb_pixel>> crops(iterations);
+    TaskScheduler::instance().parallelFor(0, iterations, [&](int64_t i) {
+        dlib::rand cropRnd(seed + i);
+        crops[i] = dlib::jitter_image(img, cropRnd);
+    }, 1, PRIORITY_BACKGROUND);
 
     return crops;
 }
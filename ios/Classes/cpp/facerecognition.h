@@ -11,7 +11,15 @@
 #include <dlib/image_processing.h>
 #include <stdio.h>
 #include <string>
+#include <memory>
 #include "face_common.h"
+#include "face_tracker.h"
+#include "recognition_cache.h"
+#include "face_gallery.h"
+#include "face_net.h"
+#include "motion_gate.h"
+#include "face_prefilter.h"
+#include "face_backend.h"
 
 
 struct ReconFace {
@@ -19,8 +27,20 @@ struct ReconFace {
     dlib::rectangle faceRect = dlib::rectangle(0,0);
     dlib::matrix<dlib::rgb_pixel> faceDlib;
     dlib::matrix<float,0,1> face_descriptor;
-    bool detected = false;
-    float length;
+    int32_t trackId = -1;   // id given by FaceTracker in detectFaces()
+    float quality = 1;      // faceQuality() score computed in detectFaces()
+};
+
+/*
+ * A face found in the frame which matches a known face of the gallery
+ */
+struct FaceMatch {
+    int32_t galleryId;              // GalleryFace::id of the known face
+    std::string name;
+    float length;                   // distance between the descriptors
+    dlib::rectangle faceRect;
+    dlib::matrix<dlib::rgb_pixel> faceDlib;
+    int32_t trackId;
 };
 
 class FaceRecognition : public FaceCommon
@@ -28,88 +48,129 @@ class FaceRecognition : public FaceCommon
 public:
     FaceRecognition();
 
-    void initFaceRecognition(std::string pathToShapePredictor,
+    // return false if a model can't be loaded
+    bool initFaceRecognition(std::string pathToShapePredictor,
                              std::string pathToFaceRecognition);
 
     void initFaceRecognition(char *sp, int64_t spSize,
                              char *fr, int64_t frSize);
 
+    /*
+     * Use models shared with other recognizers
+     */
+    void setModels(std::shared_ptr<const FaceShapePredictor> sp,
+                   std::shared_ptr<const facenet::anet_type> fr);
+
+    /*
+     * Detector and recognizer backends (see face_backend.h), built with
+     * the models of setModels(). The descriptors already computed, also
+     * the ones of the gallery, belong to the previous backend.
+     * Return false if a model of [config] can't be loaded: the backends
+     * are then unchanged
+     */
+    bool setBackends(const BackendConfig &config);
+
+    /*
+     * Compute the descriptors at [precision] (EnginePrecision, the
+     * RESNET_ENGINE backend only). The int8 activations are calibrated on
+     * the chips of the [gallery] faces and jittered copies of them, half
+     * of which are held out: the precision is refused if one of their
+     * pairs changes its match decision at LENGTH_THRESHOLD. setBackends()
+     * goes back to float32
+     */
+    bool setPrecision(int32_t precision, const std::vector<GalleryFace> &gallery,
+                      QuantizationReport &report);
+
     void adjustSource(cv::Mat &src);
 
-    std::vector<ReconFace> detectFaces(cv::Mat &img);
+    /*
+     * Number of frames a tracked face reuses its descriptor before
+     * running the network again. 0 always computes the descriptors
+     */
+    void setRefreshInterval(int32_t frames)
+        {m_cache.setRefreshInterval(frames);}
+    void setRefreshScale(int32_t scale) {m_cache.setRefreshScale(scale);}
+
+    /*
+     * Faces with a quality score [0..1] lower than [minQuality] are not
+     * passed to the recognition network
+     */
+    void setMinQuality(float minQuality) {m_minQuality = minQuality;}
+    float getMinQuality() {return m_minQuality;}
+
+    /*
+     * Number of jittered copies of the face used by addFace() to compute
+     * the descriptor. The more the better (dlib uses 100), but slower
+     */
+    void setJitterIterations(int32_t iterations)
+        {m_jitterIterations = iterations < 1 ? 1 : iterations;}
+    int32_t getJitterIterations() {return m_jitterIterations;}
+
+    /*
+     * Skip the detection of unchanged frames and scan only the changed
+     * regions and the tracked faces of the others (see motion_gate.h)
+     */
+    void setMotionGate(bool enabled);
+    void setMotionThreshold(int32_t threshold);
+
+    /*
+     * Prefilter of the camera frames scanned in full (see face_prefilter.h
+     * and FaceDetector::setPrefilter()). Images which are not part of the
+     * stream (gated == false) are always scanned in full
+     */
+    void setPrefilter(int32_t mode);
+    bool loadPrefilterCascade(const char *xml, int64_t size);
+
+    /*
+     * With [gated] the motion gate, if enabled, can skip the detection
+     * and the faces are tracked: false for the images which are not part
+     * of the camera stream (their faces get no trackId). Under
+     * SCHED_POLICY_BIG_LITTLE it runs on the fast workers
+     */
+    std::vector<ReconFace> detectFaces(cv::Mat &img, bool gated = true);
+
+    /*
+     * The steps of detectFaces() on an already adjusted [img], so that
+     * they can run as different stages of a pipeline
+     */
+    std::vector<dlib::full_object_detection> detectRects(cv::Mat &img,
+                                                         bool gated = true);
+    std::vector<ReconFace> extractFaces(
+            cv::Mat &img, const std::vector<dlib::full_object_detection> &dets,
+            bool gated = true);
+
+    /*
+     * The first step of compareFaces(): fill the descriptors of the faces
+     * good enough to be recognized
+     */
+    void computeDescriptors(std::vector<ReconFace> &newFaces);
 
     void train(std::string dir);
 
     bool addFace(ReconFace &facesRecon, std::string name, int jitterIterations);
 
-    void compareFaces(std::vector<ReconFace> &reconFaces,
-                         std::vector<ReconFace> &newFaces,
-                         int32_t *faceCount);
+    /*
+     * Return the faces in [newFaces] matching a face in [gallery].
+     * [gallery] is never modified, so many threads can compare against
+     * the same snapshot
+     */
+    std::vector<FaceMatch> compareFaces(const std::vector<GalleryFace> &gallery,
+                                        std::vector<ReconFace> &newFaces);
 
-
-private:
-    // ----------------------------------------------------------------------------------------
-
-    // The next bit of code defines a ResNet network.  It's basically copied
-    // and pasted from the dnn_imagenet_ex.cpp example, except we replaced the loss
-    // layer with loss_metric and made the network somewhat smaller.  Go read the introductory
-    // dlib DNN examples to learn what all this stuff means.
-    //
-    // Also, the dnn_metric_learning_on_images_ex.cpp example shows how to train this network.
-    // The dlib_face_recognition_resnet_model_v1 model used by this example was trained using
-    // essentially the code shown in dnn_metric_learning_on_images_ex.cpp except the
-    // mini-batches were made larger (35x15 instead of 5x5), the iterations without progress
-    // was set to 10000, and the training dataset consisted of about 3 million images instead of
-    // 55.  Also, the input layer was locked to images of size 150.
-    template <template <int,template<typename>class,int,typename> class block, int N, template<typename>class BN, typename SUBNET>
-    using residual = dlib::add_prev1<block<N,BN,1,dlib::tag1<SUBNET>>>;
-
-    template <template <int,template<typename>class,int,typename> class block, int N, template<typename>class BN, typename SUBNET>
-    using residual_down = dlib::add_prev2<dlib::avg_pool<2,2,2,2,dlib::skip1<dlib::tag2<block<N,BN,2,dlib::tag1<SUBNET>>>>>>;
-
-    template <int N, template <typename> class BN, int stride, typename SUBNET>
-    using block  = BN<dlib::con<N,3,3,1,1,dlib::relu<BN<dlib::con<N,3,3,stride,stride,SUBNET>>>>>;
-
-    template <int N, typename SUBNET> using res       = dlib::relu<residual<block,N,dlib::bn_con,SUBNET>>;
-    template <int N, typename SUBNET> using ares      = dlib::relu<residual<block,N,dlib::affine,SUBNET>>;
-    template <int N, typename SUBNET> using res_down  = dlib::relu<residual_down<block,N,dlib::bn_con,SUBNET>>;
-    template <int N, typename SUBNET> using ares_down = dlib::relu<residual_down<block,N,dlib::affine,SUBNET>>;
-
-
-    template <typename SUBNET> using level0 = res_down<256,SUBNET>;
-    template <typename SUBNET> using level1 = res<256,res<256,res_down<256,SUBNET>>>;
-    template <typename SUBNET> using level2 = res<128,res<128,res_down<128,SUBNET>>>;
-    template <typename SUBNET> using level3 = res<64,res<64,res<64,res_down<64,SUBNET>>>>;
-    template <typename SUBNET> using level4 = res<32,res<32,res<32,SUBNET>>>;
-
-    template <typename SUBNET> using alevel0 = ares_down<256,SUBNET>;
-    template <typename SUBNET> using alevel1 = ares<256,ares<256,ares_down<256,SUBNET>>>;
-    template <typename SUBNET> using alevel2 = ares<128,ares<128,ares_down<128,SUBNET>>>;
-    template <typename SUBNET> using alevel3 = ares<64,ares<64,ares<64,ares_down<64,SUBNET>>>>;
-    template <typename SUBNET> using alevel4 = ares<32,ares<32,ares<32,SUBNET>>>;
+    /*
+     * Only the matching step of compareFaces(): [newFaces] must already
+     * have their descriptors
+     */
+    static std::vector<FaceMatch> matchFaces(const std::vector<GalleryFace> &gallery,
+                                             const std::vector<ReconFace> &newFaces);
 
 
+private:
     // training network type
-    using net_type = dlib::loss_metric<dlib::fc_no_bias<128,dlib::avg_pool_everything<
-                                level0<
-                                level1<
-                                level2<
-                                level3<
-                                level4<
-                                dlib::max_pool<3,3,2,2,dlib::relu<dlib::bn_con<dlib::con<32,7,7,2,2,
-                                dlib::input_rgb_image
-                                >>>>>>>>>>>>;
+    using net_type = facenet::net_type;
 
     // testing network type (replaced batch normalization with fixed affine transforms)
-    using anet_type = dlib::loss_metric<dlib::fc_no_bias<128,dlib::avg_pool_everything<
-                                alevel0<
-                                alevel1<
-                                alevel2<
-                                alevel3<
-                                alevel4<
-                                dlib::max_pool<3,3,2,2,dlib::relu<dlib::affine<dlib::con<32,7,7,2,2,
-                                dlib::input_rgb_image_sized<150>
-                                >>>>>>>>>>>>;
+    using anet_type = facenet::anet_type;
 
     // ----------------------------------------------------------------------------------------
 
@@ -131,14 +192,25 @@ private:
     );
     // ----------------------------------------------------------------------------------------
 
-    std::mutex _mutex;
-    dlib::frontal_face_detector detector;
-    dlib::shape_predictor shapePredictor;
+    // the recognizer backend, null until the models are loaded. It can
+    // be used by many threads at once, so that addFace() and
+    // compareFaces() can run at the same time
+    std::shared_ptr<RecognizerBackend> getRecognizer();
+
+    std::mutex m_detectorMutex;     // guards m_detector, m_motionGate and m_prefilter
+    std::mutex _mutex;      // guards the models, m_recognizer, tracker and cache
+    int32_t m_jitterIterations = 5;
+    std::unique_ptr<DetectorBackend> m_detector;
+    std::shared_ptr<RecognizerBackend> m_recognizer;
+    BackendConfig m_backends;
+    std::shared_ptr<const FaceShapePredictor> shapePredictor;
+    std::shared_ptr<const anet_type> net;
     std::vector<dlib::matrix<float,0,1>> face_descriptors;
-
-public:
-    anet_type net;
-
+    FaceTracker m_tracker;
+    RecognitionCache m_cache;
+    MotionGate m_motionGate;
+    FacePrefilter m_prefilter;
+    float m_minQuality = 0.3f;
 };
 
 #endif // FACERECOGNITION_H
@@ -14,9 +14,9 @@ public:
 
     int getQueueSize() { return queue.size(); };
 
-    static int getSize() { return m_size; };
+    int getSize() { return m_size; };
 
-    static void setSize(int size) { m_size = size; };
+    void setSize(int size) { m_size = size; };
 
     void add(std::vector<int32_t> points, int32_t delta = 0) {
         if (queue.size() > m_size) {
@@ -67,7 +67,7 @@ public:
     }
 
 private:
-    static std::size_t m_size;
+    std::size_t m_size = 1;
     std::deque<std::vector<int32_t>> queue;
 };
 
@@ -0,0 +1,102 @@
+#include "frame_recorder.h"
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <opencv2/imgcodecs.hpp>
+
+static const char FILE_MAGIC[7] = {'F', 'O', 'D', 'L', 'R', 'E', 'C'};
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool FrameRecorder::open(const std::string &path)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_open) m_out.close();
+    m_open = false;
+    m_out.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_out) return false;
+    m_out.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+    m_out.put((char)FRAME_FILE_VERSION);
+    m_startNs = nowNs();
+    m_open = true;
+    return true;
+}
+
+void FrameRecorder::close()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_open) m_out.close();
+    m_open = false;
+}
+
+void FrameRecorder::record(FrameHeader header, const cv::Mat &image)
+{
+    if (!m_open || image.empty()) return;
+
+    int64_t timestamp = nowNs();
+    std::vector<uchar> data;
+    int channels = image.channels();
+    if (image.depth() == CV_8U && (channels == 1 || channels == 3 || channels == 4)) {
+        // fast PNG compression: the recorder runs inside the pipeline
+        std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION, 1};
+        cv::imencode(".png", image, data, params);
+        header.encoding = FRAME_PNG;
+    } else {
+        size_t rowBytes = image.cols * image.elemSize();
+        data.resize(rowBytes * image.rows);
+        for (int i = 0; i < image.rows; ++i)
+            memcpy(data.data() + i * rowBytes, image.ptr<uchar>(i), rowBytes);
+        header.encoding = FRAME_RAW;
+    }
+
+    header.magic = FRAME_MAGIC;
+    header.width = image.cols;
+    header.height = image.rows;
+    header.bytesPerPixel = channels;
+    header.dataSize = data.size();
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (!m_open) return;
+    header.timestampNs = timestamp - m_startNs;
+    m_out.write((const char *)&header, sizeof(header));
+    m_out.write((const char *)data.data(), data.size());
+    m_out.flush();
+}
+
+bool FrameReader::open(const std::string &path)
+{
+    m_in.open(path, std::ios::binary);
+    if (!m_in) return false;
+    char magic[sizeof(FILE_MAGIC)];
+    m_in.read(magic, sizeof(magic));
+    int version = m_in.get();
+    return m_in && memcmp(magic, FILE_MAGIC, sizeof(magic)) == 0 &&
+            version == FRAME_FILE_VERSION;
+}
+
+bool FrameReader::next(RecordedFrame &frame)
+{
+    FrameHeader &h = frame.header;
+    if (!m_in.read((char *)&h, sizeof(h))) return false;
+    if (h.magic != FRAME_MAGIC || h.width <= 0 || h.height <= 0 ||
+            h.bytesPerPixel <= 0) return false;
+
+    std::vector<uchar> data(h.dataSize);
+    if (!m_in.read((char *)data.data(), data.size())) return false;
+
+    if (h.encoding == FRAME_PNG) {
+        frame.image = cv::imdecode(data, cv::IMREAD_UNCHANGED);
+    } else {
+        if (data.size() != (size_t)h.width * h.height * h.bytesPerPixel)
+            return false;
+        frame.image = cv::Mat(h.height, h.width, CV_8UC(h.bytesPerPixel),
+                              data.data()).clone();
+    }
+    return !frame.image.empty() &&
+            frame.image.cols == h.width && frame.image.rows == h.height;
+}
@@ -0,0 +1,101 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <opencv2/core/mat.hpp>
+#include "common.h"
+
+/*
+ * Frames recorded while they enter the native pipeline, with the settings
+ * needed to process them again in the same way.
+ *
+ * File layout (little endian):
+ *   "FODLREC" + uint8 version
+ *   for each frame: FrameHeader + [dataSize] bytes of image data
+ * Images with 1, 3 or 4 bytes per pixel are stored as PNG (lossless),
+ * the others as raw rows.
+ */
+
+enum FrameSource {
+    FRAME_DETECTOR = 0,     // getFacePosePoints()
+    FRAME_RECOGNIZER        // compareFaces()
+};
+
+enum FrameEncoding {
+    FRAME_RAW = 0,
+    FRAME_PNG
+};
+
+#pragma pack(push, 1)
+struct FrameHeader {
+    uint32_t magic;             // FRAME_MAGIC
+    uint8_t source;             // FrameSource
+    uint8_t encoding;           // FrameEncoding
+    uint8_t onlyRectangle;      // detector getGetOnlyRectangle()
+    uint8_t reserved;
+    int64_t timestampNs;        // since the first recorded frame
+    int32_t width;
+    int32_t height;
+    int32_t bytesPerPixel;
+    int32_t colorSpace;
+    double scaleFactor;
+    int32_t rotation;
+    int32_t flip;
+    int32_t antiShakeSamples;   // detector only
+    uint32_t dataSize;
+};
+#pragma pack(pop)
+
+#define FRAME_MAGIC 0x4d415246  // "FRAM"
+#define FRAME_FILE_VERSION 1
+
+struct RecordedFrame {
+    FrameHeader header;
+    cv::Mat image;              // as it entered the pipeline
+};
+
+class FrameRecorder
+{
+public:
+    /*
+     * Start writing to [path]. Return false if it can't be created
+     */
+    bool open(const std::string &path);
+
+    void close();
+
+    bool isOpen() {return m_open;}
+
+    /*
+     * Append [image] with its [header] settings. Size, bytesPerPixel,
+     * encoding, timestamp and dataSize are filled here
+     */
+    void record(FrameHeader header, const cv::Mat &image);
+
+private:
+    std::mutex m_mutex;
+    std::ofstream m_out;
+    std::atomic<bool> m_open{false};
+    int64_t m_startNs = 0;
+};
+
+class FrameReader
+{
+public:
+    bool open(const std::string &path);
+
+    /*
+     * Read the next frame. Return false at the end of the file or if the
+     * file is corrupted
+     */
+    bool next(RecordedFrame &frame);
+
+private:
+    std::ifstream m_in;
+};
+
+#endif // FRAME_RECORDER_H
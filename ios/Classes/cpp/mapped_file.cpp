@@ -0,0 +1,44 @@
+#include "mapped_file.h"
+
+#include <fstream>
+#include <iterator>
+
+#if !defined(_WIN32)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string &path)
+{
+#if !defined(_WIN32)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            m_data = static_cast<const char *>(p);
+            m_size = st.st_size;
+            m_mapped = true;
+        }
+    }
+    // the mapping stays valid after the file is closed
+    close(fd);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return;
+    m_buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (m_buffer.empty()) return;
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#if !defined(_WIN32)
+    if (m_mapped) munmap(const_cast<char *>(m_data), m_size);
+#endif
+}
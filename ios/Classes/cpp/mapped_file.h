@@ -0,0 +1,35 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Read-only memory map of a whole file, unmapped by the destructor. The
+ * pages are read by the OS on first access and shared with the page
+ * cache: nothing is copied to the heap. Without mmap (Windows) the file
+ * is read in memory instead
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // false if [path] can't be read or is empty
+    bool isOpen() const {return m_data != nullptr;}
+    const char *data() const {return m_data;}
+    int64_t size() const {return m_size;}
+
+private:
+    const char *m_data = nullptr;
+    int64_t m_size = 0;
+    bool m_mapped = false;
+    std::vector<char> m_buffer;     // without mmap
+};
+
+#endif // MAPPED_FILE_H
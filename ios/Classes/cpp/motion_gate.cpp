@@ -0,0 +1,166 @@
+#include "motion_gate.h"
+
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+
+// width of the luminance thumbnail
+static const int THUMB_WIDTH = 64;
+// weight of a new frame in the background
+static const double BACKGROUND_RATE = 0.05;
+// changed thumbnail pixels under which the frame is static
+static const int MIN_CHANGED_PIXELS = 4;
+// share of the frame over which the regions are not worth it
+static const double MAX_REGIONS_AREA = 0.6;
+// smallest region scanned: the HOG window is 80x80 plus its border
+static const int MIN_REGION_SIZE = 112;
+
+MotionRegions MotionGate::update(const cv::Mat &src)
+{
+    MotionRegions motion;
+    if (!m_enabled || src.empty()) return motion;
+
+    int thumbHeight = std::max(1, src.rows * THUMB_WIDTH / std::max(1, src.cols));
+    cv::Mat thumb, gray;
+    cv::resize(src, thumb, cv::Size(THUMB_WIDTH, thumbHeight), 0, 0, cv::INTER_AREA);
+    if (thumb.channels() == 3)
+        cv::cvtColor(thumb, gray, cv::COLOR_RGB2GRAY);
+    else if (thumb.channels() == 4)
+        cv::cvtColor(thumb, gray, cv::COLOR_RGBA2GRAY);
+    else
+        gray = thumb;
+    gray.convertTo(gray, CV_32F);
+
+    if (m_background.empty() || m_frameSize != src.size()) {
+        m_background = gray;
+        m_frameSize = src.size();
+        return motion;
+    }
+
+    cv::Mat diff, mask;
+    cv::absdiff(gray, m_background, diff);
+    cv::threshold(diff, mask, m_threshold, 255, cv::THRESH_BINARY);
+    mask.convertTo(mask, CV_8U);
+    cv::accumulateWeighted(gray, m_background, BACKGROUND_RATE);
+
+    int changed = cv::countNonZero(mask);
+    motion.full = false;
+    if (changed < MIN_CHANGED_PIXELS) return motion;
+    if (changed > mask.total() * MAX_REGIONS_AREA) {
+        motion.full = true;
+        return motion;
+    }
+
+    // join the pixels of the same moving object
+    cv::dilate(mask, mask, cv::Mat(), cv::Point(-1, -1), 2);
+    cv::Mat labels, stats, centroids;
+    int n = cv::connectedComponentsWithStats(mask, labels, stats, centroids);
+    double sx = (double)src.cols / gray.cols;
+    double sy = (double)src.rows / gray.rows;
+    for (int i = 1; i < n; ++i) {
+        motion.rects.push_back(cv::Rect(
+                stats.at<int>(i, cv::CC_STAT_LEFT) * sx,
+                stats.at<int>(i, cv::CC_STAT_TOP) * sy,
+                stats.at<int>(i, cv::CC_STAT_WIDTH) * sx,
+                stats.at<int>(i, cv::CC_STAT_HEIGHT) * sy));
+    }
+    return motion;
+}
+
+// [r] enlarged by a quarter per side and to MIN_REGION_SIZE, inside [bounds]
+static cv::Rect enlarge(const cv::Rect &r, const cv::Rect &bounds)
+{
+    int w = std::max(MIN_REGION_SIZE, r.width + r.width / 2);
+    int h = std::max(MIN_REGION_SIZE, r.height + r.height / 2);
+    cv::Rect big(r.x + r.width / 2 - w / 2, r.y + r.height / 2 - h / 2, w, h);
+    return big & bounds;
+}
+
+// regions of [img] to scan for detectInRegions(), empty: the whole image
+static std::vector<cv::Rect> scanRegions(
+        const cv::Mat &img,
+        const MotionRegions &motion,
+        const std::vector<dlib::rectangle> &tracked)
+{
+    std::vector<cv::Rect> regions;
+    if (motion.full) return regions;
+
+    cv::Rect bounds(0, 0, img.cols, img.rows);
+    for (auto &r : motion.rects)
+        regions.push_back(enlarge(r, bounds));
+    for (auto &t : tracked)
+        regions.push_back(enlarge(cv::Rect(t.left(), t.top(), t.width(), t.height()),
+                                  bounds));
+
+    // merge the overlapping regions: a face is never scanned twice
+    for (bool merged = true; merged; ) {
+        merged = false;
+        for (size_t i = 0; i < regions.size() && !merged; ++i) {
+            for (size_t j = i + 1; j < regions.size(); ++j) {
+                if ((regions[i] & regions[j]).area() == 0) continue;
+                regions[i] |= regions[j];
+                regions.erase(regions.begin() + j);
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    int64_t area = 0;
+    for (auto &r : regions) area += r.area();
+    if (area > bounds.area() * MAX_REGIONS_AREA) regions.clear();
+    // nothing to scan at all
+    else if (regions.empty()) regions.push_back(cv::Rect());
+    return regions;
+}
+
+static dlib::rectangle translate(const dlib::rectangle &r, const cv::Rect &region)
+{
+    return dlib::translate_rect(r, region.x, region.y);
+}
+
+static dlib::full_object_detection translate(const dlib::full_object_detection &d,
+                                             const cv::Rect &region)
+{
+    std::vector<dlib::point> parts;
+    for (unsigned long i = 0; i < d.num_parts(); ++i)
+        parts.push_back(d.part(i) + dlib::point(region.x, region.y));
+    return dlib::full_object_detection(translate(d.get_rect(), region), parts);
+}
+
+template <typename T>
+static std::vector<T> detectInRegionsImpl(
+        cv::Mat &img,
+        const MotionRegions &motion,
+        const std::vector<dlib::rectangle> &tracked,
+        const std::function<std::vector<T>(cv::Mat &)> &detect)
+{
+    std::vector<cv::Rect> regions = scanRegions(img, motion, tracked);
+    if (regions.empty()) return detect(img);
+
+    std::vector<T> faces;
+    for (auto &r : regions) {
+        if (r.area() == 0) continue;
+        cv::Mat roi = img(r);
+        for (auto &f : detect(roi))
+            faces.push_back(translate(f, r));
+    }
+    return faces;
+}
+
+std::vector<dlib::rectangle> detectInRegions(
+        cv::Mat &img,
+        const MotionRegions &motion,
+        const std::vector<dlib::rectangle> &tracked,
+        const std::function<std::vector<dlib::rectangle>(cv::Mat &)> &detect)
+{
+    return detectInRegionsImpl(img, motion, tracked, detect);
+}
+
+std::vector<dlib::full_object_detection> detectInRegions(
+        cv::Mat &img,
+        const MotionRegions &motion,
+        const std::vector<dlib::rectangle> &tracked,
+        const std::function<std::vector<dlib::full_object_detection>(cv::Mat &)> &detect)
+{
+    return detectInRegionsImpl(img, motion, tracked, detect);
+}
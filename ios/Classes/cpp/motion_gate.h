@@ -0,0 +1,77 @@
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include <dlib/geometry/rectangle.h>
+#include <dlib/image_processing/full_object_detection.h>
+
+/*
+ * Parts of a frame which changed since the previous ones
+ */
+struct MotionRegions {
+    bool full = true;               // process the whole frame
+    std::vector<cv::Rect> rects;    // changed regions, empty: static scene
+};
+
+/*
+ * Cheap motion detector run before the face detection.
+ *
+ * Every frame is reduced to a small luminance thumbnail and compared with
+ * a running average of the previous ones (the background). The pixels
+ * differing more than a threshold are grouped in regions, scaled back to
+ * the frame coordinates. With a static scene the detection can be skipped
+ * and the faces already tracked kept; otherwise only the changed regions
+ * and the tracked faces need to be scanned.
+ */
+class MotionGate
+{
+public:
+    MotionGate() {}
+
+    void setEnabled(bool enabled) {m_enabled = enabled; reset();}
+    bool isEnabled() const {return m_enabled;}
+
+    /*
+     * Luminance difference [0..255] of a changed thumbnail pixel
+     */
+    void setThreshold(int32_t threshold) {m_threshold = threshold;}
+
+    /*
+     * Compare [src] (RGB) with the background and blend it into it.
+     * The first frame, a frame of a different size and a frame changed
+     * almost everywhere (ie. exposure change) are processed in full
+     */
+    MotionRegions update(const cv::Mat &src);
+
+    void reset() {m_background.release();}
+
+private:
+    bool m_enabled = false;
+    int32_t m_threshold = 25;
+    cv::Mat m_background;       // CV_32F thumbnail
+    cv::Size m_frameSize;
+};
+
+/*
+ * Run [detect] only on the parts of [img] covering [motion] and the
+ * [tracked] faces, enlarged to fit a face detection window and merged when
+ * they overlap. The detections are returned in [img] coordinates.
+ * The whole image is scanned when the regions cover most of it
+ */
+std::vector<dlib::rectangle> detectInRegions(
+        cv::Mat &img,
+        const MotionRegions &motion,
+        const std::vector<dlib::rectangle> &tracked,
+        const std::function<std::vector<dlib::rectangle>(cv::Mat &)> &detect);
+
+// the same for detections with landmarks (see DetectorBackend)
+std::vector<dlib::full_object_detection> detectInRegions(
+        cv::Mat &img,
+        const MotionRegions &motion,
+        const std::vector<dlib::rectangle> &tracked,
+        const std::function<std::vector<dlib::full_object_detection>(cv::Mat &)> &detect);
+
+#endif // MOTION_GATE_H
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
@@ -13,6 +14,11 @@
 #include "common.h"
 #include "facedetector.h"
 #include "facerecognition.h"
+#include "face_pipeline.h"
+#include "pipeline_stats.h"
+#include "pipeline_trace.h"
+#include "frame_recorder.h"
+#include "task_scheduler.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,15 +26,86 @@ extern "C" {
 
 
 
+struct ResultCompare {
+    u_char *faceImg;
+    int32_t imgSize;
+    int32_t left;
+    int32_t top;
+    int32_t bottom;
+    int32_t right;
+    char *name;
+    bool alreadyExists;
+};
+
+/*
+ * The pipeline used by the functions without a pipeline handle.
+ * Its models are loaded by initDetector() and initRecognition()
+ */
+static FacePipeline *defaultPipeline() {
+    static FacePipeline pipeline(nullptr);
+    return &pipeline;
+}
+
+// frames entering getFacePosePoints() and compareFaces() of every pipeline
+static FrameRecorder frameRecorder;
+
+static void recordFrame(FrameSource source, FaceCommon *settings,
+                        cv::Mat &srcImg, FaceDetector *detector = nullptr) {
+    if (!frameRecorder.isOpen()) return;
+    FrameHeader header = {};
+    header.source = source;
+    header.colorSpace = settings->m_colorSpace;
+    header.scaleFactor = settings->m_scaleFactor;
+    header.rotation = settings->m_rotation;
+    header.flip = settings->m_flip;
+    if (detector != nullptr) {
+        header.onlyRectangle = detector->getGetOnlyRectangle();
+        header.antiShakeSamples = detector->getAntiShakeSamples();
+    }
+    frameRecorder.record(header, srcImg);
+}
+
+// set when the default pipeline models are loaded
 FaceDetector *faceDetector = nullptr;
 FaceRecognition *faceRecognition = nullptr;
-std::mutex _face_mutex;
+
+static BackendConfig backendConfig(int32_t detectorBackend, char *detectorModel,
+                                   int32_t recognizerBackend, char *recognizerModel) {
+    BackendConfig config;
+    config.detector = detectorBackend;
+    config.detectorModel = detectorModel == nullptr ? "" : detectorModel;
+    config.recognizer = recognizerBackend;
+    config.recognizerModel = recognizerModel == nullptr ? "" : recognizerModel;
+    return config;
+}
 
 // -------------------------------------------------------------------------
 /// face detector
 FFI void initDetector(char *shapePredictor, int64_t size) {
-    faceDetector = new FaceDetector();
-    faceDetector->initShapePredictor(shapePredictor, size);
+    defaultPipeline()->detector.initShapePredictor(shapePredictor, size);
+    faceDetector = &defaultPipeline()->detector;
+}
+
+/*
+ * initDetector() from the model file at [shapePredictorPath], without
+ * copying it through Dart. The file is memory mapped: a .dat model or
+ * the blob written by face_model_convert, read in place (see
+ * shape_predictor_blob.h).
+ * Return false if the model can't be loaded
+ */
+FFI bool initDetectorFromFile(char *shapePredictorPath) {
+    if (shapePredictorPath == nullptr) return false;
+    bool loaded;
+    try {
+        loaded = defaultPipeline()->detector.initShapePredictor(shapePredictorPath);
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Native initDetectorFromFile(): " << e.what() << std::endl;
+        return false;
+    }
+    faceDetector = &defaultPipeline()->detector;
+    return loaded;
 }
 
 FFI void setDetectorAntiShakeSamples(int32_t antiShakeSamples) {
@@ -54,7 +131,23 @@ FFI void setDetectorFlip(int32_t flip) {
 FFI void setGetOnlyRectangle(bool onlyRect) {
     if (faceDetector == nullptr) return;
     faceDetector->setGetOnlyRectangle(onlyRect);
-    faceDetector->shapes.clear();
+}
+/*
+ * Skip the detection while the scene doesn't change and scan only the
+ * changed regions otherwise (see motion_gate.h)
+ */
+FFI void setDetectorMotionGate(bool enabled) {
+    if (faceDetector == nullptr) return;
+    faceDetector->setMotionGate(enabled);
+}
+/*
+ * DetectorBackendType of the detector and path of its ONNX model, if it
+ * needs one (see face_backend.h). Return false if it can't be loaded
+ */
+FFI bool setDetectorBackend(int32_t backend, char *model) {
+    if (faceDetector == nullptr) return false;
+    return faceDetector->setBackend(
+            backendConfig(backend, model, RECOGNIZER_BACKEND_RESNET, nullptr));
 }
 FFI bool getGetOnlyRectangle() {
     if (faceDetector == nullptr) return false;
@@ -100,30 +193,45 @@ FFI u_char *drawFacePose(int32_t width,
     return retImg;
 }
 
-/*
- * returned int32_t pointer must be deallocated in Dart
- */
-FFI int32_t *getFacePosePoints(int32_t width,
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int32_t *facePosePoints(FacePipeline *pipeline,
+                  int32_t width,
                   int32_t height,
                   int32_t bytesPerPixel,
                   u_char *imgBytes,
                   int32_t *faceCount) {
 
-    if (faceDetector == nullptr) return nullptr;
+    *faceCount = 0;
+    if (pipeline == nullptr || width == 0 || height == 0) {
+        STATS_COUNT(COUNTER_DROPS, 1);
+        return nullptr;
+    }
+    FaceDetector *detector = &pipeline->detector;
     cv::Mat srcImg = cv::Mat(height, width, CV_8UC(bytesPerPixel), imgBytes);
+    recordFrame(FRAME_DETECTOR, detector, srcImg, detector);
+    if (!pipeline->presence.admit(srcImg, *detector)) return nullptr;
+
+    STATS_SCOPE(STAGE_DETECTOR_FRAME);
+    STATS_COUNT(COUNTER_FRAMES, 1);
+    int64_t startNs = nowNs();
     int32_t retFaceCount;
-    *faceCount = 0;
-    faceDetector->getFacePosePoints(
+    detector->getFacePosePoints(
             srcImg,
             &retFaceCount);
+    pipeline->detectorFrameDone(nowNs() - startNs);
+    pipeline->presence.report(retFaceCount);
 
     if (retFaceCount == 0) return nullptr;
 
-    int nPoints = (faceDetector->getGetOnlyRectangle() ? 2 : 68);
+    int nPoints = (detector->getGetOnlyRectangle() ? 2 : 68);
     int32_t *ret = (int32_t *)malloc(retFaceCount * nPoints * 2 * sizeof (int32_t));
     for (int i=0; i<retFaceCount; ++i) {
         std::vector<int32_t> points =
-                faceDetector->shapes[i].antiShakeQueue.average();
+                detector->shapes[i].antiShakeQueue.average();
         for (int j=0; j<points.size(); ++j) {
             ret[i*nPoints*2 + j] = points[j];
         }
@@ -132,17 +240,78 @@ FFI int32_t *getFacePosePoints(int32_t width,
     return ret;
 }
 
+static int32_t *faceTrackIds(FaceDetector *detector, int32_t *faceCount) {
+    *faceCount = 0;
+    if (detector == nullptr) return nullptr;
+    int32_t count = 0;
+    for (auto &s : detector->shapes) {
+        if (s.found) count++;
+    }
+    std::vector<int32_t> ids = detector->getTrackIds(count);
+    if (ids.empty()) return nullptr;
+
+    int32_t *ret = (int32_t *)malloc(ids.size() * sizeof (int32_t));
+    if (ret == nullptr) return nullptr;
+    for (size_t i=0; i<ids.size(); ++i) {
+        ret[i] = ids[i];
+    }
+    *faceCount = ids.size();
+    return ret;
+}
+
+/*
+ * returned int32_t pointer must be deallocated in Dart
+ */
+FFI int32_t *getFacePosePoints(int32_t width,
+                  int32_t height,
+                  int32_t bytesPerPixel,
+                  u_char *imgBytes,
+                  int32_t *faceCount) {
+    return facePosePoints(faceDetector == nullptr ? nullptr : defaultPipeline(),
+                          width, height, bytesPerPixel, imgBytes, faceCount);
+}
+
+/*
+ * Return the persistent ids of the faces returned by the last
+ * getFacePosePoints() call. The same person keeps the same id while tracked.
+ * returned int32_t pointer must be deallocated in Dart
+ */
+FFI int32_t *getFaceTrackIds(int32_t *faceCount) {
+    return faceTrackIds(faceDetector, faceCount);
+}
+
 
 
 // -------------------------------------------------------------------------
 /// face recognizer
-std::vector<ReconFace> m_reconFaces;
-
 FFI void initRecognition(char *shapePredictor, int64_t sizeSp,
                          char *faceRecon, int64_t sizeFr) {
-    faceRecognition = new FaceRecognition();
-    faceRecognition->initFaceRecognition(shapePredictor, sizeSp,
-                                         faceRecon, sizeFr);
+    defaultPipeline()->recognition.initFaceRecognition(shapePredictor, sizeSp,
+                                                       faceRecon, sizeFr);
+    faceRecognition = &defaultPipeline()->recognition;
+}
+
+/*
+ * initRecognition() from the model files at [shapePredictorPath] and
+ * [faceReconPath], without copying them through Dart. The files are
+ * memory mapped: .dat models or the blobs written by face_model_convert,
+ * which load faster (see shape_predictor_blob.h and face_net_blob.h).
+ * Return false if a model can't be loaded
+ */
+FFI bool initRecognitionFromFiles(char *shapePredictorPath, char *faceReconPath) {
+    if (shapePredictorPath == nullptr || faceReconPath == nullptr) return false;
+    bool loaded;
+    try {
+        loaded = defaultPipeline()->recognition.initFaceRecognition(shapePredictorPath,
+                                                                    faceReconPath);
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Native initRecognitionFromFiles(): " << e.what() << std::endl;
+        return false;
+    }
+    faceRecognition = &defaultPipeline()->recognition;
+    return loaded;
 }
 
 FFI void setRecognizerScaleFactor(double scale) {
@@ -161,6 +330,14 @@ FFI void setRecognizerFlip(int32_t flip) {
     if (faceRecognition == nullptr) return;
     faceRecognition->setFlip(flip);
 }
+/*
+ * Number of frames a tracked face reuses its descriptor before running
+ * the recognition network again. 0 disables the descriptor cache
+ */
+FFI void setRecognizerRefreshInterval(int32_t frames) {
+    if (faceRecognition == nullptr) return;
+    faceRecognition->setRefreshInterval(frames);
+}
 
 /*
  * returned u_char pointer must be deallocated in Dart
@@ -178,41 +355,17 @@ FFI void getRecognizerAdjustedSource(
     *retImg = matToBmp(srcImg, retImgLength);
 }
 
-struct ResultCompare {
-    u_char *faceImg;
-    int32_t imgSize;
-    int32_t left;
-    int32_t top;
-    int32_t bottom;
-    int32_t right;
-    char *name;
-    bool alreadyExists;
-};
-FFI void compareFaces(int32_t width,
-                      int32_t height,
-                      int32_t bytesPerPixel,
-                      u_char *imgBytes,
-                      struct ResultCompare **result,
-                      int32_t *faceCount
-                      ) {
-    (*faceCount) = 0;
-    if (faceRecognition == nullptr || width == 0 || height == 0) return;
-    std::lock_guard<std::mutex> guard(_face_mutex);
-
-    cv::Mat srcImg = cv::Mat(height, width, CV_8UC(bytesPerPixel), imgBytes);
-    std::vector<ReconFace> currentChips;
-    currentChips = faceRecognition->detectFaces(srcImg);
-    if (currentChips.empty()) return;
-
-    faceRecognition->compareFaces(m_reconFaces, currentChips, faceCount);
-    
-    // now [detected] field of the recognized face in [m_reconFaces] can be true
+/*
+ * Fill [result] with the matched faces and return how many they are
+ */
+static int32_t matchesToResults(std::vector<FaceMatch> &matches,
+                                struct ResultCompare **result) {
     int n = 0;
-    for (int j = 0; j < m_reconFaces.size(); ++j) {
-        if (m_reconFaces[j].detected && m_reconFaces[j].faceDlib.nc() == 150) {
-            cv::Mat face = dlib::toMat(m_reconFaces[j].faceDlib);
+    for (auto &match : matches) {
+        if (match.faceDlib.nc() == 150) {
+            cv::Mat face = dlib::toMat(match.faceDlib);
             cv::putText(face,
-                std::to_string(m_reconFaces[j].length),
+                std::to_string(match.length),
                 cv::Point(0, 150),
                 cv::FONT_HERSHEY_DUPLEX,
                 0.7,
@@ -226,49 +379,102 @@ FFI void compareFaces(int32_t width,
                 result[n] = (struct ResultCompare *) malloc(sizeof(struct ResultCompare));
                 result[n]->faceImg = img;
                 result[n]->imgSize = size;
-                result[n]->left = m_reconFaces[j].faceRect.left();
-                result[n]->top = m_reconFaces[j].faceRect.top();
-                result[n]->bottom = m_reconFaces[j].faceRect.bottom();
-                result[n]->right = m_reconFaces[j].faceRect.right();
-                result[n]->name = (char*)m_reconFaces[j].name.c_str();
+                result[n]->left = match.faceRect.left();
+                result[n]->top = match.faceRect.top();
+                result[n]->bottom = match.faceRect.bottom();
+                result[n]->right = match.faceRect.right();
+                // the gallery can drop this name: give Dart its own copy
+                result[n]->name = strdup(match.name.c_str());
+                result[n]->alreadyExists = true;
                 ++n;
             } else {
                 if (img != nullptr) free(img);
-                result[n]->faceImg = nullptr;
-                result[n] = nullptr;
             }
         }
     }
-    (*faceCount) = n;
+    return n;
 }
 
-/*
- * returned ResultCompare pointer must be deallocated in Dart
- */
-FFI struct ResultCompare *addFace(int32_t width,
-                 int32_t height,
-                 int32_t bytesPerPixel,
-                 char *name,
-                 u_char *imgBytes
-                 ) {
-    if (faceRecognition == nullptr) return nullptr;
-    std::lock_guard<std::mutex> guard(_face_mutex);
+static void compareFacesIn(FacePipeline *pipeline,
+                      int32_t width,
+                      int32_t height,
+                      int32_t bytesPerPixel,
+                      u_char *imgBytes,
+                      struct ResultCompare **result,
+                      int32_t *faceCount
+                      ) {
+    (*faceCount) = 0;
+    if (width == 0 || height == 0) {
+        STATS_COUNT(COUNTER_DROPS, 1);
+        return;
+    }
     cv::Mat srcImg = cv::Mat(height, width, CV_8UC(bytesPerPixel), imgBytes);
-    std::vector<ReconFace> chips = faceRecognition->detectFaces(srcImg);
+    recordFrame(FRAME_RECOGNIZER, &pipeline->recognition, srcImg);
+    if (!pipeline->presence.admit(srcImg, pipeline->recognition)) return;
 
-    // if more then 1 face is found return
-    if (chips.size() != 1) return nullptr;
-    int nFacesRecognized = 0;
-    faceRecognition->compareFaces(m_reconFaces, chips, &nFacesRecognized);
+    STATS_SCOPE(STAGE_RECOGNIZER_FRAME);
+    STATS_COUNT(COUNTER_FRAMES, 1);
+    int64_t startNs = nowNs();
+    std::vector<ReconFace> currentChips;
+    currentChips = pipeline->recognition.detectFaces(srcImg);
+    pipeline->presence.report(currentChips.size());
+    if (currentChips.empty()) {
+        pipeline->recognizerFrameDone(nowNs() - startNs);
+        return;
+    }
+
+    // the snapshot stays valid even if faces are added or removed meanwhile
+    FaceGallery::Snapshot gallery = pipeline->gallery.snapshot();
+    std::vector<FaceMatch> matches =
+            pipeline->recognition.compareFaces(gallery->faces, currentChips);
+    pipeline->recognizerFrameDone(nowNs() - startNs);
+
+    (*faceCount) = matchesToResults(matches, result);
+}
+
+FFI void compareFaces(int32_t width,
+                      int32_t height,
+                      int32_t bytesPerPixel,
+                      u_char *imgBytes,
+                      struct ResultCompare **result,
+                      int32_t *faceCount
+                      ) {
+    (*faceCount) = 0;
+    if (faceRecognition == nullptr) {
+        STATS_COUNT(COUNTER_DROPS, 1);
+        return;
+    }
+    compareFacesIn(defaultPipeline(), width, height, bytesPerPixel,
+                   imgBytes, result, faceCount);
+}
+
+/*
+ * Add the face in [chips] (must be only one) to the known faces if it
+ * isn't already there.
+ * The face is compared against a snapshot of the known faces and then
+ * published as a new gallery version: compareFaces() keeps running while
+ * a user enrols.
+ */
+static struct ResultCompare *enrolFace(FacePipeline *pipeline,
+                                       std::vector<ReconFace> &chips,
+                                       char *name) {
+    FaceRecognition *recognition = &pipeline->recognition;
+    FaceGallery::Snapshot gallery = pipeline->gallery.snapshot();
+    int nFacesRecognized =
+            recognition->compareFaces(gallery->faces, chips).size();
 
     struct ResultCompare *result = nullptr;
 
     result = (ResultCompare*) malloc(sizeof(ResultCompare));
     if (result == nullptr) return nullptr;
+    memset(result, 0, sizeof(ResultCompare));
+    result->alreadyExists = nFacesRecognized > 0;
 
     if (nFacesRecognized == 0) {
-        if (faceRecognition->addFace(chips[0], name, 5)) {
-            m_reconFaces.push_back(chips[0]);
+        if (recognition->addFace(chips[0], name,
+                                 recognition->getJitterIterations())) {
+            pipeline->gallery.add(chips[0].name, chips[0].face_descriptor,
+                                  chips[0].faceDlib);
         }
         cv::Mat chip = dlib::toMat(chips[0].faceDlib);
         int32_t size;
@@ -285,12 +491,569 @@ FFI struct ResultCompare *addFace(int32_t width,
             free(result);
             result = nullptr;
         }
-        result->alreadyExists = nFacesRecognized > 0;
     }
 
     return result;
 }
 
+static struct ResultCompare *addFaceTo(FacePipeline *pipeline,
+                 int32_t width,
+                 int32_t height,
+                 int32_t bytesPerPixel,
+                 char *name,
+                 u_char *imgBytes
+                 ) {
+    cv::Mat srcImg = cv::Mat(height, width, CV_8UC(bytesPerPixel), imgBytes);
+    std::vector<ReconFace> chips = pipeline->recognition.detectFaces(srcImg, false);
+
+    // if more then 1 face is found return
+    if (chips.size() != 1) return nullptr;
+
+    return enrolFace(pipeline, chips, name);
+}
+
+/*
+ * returned ResultCompare pointer must be deallocated in Dart
+ */
+FFI struct ResultCompare *addFace(int32_t width,
+                 int32_t height,
+                 int32_t bytesPerPixel,
+                 char *name,
+                 u_char *imgBytes
+                 ) {
+    if (faceRecognition == nullptr) return nullptr;
+    return addFaceTo(defaultPipeline(), width, height, bytesPerPixel,
+                     name, imgBytes);
+}
+
+/*
+ * Add the face of [name] picking the best quality one in a burst of
+ * [nFrames] frames. Frames with no faces or more than 1 face are skipped.
+ * returned ResultCompare pointer must be deallocated in Dart
+ */
+FFI struct ResultCompare *addFaceBurst(int32_t width,
+                 int32_t height,
+                 int32_t bytesPerPixel,
+                 char *name,
+                 u_char **frames,
+                 int32_t nFrames
+                 ) {
+    if (faceRecognition == nullptr) return nullptr;
+
+    std::vector<ReconFace> best;
+    for (int i = 0; i < nFrames; ++i) {
+        cv::Mat srcImg = cv::Mat(height, width, CV_8UC(bytesPerPixel), frames[i]);
+        std::vector<ReconFace> chips = faceRecognition->detectFaces(srcImg, false);
+        if (chips.size() != 1) continue;
+        if (best.empty() || chips[0].quality > best[0].quality)
+            best = chips;
+    }
+    if (best.empty()) return nullptr;
+
+    return enrolFace(defaultPipeline(), best, name);
+}
+
+/*
+ * Remove all the known faces named [name].
+ * Return the number of faces removed
+ */
+FFI int32_t removeFace(char *name) {
+    if (name == nullptr) return 0;
+    return defaultPipeline()->gallery.remove(name);
+}
+
+/*
+ * Number of jittered copies of the face used to compute its descriptor
+ * when adding it. dlib uses 100 for the best accuracy. Default is 5
+ */
+FFI void setRecognizerJitterIterations(int32_t iterations) {
+    if (faceRecognition == nullptr) return;
+    faceRecognition->setJitterIterations(iterations);
+}
+
+/*
+ * Faces with a quality score [0..1] lower than [minQuality] are skipped
+ * when comparing and adding faces
+ */
+FFI void setRecognizerMinQuality(double minQuality) {
+    if (faceRecognition == nullptr) return;
+    faceRecognition->setMinQuality(minQuality);
+}
+
+/*
+ * Backends of the recognizer (see createFaceModelsWithBackends()), to be
+ * set after initRecognition(). The faces already added must be added
+ * again. Return false if a model can't be loaded
+ */
+FFI bool setRecognizerBackends(int32_t detectorBackend, char *detectorModel,
+                               int32_t recognizerBackend, char *recognizerModel) {
+    if (faceRecognition == nullptr) return false;
+    return faceRecognition->setBackends(backendConfig(detectorBackend, detectorModel,
+                                                      recognizerBackend, recognizerModel));
+}
+
+static struct QuantizationReport *recognizerPrecision(FacePipeline *pipeline,
+                                                     int32_t precision) {
+    QuantizationReport *report = (QuantizationReport *)malloc(sizeof(QuantizationReport));
+    if (report == nullptr) return nullptr;
+    FaceGallery::Snapshot gallery = pipeline->gallery.snapshot();
+    pipeline->recognition.setPrecision(precision, gallery->faces, *report);
+    return report;
+}
+
+/*
+ * Compute the descriptors at [precision] (EnginePrecision) with the
+ * RECOGNIZER_BACKEND_RESNET_ENGINE backend. ENGINE_PRECISION_INT8 is
+ * calibrated on the faces of the gallery: add them first. It is refused
+ * when it would change a match decision on held-out chips, see
+ * QuantizationReport::applied and its drift from float32.
+ * returned QuantizationReport pointer must be deallocated in Dart
+ */
+FFI struct QuantizationReport *setRecognizerPrecision(int32_t precision) {
+    if (faceRecognition == nullptr) return nullptr;
+    return recognizerPrecision(defaultPipeline(), precision);
+}
+
+/*
+ * Threads computing one descriptor with the RECOGNIZER_BACKEND_RESNET_ENGINE
+ * backend, the calling one included: every layer is split between them,
+ * so a single face uses several cores. <= 0 (default) uses all the
+ * workers of the task scheduler, 1 the calling thread only. The dlib
+ * backends compute a face on one thread
+ */
+FFI void setRecognizerThreads(int32_t threads) {
+    FaceNetEngine::setThreads(threads);
+}
+
+FFI int32_t getRecognizerThreads() {
+    return FaceNetEngine::getThreads();
+}
+
+/*
+ * Skip the detection of compareFaces() while the scene doesn't change
+ * (see motion_gate.h). addFace() always runs the detection
+ */
+FFI void setRecognizerMotionGate(bool enabled) {
+    if (faceRecognition == nullptr) return;
+    faceRecognition->setMotionGate(enabled);
+}
+
+
+
+// -------------------------------------------------------------------------
+/// multi-instance API
+///
+/// Models are loaded once with createFaceModels() and shared by all the
+/// pipelines created with createPipeline(). Each pipeline keeps its own
+/// tracking, smoothing and gallery state, so different pipelines can
+/// process different streams on different threads at the same time.
+/// A single pipeline must not be used by more threads at once.
+
+struct FaceModelsHandle {
+    std::shared_ptr<const FaceModels> models;
+};
+
+static struct FaceModelsHandle *loadFaceModels(char *detectorSp, int64_t sizeDetectorSp,
+                                               char *recognizerSp, int64_t sizeRecognizerSp,
+                                               char *faceRecon, int64_t sizeFr,
+                                               const BackendConfig &backends) {
+    std::shared_ptr<FaceModels> models = std::make_shared<FaceModels>();
+    try {
+        models->detectorShapePredictor = loadShapePredictor(detectorSp, sizeDetectorSp);
+        models->recognizerShapePredictor = loadShapePredictor(recognizerSp, sizeRecognizerSp);
+        models->net = loadFaceNet(faceRecon, sizeFr);
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Native createFaceModels(): " << e.what() << std::endl;
+        return nullptr;
+    }
+    // the ONNX models are loaded by every pipeline: check them once here
+    if (!createDetectorBackend(backends) ||
+            (backends.recognizer != RECOGNIZER_BACKEND_RESNET &&
+             !createRecognizerBackend(backends, models->recognizerShapePredictor,
+                                      models->net))) {
+        std::cout << "Native createFaceModels(): cannot load the backends" << std::endl;
+        return nullptr;
+    }
+    models->backends = backends;
+    FaceModelsHandle *handle = new FaceModelsHandle();
+    handle->models = models;
+    return handle;
+}
+
+/*
+ * Load the models. Any model can be null if not needed:
+ * [detectorSp] the 68 points shape predictor used by the detector,
+ * [recognizerSp] the 5 points shape predictor and [faceRecon] the network
+ * used by the recognizer.
+ * Returned handle must be released with destroyFaceModels(). Pipelines
+ * keep the models alive also after that.
+ */
+FFI struct FaceModelsHandle *createFaceModels(char *detectorSp, int64_t sizeDetectorSp,
+                                              char *recognizerSp, int64_t sizeRecognizerSp,
+                                              char *faceRecon, int64_t sizeFr) {
+    return loadFaceModels(detectorSp, sizeDetectorSp, recognizerSp, sizeRecognizerSp,
+                          faceRecon, sizeFr, BackendConfig());
+}
+
+/*
+ * createFaceModels() with other detector and recognizer backends (see
+ * face_backend.h): [detectorBackend] is a DetectorBackendType and
+ * [recognizerBackend] a RecognizerBackendType. [detectorModel] and
+ * [recognizerModel] are the paths of their ONNX files, if they need one.
+ * [faceRecon] is only needed by the RECOGNIZER_BACKEND_RESNET backends
+ * (RESNET_ENGINE runs it on FaceNetEngine instead of dlib); the 5 points
+ * [recognizerSp] also aligns the faces of the detectors without landmarks.
+ * Return null if a model can't be loaded
+ */
+FFI struct FaceModelsHandle *createFaceModelsWithBackends(
+        char *detectorSp, int64_t sizeDetectorSp,
+        char *recognizerSp, int64_t sizeRecognizerSp,
+        char *faceRecon, int64_t sizeFr,
+        int32_t detectorBackend, char *detectorModel,
+        int32_t recognizerBackend, char *recognizerModel) {
+    return loadFaceModels(detectorSp, sizeDetectorSp, recognizerSp, sizeRecognizerSp,
+                          faceRecon, sizeFr,
+                          backendConfig(detectorBackend, detectorModel,
+                                        recognizerBackend, recognizerModel));
+}
+
+FFI void destroyFaceModels(struct FaceModelsHandle *models) {
+    delete models;
+}
+
+/*
+ * Returned pipeline must be released with destroyPipeline()
+ */
+FFI FacePipeline *createPipeline(struct FaceModelsHandle *models) {
+    if (models == nullptr) return nullptr;
+    return new FacePipeline(models->models);
+}
+
+FFI void destroyPipeline(FacePipeline *pipeline) {
+    delete pipeline;
+}
+
+/*
+ * Set a PipelineOption (see face_pipeline.h).
+ * Return false if [option] is unknown
+ */
+FFI bool pipelineConfigure(FacePipeline *pipeline, int32_t option, double value) {
+    if (pipeline == nullptr) return false;
+    return pipeline->configure((PipelineOption)option, value);
+}
+
+/*
+ * returned int32_t pointer must be deallocated in Dart
+ */
+FFI int32_t *pipelineGetFacePosePoints(FacePipeline *pipeline,
+                  int32_t width,
+                  int32_t height,
+                  int32_t bytesPerPixel,
+                  u_char *imgBytes,
+                  int32_t *faceCount) {
+    *faceCount = 0;
+    if (pipeline == nullptr) return nullptr;
+    return facePosePoints(pipeline, width, height, bytesPerPixel,
+                          imgBytes, faceCount);
+}
+
+/*
+ * returned int32_t pointer must be deallocated in Dart
+ */
+FFI int32_t *pipelineGetFaceTrackIds(FacePipeline *pipeline, int32_t *faceCount) {
+    *faceCount = 0;
+    if (pipeline == nullptr) return nullptr;
+    return faceTrackIds(&pipeline->detector, faceCount);
+}
+
+FFI void pipelineCompareFaces(FacePipeline *pipeline,
+                      int32_t width,
+                      int32_t height,
+                      int32_t bytesPerPixel,
+                      u_char *imgBytes,
+                      struct ResultCompare **result,
+                      int32_t *faceCount
+                      ) {
+    (*faceCount) = 0;
+    if (pipeline == nullptr) return;
+    compareFacesIn(pipeline, width, height, bytesPerPixel,
+                   imgBytes, result, faceCount);
+}
+
+/*
+ * returned ResultCompare pointer must be deallocated in Dart
+ */
+FFI struct ResultCompare *pipelineAddFace(FacePipeline *pipeline,
+                 int32_t width,
+                 int32_t height,
+                 int32_t bytesPerPixel,
+                 char *name,
+                 u_char *imgBytes
+                 ) {
+    if (pipeline == nullptr) return nullptr;
+    return addFaceTo(pipeline, width, height, bytesPerPixel, name, imgBytes);
+}
+
+FFI int32_t pipelineRemoveFace(FacePipeline *pipeline, char *name) {
+    if (pipeline == nullptr || name == nullptr) return 0;
+    return pipeline->gallery.remove(name);
+}
+
+/*
+ * Queue a frame for the staged recognizer (see staged_pipeline.h), which
+ * overlaps the stages of consecutive frames on the shared thread pool.
+ * The bytes are copied: the caller can free them on return.
+ * Return the frame id or -1 if the frame is dropped because
+ * OPT_STAGED_MAX_IN_FLIGHT frames are not polled yet
+ */
+FFI int64_t pipelineSubmitFrame(FacePipeline *pipeline,
+                                int32_t width,
+                                int32_t height,
+                                int32_t bytesPerPixel,
+                                u_char *imgBytes) {
+    if (pipeline == nullptr || width == 0 || height == 0) {
+        STATS_COUNT(COUNTER_DROPS, 1);
+        return -1;
+    }
+    cv::Mat srcImg = cv::Mat(height, width, CV_8UC(bytesPerPixel), imgBytes);
+    recordFrame(FRAME_RECOGNIZER, &pipeline->recognition, srcImg);
+    return pipeline->stagedRecognizer().submit(srcImg);
+}
+
+/*
+ * Get the results of the oldest completed frame queued with
+ * pipelineSubmitFrame(), as compareFaces() does.
+ * Return false if no frame is completed yet
+ */
+FFI bool pipelinePollFrame(FacePipeline *pipeline,
+                           int64_t *frameId,
+                           struct ResultCompare **result,
+                           int32_t *faceCount) {
+    (*faceCount) = 0;
+    if (pipeline == nullptr) return false;
+    StagedFrame frame;
+    if (!pipeline->stagedRecognizer().poll(frame)) return false;
+    *frameId = frame.id;
+    (*faceCount) = matchesToResults(frame.matches, result);
+    return true;
+}
+
+/*
+ * Target time per frame in ms of the getFacePosePoints() and
+ * compareFaces() calls of the pipeline (see quality_governor.h): the
+ * detection and recognition quality is lowered while the frames take
+ * longer. 0 disables the governor. The same as OPT_GOVERNOR_BUDGET_MS
+ */
+FFI void setFrameBudget(double ms) {
+    defaultPipeline()->governor.setBudget(ms);
+}
+
+static struct GovernorState *governorState(FacePipeline *pipeline) {
+    GovernorState *state = (GovernorState *)malloc(sizeof(GovernorState));
+    if (state == nullptr) return nullptr;
+    *state = pipeline->governor.getState();
+    return state;
+}
+
+/*
+ * Current decisions of the governor of the default pipeline.
+ * returned GovernorState pointer must be deallocated in Dart
+ */
+FFI struct GovernorState *getGovernorState() {
+    return governorState(defaultPipeline());
+}
+
+/*
+ * returned GovernorState pointer must be deallocated in Dart
+ */
+FFI struct GovernorState *pipelineGetGovernorState(FacePipeline *pipeline) {
+    if (pipeline == nullptr) return nullptr;
+    return governorState(pipeline);
+}
+
+/*
+ * Low-power presence mode of the default pipeline (see presence_monitor.h):
+ * while nobody is in front of the camera only one frame every
+ * [idleStride] is scanned, at [idleWidth] pixels, and the full pipeline
+ * resumes when a face appears. It goes back idle after [emptyFrames]
+ * frames without faces. The same as the OPT_PRESENCE_* options
+ */
+FFI void setPresenceMode(bool enabled, int32_t idleWidth,
+                         int32_t idleStride, int32_t emptyFrames) {
+    PresenceMonitor &presence = defaultPipeline()->presence;
+    presence.setIdleWidth(idleWidth);
+    presence.setIdleStride(idleStride);
+    presence.setEmptyFrames(emptyFrames);
+    presence.setEnabled(enabled);
+}
+
+static struct PresenceState *presenceState(FacePipeline *pipeline) {
+    PresenceState *state = (PresenceState *)malloc(sizeof(PresenceState));
+    if (state == nullptr) return nullptr;
+    *state = pipeline->presence.getState();
+    return state;
+}
+
+/*
+ * returned PresenceState pointer must be deallocated in Dart
+ */
+FFI struct PresenceState *getPresenceState() {
+    return presenceState(defaultPipeline());
+}
+
+/*
+ * returned PresenceState pointer must be deallocated in Dart
+ */
+FFI struct PresenceState *pipelineGetPresenceState(FacePipeline *pipeline) {
+    if (pipeline == nullptr) return nullptr;
+    return presenceState(pipeline);
+}
+
+/*
+ * setRecognizerPrecision() of [pipeline], calibrated on its gallery.
+ * returned QuantizationReport pointer must be deallocated in Dart
+ */
+FFI struct QuantizationReport *pipelineSetRecognizerPrecision(FacePipeline *pipeline,
+                                                              int32_t precision) {
+    if (pipeline == nullptr) return nullptr;
+    return recognizerPrecision(pipeline, precision);
+}
+
+/*
+ * Coarse-to-fine detection of the default pipeline (see face_prefilter.h):
+ * the HOG detector only verifies the candidates of the PrefilterMode
+ * [mode] prefilter.
+ * [cascade] is the content of an OpenCV cascade XML file (ie.
+ * haarcascade_frontalface_default.xml) used by PREFILTER_CASCADE, or null
+ * to keep the one already loaded.
+ * Return false if [cascade] can't be loaded: the mode is then unchanged
+ */
+FFI bool setDetectorPrefilter(int32_t mode, char *cascade, int64_t size) {
+    FaceDetector &detector = defaultPipeline()->detector;
+    if (cascade != nullptr && !detector.loadPrefilterCascade(cascade, size))
+        return false;
+    detector.setPrefilter(mode);
+    return true;
+}
+FFI bool setRecognizerPrefilter(int32_t mode, char *cascade, int64_t size) {
+    FaceRecognition &recognition = defaultPipeline()->recognition;
+    if (cascade != nullptr && !recognition.loadPrefilterCascade(cascade, size))
+        return false;
+    recognition.setPrefilter(mode);
+    return true;
+}
+
+/*
+ * Load the cascade of both prefilters of [pipeline], enabled with the
+ * OPT_DETECTOR_PREFILTER and OPT_RECOGNIZER_PREFILTER options
+ */
+FFI bool pipelineLoadPrefilterCascade(FacePipeline *pipeline,
+                                      char *cascade, int64_t size) {
+    if (pipeline == nullptr) return false;
+    return pipeline->detector.loadPrefilterCascade(cascade, size) &&
+           pipeline->recognition.loadPrefilterCascade(cascade, size);
+}
+
+
+
+// -------------------------------------------------------------------------
+/// stats
+
+/*
+ * Return the latency percentiles of every PipelineStage and the
+ * PipelineCounter values collected since the start or the last
+ * resetPipelineStats() (see pipeline_stats.h).
+ * All zeros if the library is built with FACE_PIPELINE_NO_STATS.
+ * returned PipelineStats pointer must be deallocated in Dart
+ */
+FFI struct PipelineStats *getPipelineStats() {
+    PipelineStats *stats = (PipelineStats *)malloc(sizeof(PipelineStats));
+    if (stats == nullptr) return nullptr;
+    pipelineStatsSnapshot(stats);
+    return stats;
+}
+
+FFI void resetPipelineStats() {
+    pipelineStatsReset();
+}
+
+/*
+ * Name of the [stage] index of PipelineStats::stages
+ */
+FFI const char *getPipelineStageName(int32_t stage) {
+    return pipelineStageName(stage);
+}
+
+/*
+ * Start recording the spans of every stage into a ring holding the last
+ * [capacity] spans. Spans recorded before are discarded
+ */
+FFI void startPipelineTrace(int32_t capacity) {
+    pipelineTraceStart(capacity);
+}
+
+FFI void stopPipelineTrace() {
+    pipelineTraceStop();
+}
+
+/*
+ * Write the recorded spans to [path] as Chrome trace-event JSON
+ * (chrome://tracing, ui.perfetto.dev). It can be called while tracing.
+ * Return the number of spans written or -1 on error
+ */
+FFI int64_t dumpPipelineTrace(char *path) {
+    if (path == nullptr) return -1;
+    return pipelineTraceDump(path);
+}
+
+/*
+ * Record every frame entering getFacePosePoints() and compareFaces(), with
+ * its settings, into [path] (see frame_recorder.h). The file can be
+ * replayed with linux/benchmark face_replay.
+ * Return false if the file can't be created
+ */
+FFI bool startFrameRecording(char *path) {
+    if (path == nullptr) return false;
+    return frameRecorder.open(path);
+}
+
+FFI void stopFrameRecording() {
+    frameRecorder.close();
+}
+
+/*
+ * Restart the native task scheduler with [workers] threads (<= 0 uses
+ * the number of cores) placed with [policy]:
+ * 0 the OS places them, 1 every worker stays on one core, 2 detection and
+ * landmarks run on the fast cores and the background work (enrolment
+ * jitter, training) on the slow ones. Pinning works on Linux and Android
+ */
+FFI void setSchedulerWorkers(int32_t workers, int32_t policy) {
+    TaskScheduler::instance().configure(workers, policy);
+}
+
+FFI int32_t getSchedulerWorkers() {
+    return TaskScheduler::instance().getWorkers();
+}
+
+/*
+ * Policy in use, which can differ from the requested one: policy 2 falls
+ * back to 0 when all the cores are the same
+ */
+FFI int32_t getSchedulerPolicy() {
+    return TaskScheduler::instance().getPolicy();
+}
+
+/*
+ * Read the CPU capacities from [root] instead of /sys/devices/system/cpu
+ * at the next setSchedulerWorkers(). nullptr restores the default
+ */
+FFI void setSchedulerTopologyRoot(char *root) {
+    TaskScheduler::instance().setTopologyRoot(root == nullptr ? "" : root);
+}
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,196 @@
+#include "pipeline_stats.h"
+#include "pipeline_trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// bucket 0 holds times under 1us, bucket i>0 holds [2^((i-1)/4), 2^(i/4)) us.
+// The last one holds everything above ~16s
+#define BUCKETS_PER_OCTAVE 4
+#define N_BUCKETS 98
+
+namespace {
+
+struct ThreadStats {
+    // written only by the owner thread, read by the snapshot
+    std::atomic<uint32_t> buckets[STAGE_COUNT][N_BUCKETS];
+    std::atomic<int64_t> maxNs[STAGE_COUNT];
+    std::atomic<int64_t> counters[COUNTER_COUNT];
+
+    ThreadStats() {reset();}
+
+    void reset() {
+        for (auto &stage : buckets)
+            for (auto &b : stage) b.store(0, std::memory_order_relaxed);
+        for (auto &m : maxNs) m.store(0, std::memory_order_relaxed);
+        for (auto &c : counters) c.store(0, std::memory_order_relaxed);
+    }
+};
+
+/*
+ * Totals of all the threads. Threads which end move their stats into
+ * [retired] so that short lived threads don't make the list grow
+ */
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadStats *> threads;
+    uint64_t retired[STAGE_COUNT][N_BUCKETS] = {};
+    int64_t retiredMaxNs[STAGE_COUNT] = {};
+    int64_t retiredCounters[COUNTER_COUNT] = {};
+};
+
+Registry &registry() {
+    // never destroyed: threads can still end after exit() started
+    static Registry *r = new Registry();
+    return *r;
+}
+
+struct ThreadSlot {
+    ThreadStats *stats;
+
+    ThreadSlot() : stats(new ThreadStats()) {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> guard(r.mutex);
+        r.threads.push_back(stats);
+    }
+
+    ~ThreadSlot() {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> guard(r.mutex);
+        for (int s = 0; s < STAGE_COUNT; ++s) {
+            for (int b = 0; b < N_BUCKETS; ++b)
+                r.retired[s][b] += stats->buckets[s][b].load(std::memory_order_relaxed);
+            r.retiredMaxNs[s] = std::max(r.retiredMaxNs[s],
+                    stats->maxNs[s].load(std::memory_order_relaxed));
+        }
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+            r.retiredCounters[c] += stats->counters[c].load(std::memory_order_relaxed);
+        r.threads.erase(std::remove(r.threads.begin(), r.threads.end(), stats),
+                        r.threads.end());
+        delete stats;
+    }
+};
+
+ThreadStats &threadStats() {
+    thread_local ThreadSlot slot;
+    return *slot.stats;
+}
+
+int bucketOf(int64_t ns) {
+    if (ns < 1000) return 0;
+    int b = 1 + (int)(BUCKETS_PER_OCTAVE * std::log2(ns / 1000.0));
+    return std::min(b, N_BUCKETS - 1);
+}
+
+// geometric center of the bucket in ms
+double bucketMs(int b) {
+    if (b == 0) return 0.0005;
+    return std::pow(2.0, (b - 0.5) / BUCKETS_PER_OCTAVE) / 1000.0;
+}
+
+double percentileMs(const uint64_t *buckets, uint64_t count, double p) {
+    uint64_t rank = (uint64_t)std::ceil(p * count);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < N_BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen >= rank) return bucketMs(b);
+    }
+    return bucketMs(N_BUCKETS - 1);
+}
+
+} // namespace
+
+const char *pipelineStageName(int32_t stage)
+{
+    static const char *names[STAGE_COUNT] = {
+        "resample",
+        "detect",
+        "landmarks",
+        "track",
+        "chip",
+        "quality",
+        "descriptor",
+        "match",
+        "encode",
+        "detectorFrame",
+        "recognizerFrame",
+        "cameraRead",
+        "lockWait",
+        "presenceWake",
+        "prefilter"
+    };
+    if (stage < 0 || stage >= STAGE_COUNT) return "";
+    return names[stage];
+}
+
+void pipelineStatsRecord(PipelineStage stage, int64_t nanoseconds)
+{
+    ThreadStats &s = threadStats();
+    s.buckets[stage][bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    if (nanoseconds > s.maxNs[stage].load(std::memory_order_relaxed))
+        s.maxNs[stage].store(nanoseconds, std::memory_order_relaxed);
+}
+
+void pipelineStatsRecordSpan(PipelineStage stage, int64_t beginNs, int64_t durNs)
+{
+    pipelineStatsRecord(stage, durNs);
+    if (pipelineTraceEnabled())
+        pipelineTraceRecord(stage, beginNs, durNs);
+}
+
+void pipelineStatsCount(PipelineCounter counter, int64_t n)
+{
+    threadStats().counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void pipelineStatsSnapshot(PipelineStats *stats)
+{
+    memset(stats, 0, sizeof(PipelineStats));
+    stats->nStages = STAGE_COUNT;
+    stats->nCounters = COUNTER_COUNT;
+
+    Registry &r = registry();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        uint64_t buckets[N_BUCKETS];
+        uint64_t count = 0;
+        int64_t maxNs = r.retiredMaxNs[s];
+        for (int b = 0; b < N_BUCKETS; ++b) {
+            buckets[b] = r.retired[s][b];
+            for (ThreadStats *t : r.threads)
+                buckets[b] += t->buckets[s][b].load(std::memory_order_relaxed);
+            count += buckets[b];
+        }
+        for (ThreadStats *t : r.threads)
+            maxNs = std::max(maxNs, t->maxNs[s].load(std::memory_order_relaxed));
+
+        StageStats &st = stats->stages[s];
+        st.count = count;
+        if (count == 0) continue;
+        st.maxMs = maxNs / 1e6;
+        st.p50Ms = std::min(percentileMs(buckets, count, 0.50), st.maxMs);
+        st.p95Ms = std::min(percentileMs(buckets, count, 0.95), st.maxMs);
+        st.p99Ms = std::min(percentileMs(buckets, count, 0.99), st.maxMs);
+    }
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        stats->counters[c] = r.retiredCounters[c];
+        for (ThreadStats *t : r.threads)
+            stats->counters[c] += t->counters[c].load(std::memory_order_relaxed);
+    }
+}
+
+void pipelineStatsReset()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    for (ThreadStats *t : r.threads)
+        t->reset();
+    memset(r.retired, 0, sizeof(r.retired));
+    memset(r.retiredMaxNs, 0, sizeof(r.retiredMaxNs));
+    memset(r.retiredCounters, 0, sizeof(r.retiredCounters));
+}
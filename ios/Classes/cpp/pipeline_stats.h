@@ -0,0 +1,121 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Per-stage latency histograms and pipeline counters.
+ *
+ * Every thread records into its own histograms, so STATS_SCOPE() never
+ * takes a lock: the only shared work is the aggregation done by
+ * pipelineStatsSnapshot(). Defining FACE_PIPELINE_NO_STATS compiles the
+ * timers and counters out.
+ */
+
+enum PipelineStage {
+    STAGE_RESAMPLE = 0,     // resampleMat(): color conversion, scale, rotation
+    STAGE_DETECT,           // HOG detector
+    STAGE_LANDMARKS,        // shape predictor
+    STAGE_TRACK,            // FaceTracker::update()
+    STAGE_CHIP,             // extract_image_chip()
+    STAGE_QUALITY,          // faceQuality()
+    STAGE_DESCRIPTOR,       // recognition network, one face or one batch
+    STAGE_MATCH,            // descriptors against the gallery
+    STAGE_ENCODE,           // matToBmp() / matToRaw()
+    STAGE_DETECTOR_FRAME,   // whole getFacePosePoints() frame
+    STAGE_RECOGNIZER_FRAME, // whole compareFaces() frame
+    STAGE_CAMERA_READ,      // desktop camera VideoCapture::read()
+    STAGE_LOCK_WAIT,        // waiting for a recognizer lock
+    STAGE_PRESENCE_WAKE,    // PresenceMonitor idle -> first full result
+    STAGE_PREFILTER,        // FacePrefilter candidates
+    STAGE_COUNT
+};
+
+enum PipelineCounter {
+    COUNTER_FRAMES = 0,         // frames processed
+    COUNTER_FACES,              // faces found
+    COUNTER_DROPS,              // frames refused: no model or empty image
+    COUNTER_LOW_QUALITY,        // faces not recognized because of faceQuality()
+    COUNTER_CACHE_HITS,         // descriptors reused from RecognitionCache
+    COUNTER_MOTION_SKIPS,       // detections skipped by MotionGate
+    COUNTER_COUNT
+};
+
+/*
+ * Aggregated stats returned through FFI. Percentiles are estimated from
+ * log-scale buckets, so they are accurate to about 20%
+ */
+struct StageStats {
+    int64_t count;
+    double p50Ms;
+    double p95Ms;
+    double p99Ms;
+    double maxMs;
+};
+
+struct PipelineStats {
+    int32_t nStages;
+    int32_t nCounters;
+    struct StageStats stages[STAGE_COUNT];
+    int64_t counters[COUNTER_COUNT];
+};
+
+const char *pipelineStageName(int32_t stage);
+
+void pipelineStatsRecord(PipelineStage stage, int64_t nanoseconds);
+
+/*
+ * pipelineStatsRecord() plus the span for pipeline_trace.h when tracing
+ */
+void pipelineStatsRecordSpan(PipelineStage stage, int64_t beginNs, int64_t durNs);
+
+void pipelineStatsCount(PipelineCounter counter, int64_t n);
+
+void pipelineStatsSnapshot(PipelineStats *stats);
+
+void pipelineStatsReset();
+
+/*
+ * Record the time spent in the enclosing scope into [stage]
+ */
+class StageTimer
+{
+public:
+    explicit StageTimer(PipelineStage stage)
+        : m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+
+    ~StageTimer() {
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        pipelineStatsRecordSpan(m_stage,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                m_start.time_since_epoch()).count(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                end - m_start).count());
+    }
+
+private:
+    PipelineStage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#ifndef FACE_PIPELINE_NO_STATS
+#   define STATS_CONCAT_(a, b) a##b
+#   define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+#   define STATS_SCOPE(stage) StageTimer STATS_CONCAT(_stageTimer, __LINE__)(stage)
+#   define STATS_COUNT(counter, n) pipelineStatsCount(counter, n)
+#else
+#   define STATS_SCOPE(stage) do {} while (0)
+#   define STATS_COUNT(counter, n) do {} while (0)
+#endif
+
+/*
+ * Lock [m] recording the time spent waiting as STAGE_LOCK_WAIT
+ */
+inline std::unique_lock<std::mutex> timedLock(std::mutex &m) {
+    STATS_SCOPE(STAGE_LOCK_WAIT);
+    return std::unique_lock<std::mutex>(m);
+}
+
+#endif // PIPELINE_STATS_H
@@ -0,0 +1,146 @@
+#include "pipeline_trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+
+std::atomic<bool> pipelineTraceOn(false);
+
+namespace {
+
+/*
+ * A slot of the ring. [seq] is odd while a writer fills the slot and
+ * 2*(index+1) when the span with that index is complete, so the dump can
+ * skip the slots being overwritten without locking the writers
+ */
+struct TraceSlot {
+    std::atomic<uint64_t> seq;
+    std::atomic<int64_t> beginNs;
+    std::atomic<int64_t> durNs;
+    std::atomic<uint32_t> tid;
+    std::atomic<int32_t> stage;
+};
+
+struct TraceRing {
+    explicit TraceRing(uint64_t capacity)
+        : capacity(capacity), slots(new TraceSlot[capacity]) {}
+
+    uint64_t capacity;
+    TraceSlot *slots;
+    std::atomic<uint64_t> head{0};
+    int64_t startNs = 0;
+};
+
+// rings are never freed: a writer could still hold the previous one
+std::atomic<TraceRing *> currentRing(nullptr);
+std::mutex ringMutex;    // serializes start and dump
+std::map<uint32_t, std::string> threadNames;
+
+std::atomic<uint32_t> nextTid(1);
+
+uint32_t threadId() {
+    thread_local uint32_t tid = nextTid.fetch_add(1);
+    return tid;
+}
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+void pipelineTraceStart(int32_t capacity)
+{
+    if (capacity < 1) capacity = 1;
+    std::lock_guard<std::mutex> guard(ringMutex);
+    pipelineTraceOn.store(false);
+    TraceRing *ring = currentRing.load();
+    if (ring == nullptr || ring->capacity != (uint64_t)capacity) {
+        ring = new TraceRing(capacity);
+    } else {
+        for (uint64_t i = 0; i < ring->capacity; ++i)
+            ring->slots[i].seq.store(0, std::memory_order_relaxed);
+        ring->head.store(0);
+    }
+    ring->startNs = nowNs();
+    currentRing.store(ring);
+    pipelineTraceOn.store(true);
+}
+
+void pipelineTraceStop()
+{
+    pipelineTraceOn.store(false);
+}
+
+void pipelineTraceRecord(PipelineStage stage, int64_t beginNs, int64_t durNs)
+{
+    TraceRing *ring = currentRing.load(std::memory_order_acquire);
+    if (ring == nullptr) return;
+    uint64_t index = ring->head.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot &slot = ring->slots[index % ring->capacity];
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.beginNs.store(beginNs, std::memory_order_relaxed);
+    slot.durNs.store(durNs, std::memory_order_relaxed);
+    slot.tid.store(threadId(), std::memory_order_relaxed);
+    slot.stage.store(stage, std::memory_order_relaxed);
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+}
+
+void pipelineTraceSetThreadName(const char *name)
+{
+    std::lock_guard<std::mutex> guard(ringMutex);
+    threadNames[threadId()] = name;
+}
+
+int64_t pipelineTraceDump(const char *path)
+{
+    std::lock_guard<std::mutex> guard(ringMutex);
+    std::ofstream out(path);
+    if (!out) return -1;
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (auto &t : threadNames) {
+        out << (first ? "\n" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t.first
+            << ",\"args\":{\"name\":\"" << t.second << "\"}}";
+        first = false;
+    }
+
+    int64_t written = 0;
+    TraceRing *ring = currentRing.load();
+    if (ring != nullptr) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t from = head > ring->capacity ? head - ring->capacity : 0;
+        for (uint64_t index = from; index < head; ++index) {
+            TraceSlot &slot = ring->slots[index % ring->capacity];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq != 2 * index + 2) continue;     // being written
+            int64_t beginNs = slot.beginNs.load(std::memory_order_relaxed);
+            int64_t durNs = slot.durNs.load(std::memory_order_relaxed);
+            uint32_t tid = slot.tid.load(std::memory_order_relaxed);
+            int32_t stage = slot.stage.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+            // spans started before pipelineTraceStart() are clipped
+            if (beginNs < ring->startNs) continue;
+
+            out << (first ? "\n" : ",\n")
+                << "{\"name\":\"" << pipelineStageName(stage)
+                << "\",\"cat\":\"pipeline\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                << ",\"ts\":" << (beginNs - ring->startNs) / 1000.0
+                << ",\"dur\":" << durNs / 1000.0 << "}";
+            first = false;
+            ++written;
+        }
+    }
+    out << "\n]}\n";
+    if (!out) return -1;
+    return written;
+}
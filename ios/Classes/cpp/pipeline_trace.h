@@ -0,0 +1,45 @@
+#ifndef PIPELINE_TRACE_H
+#define PIPELINE_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include "pipeline_stats.h"
+
+/*
+ * Opt-in tracing of the STATS_SCOPE() spans. While enabled every span is
+ * stored with its thread into a bounded ring which overwrites the oldest
+ * spans; pipelineTraceDump() writes the ring as Chrome trace-event JSON,
+ * which can be opened with chrome://tracing or ui.perfetto.dev.
+ */
+
+extern std::atomic<bool> pipelineTraceOn;
+
+inline bool pipelineTraceEnabled() {
+    return pipelineTraceOn.load(std::memory_order_relaxed);
+}
+
+/*
+ * Start recording the last [capacity] spans. Spans recorded before are
+ * discarded
+ */
+void pipelineTraceStart(int32_t capacity);
+
+void pipelineTraceStop();
+
+/*
+ * Store a span of [stage] started at [beginNs] (steady_clock) lasting [durNs]
+ */
+void pipelineTraceRecord(PipelineStage stage, int64_t beginNs, int64_t durNs);
+
+/*
+ * Name the calling thread in the trace (ie. "camera")
+ */
+void pipelineTraceSetThreadName(const char *name);
+
+/*
+ * Write the recorded spans to [path]. Return the number of spans written
+ * or -1 if the file cannot be written
+ */
+int64_t pipelineTraceDump(const char *path);
+
+#endif // PIPELINE_TRACE_H
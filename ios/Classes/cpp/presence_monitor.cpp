@@ -0,0 +1,134 @@
+#include "presence_monitor.h"
+#include "common.h"
+#include "pipeline_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <opencv2/imgproc.hpp>
+#include <dlib/opencv.h>
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PresenceMonitor::PresenceMonitor()
+{
+    memset(&m_state, 0, sizeof(m_state));
+    m_state.active = 1;
+}
+
+void PresenceMonitor::setEnabled(bool enabled)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_enabled = enabled;
+    // start active: the scene is unknown
+    m_active = true;
+    m_emptyCount = 0;
+    m_wakeStartNs = 0;
+}
+
+void PresenceMonitor::setIdleWidth(int32_t width)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_idleWidth = std::max(80, width);
+}
+
+void PresenceMonitor::setIdleStride(int32_t frames)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_idleStride = std::max(1, frames);
+}
+
+void PresenceMonitor::setEmptyFrames(int32_t frames)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_emptyFrames = std::max(1, frames);
+}
+
+void PresenceMonitor::sleep()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_active = false;
+    m_strideCount = 0;
+    m_wakeStartNs = 0;
+}
+
+bool PresenceMonitor::admit(const cv::Mat &raw, const FaceCommon &settings)
+{
+    int64_t startNs = nowNs();
+    int32_t idleWidth;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (!m_enabled || m_active) return true;
+        if (++m_strideCount < m_idleStride) {
+            m_state.idleSkips++;
+            return false;
+        }
+        m_strideCount = 0;
+        m_state.idleScans++;
+        idleWidth = m_idleWidth;
+    }
+
+    // reduce before converting: the conversion is the most of the cost
+    cv::Mat small;
+    double scale = (double)idleWidth / std::max(raw.cols, raw.rows);
+    if (scale < 1)
+        cv::resize(raw, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    else
+        small = raw.clone();
+    resampleMat(small, settings.m_colorSpace, -1,
+                settings.m_rotation, settings.m_flip);
+    if (!scan(small)) return false;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (!m_active) {
+        m_active = true;
+        m_emptyCount = 0;
+        m_wakeStartNs = startNs;
+        m_state.wakeUps++;
+    }
+    return true;
+}
+
+bool PresenceMonitor::scan(cv::Mat &rgb)
+{
+    std::lock_guard<std::mutex> guard(m_detectorMutex);
+    if (!m_detectorReady) {
+        m_detector = dlib::get_frontal_face_detector();
+        m_detectorReady = true;
+    }
+    STATS_SCOPE(STAGE_DETECT);
+    return !m_detector(dlib::cv_image<dlib::rgb_pixel>(rgb)).empty();
+}
+
+void PresenceMonitor::report(int32_t faces)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (!m_enabled || !m_active) return;
+    if (faces > 0) {
+        m_emptyCount = 0;
+        if (m_wakeStartNs != 0) {
+            int64_t durNs = nowNs() - m_wakeStartNs;
+            m_state.lastWakeMs = durNs / 1e6;
+            pipelineStatsRecordSpan(STAGE_PRESENCE_WAKE, m_wakeStartNs, durNs);
+            m_wakeStartNs = 0;
+        }
+        return;
+    }
+    if (++m_emptyCount >= m_emptyFrames) {
+        m_active = false;
+        m_strideCount = 0;
+        m_wakeStartNs = 0;
+    }
+}
+
+PresenceState PresenceMonitor::getState()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_state.enabled = m_enabled;
+    m_state.active = m_active;
+    return m_state;
+}
@@ -0,0 +1,80 @@
+#ifndef PRESENCE_MONITOR_H
+#define PRESENCE_MONITOR_H
+
+#include <cstdint>
+#include <mutex>
+#include <opencv2/core/mat.hpp>
+#include <dlib/image_processing/frontal_face_detector.h>
+#include "face_common.h"
+
+/*
+ * State of a PresenceMonitor. Returned to Dart as is (FFI struct)
+ */
+struct PresenceState {
+    int32_t enabled;
+    int32_t active;             // 1: full pipeline, 0: idle scanning
+    int64_t idleScans;          // frames scanned while idle
+    int64_t idleSkips;          // frames skipped while idle
+    int64_t wakeUps;            // idle -> active transitions
+    double lastWakeMs;          // candidate frame start -> first full result
+};
+
+/*
+ * Low-power mode for scenes which are empty most of the time.
+ *
+ * While idle only one frame every [idleStride] is looked at, reduced to
+ * [idleWidth] pixels (longest side) before the color conversion and
+ * scanned with the HOG detector (the small image gives a short pyramid),
+ * and the pipeline is skipped. A face candidate wakes the full pipeline up on the same frame;
+ * [emptyFrames] consecutive full frames without faces put it back to idle.
+ * The wake up latency is recorded in STAGE_PRESENCE_WAKE.
+ */
+class PresenceMonitor
+{
+public:
+    PresenceMonitor();
+
+    void setEnabled(bool enabled);
+    void setIdleWidth(int32_t width);
+    void setIdleStride(int32_t frames);
+    void setEmptyFrames(int32_t frames);
+
+    /*
+     * Called with every raw frame (as received, with the [settings] of
+     * the caller) before the pipeline. Return false if the frame must be
+     * skipped because the monitor is idle
+     */
+    bool admit(const cv::Mat &raw, const FaceCommon &settings);
+
+    /*
+     * Number of faces found by the pipeline in an admitted frame
+     */
+    void report(int32_t faces);
+
+    // go idle now, ie. to measure the wake up
+    void sleep();
+
+    PresenceState getState();
+
+private:
+    // true if the HOG detector finds a face in [rgb]
+    bool scan(cv::Mat &rgb);
+
+    std::mutex m_mutex;
+    bool m_enabled = false;
+    bool m_active = true;
+    int32_t m_idleWidth = 320;
+    int32_t m_idleStride = 3;
+    int32_t m_emptyFrames = 30;
+    int32_t m_emptyCount = 0;
+    int32_t m_strideCount = 0;
+    int64_t m_wakeStartNs = 0;      // 0: no wake up pending
+    PresenceState m_state;
+    bool m_detectorReady = false;
+
+    // only used by scan(), which runs outside m_mutex
+    std::mutex m_detectorMutex;
+    dlib::frontal_face_detector m_detector;
+};
+
+#endif // PRESENCE_MONITOR_H
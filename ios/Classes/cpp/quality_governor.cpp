@@ -0,0 +1,131 @@
+#include "quality_governor.h"
+
+#include <cstring>
+
+struct DetectorLevel {
+    double detectScale;
+    int32_t pyramidLevels;
+    int32_t detectInterval;
+    int32_t smoothingLimit;
+};
+
+// cheapest last. The pyramid goes down by 5/6 per level: 6 levels still
+// find faces up to ~2.5 times the smallest one, 4 levels ~1.7 times
+static const DetectorLevel DETECTOR_LEVELS[] = {
+    {1.0,  0, 1, 0},
+    {1.0,  0, 2, 0},
+    {0.75, 0, 2, 0},
+    {0.75, 6, 3, 4},
+    {0.5,  6, 4, 3},
+    {0.5,  4, 6, 2},
+};
+
+static const int32_t REFRESH_SCALES[] = {1, 2, 4, 8};
+
+// smoothing of the frame times
+static const double EWMA_ALPHA = 0.2;
+// frames over budget before stepping down
+static const int32_t STEP_DOWN_FRAMES = 3;
+// frames under UP_MARGIN * budget before stepping up
+static const int32_t STEP_UP_FRAMES = 30;
+static const double UP_MARGIN = 0.6;
+// frames for the average to reflect a new level
+static const int32_t COOLDOWN_FRAMES = 10;
+
+QualityGovernor::QualityGovernor()
+{
+    memset(&m_state, 0, sizeof(m_state));
+    m_detector.levels = sizeof(DETECTOR_LEVELS) / sizeof(DETECTOR_LEVELS[0]);
+    m_recognizer.levels = sizeof(REFRESH_SCALES) / sizeof(REFRESH_SCALES[0]);
+    fillKnobs();
+}
+
+void QualityGovernor::setBudget(double ms)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_state.budgetMs = ms > 0 ? ms : 0;
+    m_state.levelChanges = 0;
+    for (Ladder *ladder : {&m_detector, &m_recognizer}) {
+        int32_t levels = ladder->levels;
+        *ladder = Ladder();
+        ladder->levels = levels;
+        ladder->changed = true;
+    }
+    fillKnobs();
+}
+
+void QualityGovernor::setLandmarkTracking(bool enabled)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_landmarkTracking == enabled) return;
+    m_landmarkTracking = enabled;
+    m_detector.changed = true;
+    fillKnobs();
+}
+
+bool QualityGovernor::detectorFrame(int64_t durNs)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return frame(m_detector, durNs);
+}
+
+bool QualityGovernor::recognizerFrame(int64_t durNs)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return frame(m_recognizer, durNs);
+}
+
+bool QualityGovernor::frame(Ladder &ladder, int64_t durNs)
+{
+    double ms = durNs / 1e6;
+    ladder.frameMs = ladder.frameMs == 0
+            ? ms : ladder.frameMs + EWMA_ALPHA * (ms - ladder.frameMs);
+
+    double budget = m_state.budgetMs;
+    if (ladder.cooldown > 0) {
+        ladder.cooldown--;
+    } else if (budget > 0) {
+        ladder.overBudget = ladder.frameMs > budget ? ladder.overBudget + 1 : 0;
+        ladder.underBudget = ladder.frameMs < budget * UP_MARGIN
+                ? ladder.underBudget + 1 : 0;
+
+        int32_t step = 0;
+        if (ladder.overBudget >= STEP_DOWN_FRAMES && ladder.level + 1 < ladder.levels)
+            step = 1;
+        else if (ladder.underBudget >= STEP_UP_FRAMES && ladder.level > 0)
+            step = -1;
+        if (step != 0) {
+            ladder.level += step;
+            ladder.overBudget = 0;
+            ladder.underBudget = 0;
+            ladder.cooldown = COOLDOWN_FRAMES;
+            ladder.changed = true;
+            m_state.levelChanges++;
+        }
+    }
+    fillKnobs();
+
+    bool changed = ladder.changed;
+    ladder.changed = false;
+    return changed;
+}
+
+void QualityGovernor::fillKnobs()
+{
+    const DetectorLevel &d = DETECTOR_LEVELS[m_detector.level];
+    m_state.detectorFrameMs = m_detector.frameMs;
+    m_state.recognizerFrameMs = m_recognizer.frameMs;
+    m_state.detectorLevel = m_detector.level;
+    m_state.recognizerLevel = m_recognizer.level;
+    m_state.detectScale = d.detectScale;
+    m_state.pyramidLevels = d.pyramidLevels;
+    m_state.detectInterval = m_landmarkTracking ? d.detectInterval : 1;
+    m_state.smoothingLimit = d.smoothingLimit;
+    m_state.refreshScale = REFRESH_SCALES[m_recognizer.level];
+}
+
+GovernorState QualityGovernor::getState()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_state;
+}
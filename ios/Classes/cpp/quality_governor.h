@@ -0,0 +1,88 @@
+#ifndef QUALITY_GOVERNOR_H
+#define QUALITY_GOVERNOR_H
+
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Decisions of QualityGovernor and the measures they are based on.
+ * Returned to Dart as is (FFI struct)
+ */
+struct GovernorState {
+    double budgetMs;            // target time per frame, 0 = disabled
+    double detectorFrameMs;     // smoothed cost of the detector frames
+    double recognizerFrameMs;   // smoothed cost of the recognizer frames
+    int32_t detectorLevel;      // 0 = full quality
+    int32_t recognizerLevel;
+    double detectScale;         // image scale used by the HOG detector
+    int32_t pyramidLevels;      // HOG pyramid levels, 0 = all
+    int32_t detectInterval;     // frames per detection, tracking between
+    int32_t smoothingLimit;     // max anti-shake samples, 0 = no limit
+    int32_t refreshScale;       // multiplier of the refresh interval
+    int64_t levelChanges;       // since the budget was set
+};
+
+/*
+ * Keeps the frame time under a budget degrading the quality step by step.
+ *
+ * The detector and the recognizer have their own ladder of levels, each
+ * one cheaper than the previous:
+ *  - detector: a longer detection interval (landmark tracking between
+ *    detections), a smaller detection scale, fewer pyramid levels and a
+ *    shorter smoothing window, so the smoothing lag stays the same when
+ *    each sample covers more time
+ *  - recognizer: a longer descriptor refresh interval
+ * Every frame time is averaged (EWMA). A ladder steps down after a few
+ * frames over budget and steps back up after many frames well under
+ * budget, so a thermal throttled device settles on a steady frame rate
+ * instead of oscillating.
+ */
+class QualityGovernor
+{
+public:
+    QualityGovernor();
+
+    /*
+     * Target time per frame in ms. 0 disables the governor and restores
+     * the full quality
+     */
+    void setBudget(double ms);
+
+    /*
+     * Without landmark tracking (ie. rectangles only) the detector can't
+     * follow the faces between detections: the detection interval stays
+     * 1 and the other knobs still degrade
+     */
+    void setLandmarkTracking(bool enabled);
+
+    /*
+     * Record the duration of a frame. Return true if the knobs of that
+     * side changed since the last call: the caller applies them
+     */
+    bool detectorFrame(int64_t durNs);
+    bool recognizerFrame(int64_t durNs);
+
+    GovernorState getState();
+
+private:
+    struct Ladder {
+        double frameMs = 0;
+        int32_t level = 0;
+        int32_t levels = 1;
+        int32_t overBudget = 0;     // consecutive frames over budget
+        int32_t underBudget = 0;    // consecutive frames well under budget
+        int32_t cooldown = 0;       // frames to ignore after a change
+        bool changed = false;
+    };
+
+    bool frame(Ladder &ladder, int64_t durNs);
+    void fillKnobs();
+
+    std::mutex m_mutex;
+    GovernorState m_state;
+    bool m_landmarkTracking = true;
+    Ladder m_detector;
+    Ladder m_recognizer;
+};
+
+#endif // QUALITY_GOVERNOR_H
@@ -0,0 +1,70 @@
+#include "recognition_cache.h"
+
+#include <algorithm>
+#include <bitset>
+
+/*
+ * Average hash: reduce the chip to 8x8 gray and set a bit for each
+ * pixel brighter than the mean
+ */
+uint64_t RecognitionCache::chipHash(const dlib::matrix<dlib::rgb_pixel> &chip)
+{
+    if (chip.nr() < 8 || chip.nc() < 8) return 0;
+
+    uint32_t cells[64] = {0};
+    long cellH = chip.nr() / 8;
+    long cellW = chip.nc() / 8;
+    for (long r = 0; r < cellH * 8; ++r) {
+        for (long c = 0; c < cellW * 8; ++c) {
+            const dlib::rgb_pixel &p = chip(r, c);
+            cells[(r / cellH) * 8 + c / cellW] += p.red + p.green + p.blue;
+        }
+    }
+
+    uint64_t sum = 0;
+    for (int i = 0; i < 64; ++i) sum += cells[i];
+    uint64_t mean = sum / 64;
+
+    uint64_t hash = 0;
+    for (int i = 0; i < 64; ++i)
+        if (cells[i] > mean) hash |= (uint64_t)1 << i;
+    return hash;
+}
+
+bool RecognitionCache::lookup(int32_t trackId, uint64_t hash,
+                              dlib::matrix<float,0,1> &descriptor)
+{
+    if (m_refreshInterval <= 0 || trackId < 0) return false;
+    auto it = m_entries.find(trackId);
+    if (it == m_entries.end()) return false;
+
+    if (it->second.age >= m_refreshInterval * m_refreshScale ||
+            (int32_t)std::bitset<64>(it->second.hash ^ hash).count() > m_maxHashDistance)
+        return false;
+
+    descriptor = it->second.descriptor;
+    return true;
+}
+
+void RecognitionCache::store(int32_t trackId, uint64_t hash,
+                             const dlib::matrix<float,0,1> &descriptor)
+{
+    if (m_refreshInterval <= 0 || trackId < 0) return;
+    Entry &e = m_entries[trackId];
+    e.descriptor = descriptor;
+    e.hash = hash;
+    e.age = 0;
+}
+
+void RecognitionCache::nextFrame(const std::vector<int32_t> &aliveTracks)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+        if (std::find(aliveTracks.begin(), aliveTracks.end(), it->first) ==
+                aliveTracks.end()) {
+            it = m_entries.erase(it);
+        } else {
+            it->second.age++;
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef RECOGNITION_CACHE_H
+#define RECOGNITION_CACHE_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+
+/*
+ * Cache of the face descriptors computed for each tracked face.
+ * While a face is tracked its descriptor is reused and recomputed only every
+ * [refreshInterval] frames or when its chip changes too much. The chip
+ * change is checked with a 64 bit average hash of an 8x8 gray thumbnail.
+ */
+class RecognitionCache
+{
+public:
+    RecognitionCache() {}
+
+    /*
+     * Number of frames after which a cached descriptor is recomputed.
+     * 0 disables the cache
+     */
+    void setRefreshInterval(int32_t frames) {m_refreshInterval = frames;}
+    int32_t getRefreshInterval() const {return m_refreshInterval;}
+
+    /*
+     * Multiplier of the refresh interval, set by QualityGovernor
+     */
+    void setRefreshScale(int32_t scale) {m_refreshScale = scale < 1 ? 1 : scale;}
+
+    /*
+     * Max number of different bits between the chip hashes to consider
+     * the chip unchanged
+     */
+    void setMaxHashDistance(int32_t bits) {m_maxHashDistance = bits;}
+
+    static uint64_t chipHash(const dlib::matrix<dlib::rgb_pixel> &chip);
+
+    /*
+     * Return true and fill [descriptor] if [trackId] has a valid descriptor
+     * for a chip with hash [hash]
+     */
+    bool lookup(int32_t trackId, uint64_t hash,
+                dlib::matrix<float,0,1> &descriptor);
+
+    void store(int32_t trackId, uint64_t hash,
+               const dlib::matrix<float,0,1> &descriptor);
+
+    /*
+     * Must be called once per processed frame: ages the entries and removes
+     * the ones whose track is not in [aliveTracks]
+     */
+    void nextFrame(const std::vector<int32_t> &aliveTracks);
+
+    void clear() {m_entries.clear();}
+
+private:
+    struct Entry {
+        dlib::matrix<float,0,1> descriptor;
+        uint64_t hash;
+        int32_t age;
+    };
+
+    std::map<int32_t, Entry> m_entries;
+    int32_t m_refreshInterval = 15;
+    int32_t m_refreshScale = 1;
+    int32_t m_maxHashDistance = 10;
+};
+
+#endif // RECOGNITION_CACHE_H
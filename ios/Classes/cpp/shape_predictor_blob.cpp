@@ -0,0 +1,225 @@
+#include "shape_predictor_blob.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <streambuf>
+#include <dlib/image_processing.h>
+
+static_assert(sizeof(ShapeBlobHeader) == 96, "ShapeBlobHeader layout");
+static_assert(sizeof(ShapeBlobCascade) == 16, "ShapeBlobCascade layout");
+static_assert(sizeof(ShapeBlobFeature) == 12, "ShapeBlobFeature layout");
+static_assert(sizeof(ShapeBlobSplit) == 8, "ShapeBlobSplit layout");
+
+namespace {
+
+// read-only stream over [data], which is not copied
+class MemoryBuffer : public std::streambuf
+{
+public:
+    MemoryBuffer(const char *data, int64_t size)
+    {
+        char *p = const_cast<char *>(data);
+        setg(p, p, p + size);
+    }
+};
+
+uint64_t align(uint64_t offset)
+{
+    return (offset + SHAPE_BLOB_ALIGNMENT - 1) / SHAPE_BLOB_ALIGNMENT
+           * SHAPE_BLOB_ALIGNMENT;
+}
+
+// rounded to nearest even, clamped to the largest half float
+uint16_t floatToHalf(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t abs = f & 0x7fffffff;
+    if (abs >= 0x477ff000) return sign | 0x7bff;    // 65520 and up, nan
+    if (abs < 0x38800000) {
+        // subnormal half: 0.5 + value rounds at the half subnormal step
+        float a;
+        memcpy(&a, &abs, sizeof(a));
+        a += 0.5f;
+        uint32_t b;
+        memcpy(&b, &a, sizeof(b));
+        return sign | (b - 0x3f000000);
+    }
+    abs += 0xc8000fff + ((abs >> 13) & 1);
+    return sign | (abs >> 13);
+}
+
+size_t leafValueSize(int32_t encoding)
+{
+    switch (encoding) {
+        case SHAPE_LEAVES_FP16: return sizeof(uint16_t);
+        case SHAPE_LEAVES_INT8: return sizeof(int8_t);
+        default: return sizeof(float);
+    }
+}
+
+} // namespace
+
+bool packShapePredictor(const char *data, int64_t size,
+                        const ShapeBlobOptions &options, std::vector<char> &blob)
+{
+    if (data == nullptr || size <= 0 || options.leafEncoding < 0
+            || options.leafEncoding >= SHAPE_LEAVES_COUNT)
+        return false;
+
+    // the members of dlib::shape_predictor, in the order of its serialize()
+    MemoryBuffer buffer(data, size);
+    std::istream in(&buffer);
+    int version = 0;
+    dlib::deserialize(version, in);
+    if (version != 1)
+        throw dlib::serialization_error("Unexpected version found while deserializing dlib::shape_predictor.");
+    dlib::matrix<float,0,1> initialShape;
+    std::vector<std::vector<dlib::impl::regression_tree>> forests;
+    std::vector<std::vector<unsigned long>> anchors;
+    std::vector<std::vector<dlib::vector<float,2>>> deltas;
+    dlib::deserialize(initialShape, in);
+    dlib::deserialize(forests, in);
+    dlib::deserialize(anchors, in);
+    dlib::deserialize(deltas, in);
+
+    const uint32_t parts = initialShape.size() / 2;
+    if (parts == 0 || initialShape.size() % 2 != 0
+            || anchors.size() != forests.size() || deltas.size() != forests.size())
+        return false;
+
+    // every tree is complete and of the same depth
+    uint32_t depth = 0;
+    bool depthKnown = false;
+    uint32_t treeCount = 0, featureCount = 0;
+    for (size_t c = 0; c < forests.size(); ++c) {
+        if (options.maxTrees > 0 && forests[c].size() > (size_t)options.maxTrees)
+            forests[c].resize(options.maxTrees);
+        if (anchors[c].size() != deltas[c].size() || anchors[c].size() > 65536)
+            return false;
+        for (unsigned long a : anchors[c])
+            if (a >= parts) return false;
+        for (const dlib::impl::regression_tree &tree : forests[c]) {
+            const size_t leaves = tree.leaf_values.size();
+            if (!depthKnown) {
+                while (((size_t)1 << depth) < leaves && depth < 16) ++depth;
+                depthKnown = true;
+            }
+            if (leaves != ((size_t)1 << depth) || tree.splits.size() != leaves - 1)
+                return false;
+            for (const dlib::impl::split_feature &s : tree.splits)
+                if (s.idx1 >= anchors[c].size() || s.idx2 >= anchors[c].size())
+                    return false;
+            for (const dlib::matrix<float,0,1> &leaf : tree.leaf_values)
+                if (leaf.size() != 2 * parts) return false;
+        }
+        treeCount += forests[c].size();
+        featureCount += anchors[c].size();
+    }
+
+    const uint32_t leaves = 1u << depth;
+    const uint32_t splits = leaves - 1;
+    const size_t values = 2 * parts;
+    const size_t leafSize = values * leafValueSize(options.leafEncoding);
+
+    ShapeBlobHeader header = {};
+    memcpy(header.magic, SHAPE_BLOB_MAGIC, sizeof(header.magic));
+    header.version = SHAPE_BLOB_VERSION;
+    header.leafEncoding = options.leafEncoding;
+    header.parts = parts;
+    header.cascadeCount = forests.size();
+    header.treeDepth = depth;
+    header.treeCount = treeCount;
+    header.featureCount = featureCount;
+    header.shapeOffset = align(sizeof(header));
+    header.cascadeOffset = align(header.shapeOffset + values * sizeof(float));
+    header.featureOffset = align(header.cascadeOffset
+                                 + forests.size() * sizeof(ShapeBlobCascade));
+    header.splitOffset = align(header.featureOffset
+                               + (uint64_t)featureCount * sizeof(ShapeBlobFeature));
+    header.leafOffset = align(header.splitOffset
+                              + (uint64_t)treeCount * splits * sizeof(ShapeBlobSplit));
+    uint64_t end = header.leafOffset + (uint64_t)treeCount * leaves * leafSize;
+    if (options.leafEncoding == SHAPE_LEAVES_INT8) {
+        header.scaleOffset = align(end);
+        end = header.scaleOffset + (uint64_t)treeCount * leaves * sizeof(float);
+    }
+    header.size = align(end);
+
+    blob.assign(header.size, 0);
+    char *out = blob.data();
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + header.shapeOffset, &initialShape(0), values * sizeof(float));
+
+    uint32_t tree = 0, feature = 0;
+    for (size_t c = 0; c < forests.size(); ++c) {
+        ShapeBlobCascade cascade;
+        cascade.firstTree = tree;
+        cascade.treeCount = forests[c].size();
+        cascade.firstFeature = feature;
+        cascade.featureCount = anchors[c].size();
+        memcpy(out + header.cascadeOffset + c * sizeof(cascade), &cascade, sizeof(cascade));
+
+        for (size_t i = 0; i < anchors[c].size(); ++i, ++feature) {
+            ShapeBlobFeature f;
+            f.dx = deltas[c][i].x();
+            f.dy = deltas[c][i].y();
+            f.anchor = anchors[c][i];
+            memcpy(out + header.featureOffset + (uint64_t)feature * sizeof(f), &f, sizeof(f));
+        }
+
+        for (const dlib::impl::regression_tree &t : forests[c]) {
+            for (uint32_t i = 0; i < splits; ++i) {
+                ShapeBlobSplit s;
+                s.idx1 = t.splits[i].idx1;
+                s.idx2 = t.splits[i].idx2;
+                s.thresh = t.splits[i].thresh;
+                memcpy(out + header.splitOffset
+                       + ((uint64_t)tree * splits + i) * sizeof(s), &s, sizeof(s));
+            }
+            for (uint32_t l = 0; l < leaves; ++l) {
+                const uint64_t leaf = (uint64_t)tree * leaves + l;
+                const float *v = &t.leaf_values[l](0);
+                char *dst = out + header.leafOffset + leaf * leafSize;
+                if (options.leafEncoding == SHAPE_LEAVES_FP32) {
+                    memcpy(dst, v, leafSize);
+                } else if (options.leafEncoding == SHAPE_LEAVES_FP16) {
+                    for (size_t k = 0; k < values; ++k) {
+                        uint16_t h = floatToHalf(v[k]);
+                        memcpy(dst + k * sizeof(h), &h, sizeof(h));
+                    }
+                } else {
+                    float largest = 0;
+                    for (size_t k = 0; k < values; ++k)
+                        largest = std::max(largest, std::fabs(v[k]));
+                    const float scale = largest / 127;
+                    memcpy(out + header.scaleOffset + leaf * sizeof(scale), &scale, sizeof(scale));
+                    for (size_t k = 0; k < values; ++k)
+                        dst[k] = scale > 0 ? (int8_t)std::lround(v[k] / scale) : 0;
+                }
+            }
+            ++tree;
+        }
+        // the leaves of the .dat model are released as they are packed
+        std::vector<dlib::impl::regression_tree>().swap(forests[c]);
+    }
+    return true;
+}
+
+bool writeShapePredictorBlob(const char *data, int64_t size,
+                             const ShapeBlobOptions &options, std::ostream &out)
+{
+    std::vector<char> blob;
+    if (!packShapePredictor(data, size, options, blob)) return false;
+    out.write(blob.data(), blob.size());
+    return (bool)out;
+}
+
+bool isShapePredictorBlob(const char *data, int64_t size)
+{
+    return data != nullptr && size >= (int64_t)sizeof(ShapeBlobHeader)
+           && memcmp(data, SHAPE_BLOB_MAGIC, 8) == 0;
+}
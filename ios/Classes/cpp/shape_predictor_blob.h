@@ -0,0 +1,106 @@
+#ifndef SHAPE_PREDICTOR_BLOB_H
+#define SHAPE_PREDICTOR_BLOB_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/*
+ * Flat file of a dlib::shape_predictor (.spb), read in place by
+ * FaceShapePredictor. shape_predictor_68_face_landmarks.dat is ~99 MB,
+ * almost all of it leaf values, each leaf a matrix deserialized on its
+ * own.
+ *
+ * File layout (little endian), every section at an offset multiple of
+ * SHAPE_BLOB_ALIGNMENT:
+ *   ShapeBlobHeader
+ *   the initial shape: [parts] x, y floats (normalized to the face box)
+ *   the cascades: [cascadeCount] ShapeBlobCascade
+ *   the features: [featureCount] ShapeBlobFeature, the pixels of all the
+ *   cascades
+ *   the splits: 2^treeDepth - 1 ShapeBlobSplit per tree, breadth first
+ *   (the children of split i are 2i + 1 and 2i + 2)
+ *   the leaves: 2^treeDepth per tree, each one the [parts] x, y deltas
+ *   added to the shape, as [leafEncoding]
+ *   SHAPE_LEAVES_INT8 only: one float scale per leaf
+ * Written by face_model_convert (linux/benchmark)
+ */
+
+enum ShapeLeafEncoding {
+    SHAPE_LEAVES_FP32 = 0,      // as in the .dat model
+    SHAPE_LEAVES_FP16,          // half floats, 1/2 of the size
+    SHAPE_LEAVES_INT8,          // value = int8 * scale of the leaf, ~1/4
+    SHAPE_LEAVES_COUNT
+};
+
+#pragma pack(push, 1)
+struct ShapeBlobHeader {
+    char magic[8];              // SHAPE_BLOB_MAGIC, not null terminated
+    uint32_t version;           // SHAPE_BLOB_VERSION
+    uint32_t leafEncoding;      // ShapeLeafEncoding
+    uint32_t parts;
+    uint32_t cascadeCount;
+    uint32_t treeDepth;         // the same for all the trees
+    uint32_t treeCount;         // of all the cascades
+    uint32_t featureCount;      // of all the cascades
+    uint32_t reserved0;
+    uint64_t shapeOffset;
+    uint64_t cascadeOffset;
+    uint64_t featureOffset;
+    uint64_t splitOffset;
+    uint64_t leafOffset;
+    uint64_t scaleOffset;       // 0 without scales
+    uint64_t size;              // of the whole blob
+};
+#pragma pack(pop)
+
+// the tables are read in place: no padding, every field naturally aligned
+struct ShapeBlobCascade {
+    uint32_t firstTree;
+    uint32_t treeCount;
+    uint32_t firstFeature;
+    uint32_t featureCount;
+};
+
+// pixel of a cascade, relative to a part of the initial shape
+struct ShapeBlobFeature {
+    float dx;
+    float dy;
+    uint32_t anchor;            // part
+};
+
+// left child if feature idx1 - feature idx2 > thresh, features of the cascade
+struct ShapeBlobSplit {
+    uint16_t idx1;
+    uint16_t idx2;
+    float thresh;
+};
+
+#define SHAPE_BLOB_MAGIC "SPREDBLB"
+#define SHAPE_BLOB_VERSION 1
+#define SHAPE_BLOB_ALIGNMENT 64
+
+struct ShapeBlobOptions {
+    int32_t leafEncoding = SHAPE_LEAVES_FP16;
+    // first trees kept in every cascade, 0 = all: the cascades are
+    // gradient boosted, the last trees add the smallest corrections
+    int32_t maxTrees = 0;
+};
+
+/*
+ * Pack the dlib .dat shape predictor [data] in a blob, [blob] is
+ * replaced. Throw dlib::serialization_error if [data] isn't a
+ * shape_predictor, return false if its trees can't be packed (not all of
+ * the same depth, more than 65536 features in a cascade)
+ */
+bool packShapePredictor(const char *data, int64_t size,
+                        const ShapeBlobOptions &options, std::vector<char> &blob);
+
+// packShapePredictor() of [data] written to [out]
+bool writeShapePredictorBlob(const char *data, int64_t size,
+                             const ShapeBlobOptions &options, std::ostream &out);
+
+// true if [data] starts with the header of a blob
+bool isShapePredictorBlob(const char *data, int64_t size);
+
+#endif // SHAPE_PREDICTOR_BLOB_H
@@ -0,0 +1,60 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/*
+ * Bounded lock-free queue for exactly one producer thread and one consumer
+ * thread at a time. Both ends never block: tryPush() fails when full and
+ * tryPop() fails when empty.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity)
+        : m_slots(capacity + 1), m_head(0), m_tail(0) {}
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    bool tryPush(T &&item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = increment(tail);
+        if (next == m_head.load(std::memory_order_acquire)) return false;
+        m_slots[tail] = std::move(item);
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) return false;
+        item = std::move(m_slots[head]);
+        m_slots[head] = T();
+        m_head.store(increment(head), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) ==
+                m_tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const {return m_slots.size() - 1;}
+
+private:
+    size_t increment(size_t i) const {return i + 1 == m_slots.size() ? 0 : i + 1;}
+
+    std::vector<T> m_slots;
+    // producer and consumer indexes on different cache lines (padding
+    // instead of alignas: C++14 new ignores extended alignments)
+    std::atomic<size_t> m_head;
+    char m_padding[64];
+    std::atomic<size_t> m_tail;
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,136 @@
+#include "staged_pipeline.h"
+#include "pipeline_stats.h"
+#include "task_scheduler.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+StagedRecognizer::StagedRecognizer(FaceRecognition &recognition,
+                                   FaceGallery &gallery,
+                                   int32_t maxInFlight)
+    : m_recognition(recognition),
+      m_gallery(gallery),
+      m_maxInFlight(maxInFlight < 1 ? 1 : maxInFlight),
+      m_output(m_maxInFlight),
+      m_inFlight(0),
+      m_runningTasks(0)
+{
+    for (int s = 0; s < N_STAGES; ++s) {
+        m_queues.emplace_back(new SpscQueue<FramePtr>(m_maxInFlight));
+        m_scheduled[s].store(false);
+    }
+}
+
+StagedRecognizer::~StagedRecognizer()
+{
+    while (m_runningTasks.load() > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+int64_t StagedRecognizer::submit(const cv::Mat &img)
+{
+    if (m_inFlight.load() >= m_maxInFlight) {
+        STATS_COUNT(COUNTER_DROPS, 1);
+        return -1;
+    }
+    m_inFlight.fetch_add(1);
+    STATS_COUNT(COUNTER_FRAMES, 1);
+
+    FramePtr frame(new StagedFrame());
+    frame->id = m_nextId++;
+    frame->submitNs = nowNs();
+    // the caller owns [img] data
+    img.copyTo(frame->img);
+    int64_t id = frame->id;
+    m_queues[CONVERT]->tryPush(std::move(frame));
+    schedule(CONVERT);
+    return id;
+}
+
+bool StagedRecognizer::poll(StagedFrame &frame)
+{
+    FramePtr f;
+    if (!m_output.tryPop(f)) return false;
+    frame = std::move(*f);
+    m_inFlight.fetch_sub(1);
+    return true;
+}
+
+void StagedRecognizer::schedule(int stage)
+{
+    if (m_scheduled[stage].exchange(true)) return;
+    m_runningTasks.fetch_add(1);
+    // the stages up to the landmarks decide the frame latency
+    TaskScheduler::instance().submit([this, stage]() {drain(stage);},
+            stage <= EXTRACT ? PRIORITY_LATENCY : PRIORITY_NORMAL);
+}
+
+void StagedRecognizer::drain(int stage)
+{
+    for (;;) {
+        FramePtr frame;
+        while (m_queues[stage]->tryPop(frame)) {
+            process(stage, *frame);
+            // the queues can hold maxInFlight frames, which is the most
+            // frames submit() lets in: the push can't fail
+            if (stage + 1 < N_STAGES) {
+                m_queues[stage + 1]->tryPush(std::move(frame));
+                schedule(stage + 1);
+            } else {
+                m_output.tryPush(std::move(frame));
+            }
+        }
+        m_scheduled[stage].store(false);
+        // a frame pushed after the last tryPop() but before the store
+        // didn't schedule a new task: take it here
+        if (m_queues[stage]->empty() || m_scheduled[stage].exchange(true))
+            break;
+    }
+    m_runningTasks.fetch_sub(1);
+}
+
+void StagedRecognizer::process(int stage, StagedFrame &frame)
+{
+    try {
+        switch (stage) {
+            case CONVERT:
+                m_recognition.adjustSource(frame.img);
+                break;
+            case DETECT:
+                frame.rects = m_recognition.detectRects(frame.img);
+                break;
+            case EXTRACT:
+                frame.faces = m_recognition.extractFaces(frame.img, frame.rects);
+                break;
+            case EMBED:
+                // the snapshot stays valid even if faces are added or removed
+                frame.gallery = m_gallery.snapshot();
+                if (!frame.gallery->faces.empty())
+                    m_recognition.computeDescriptors(frame.faces);
+                break;
+            case MATCH: {
+                if (frame.gallery) {
+                    STATS_SCOPE(STAGE_MATCH);
+                    frame.matches = FaceRecognition::matchFaces(
+                            frame.gallery->faces, frame.faces);
+                }
+                int64_t now = nowNs();
+                pipelineStatsRecordSpan(STAGE_RECOGNIZER_FRAME,
+                                        frame.submitNs, now - frame.submitNs);
+                break;
+            }
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Native StagedRecognizer stage " << stage << ": "
+                  << e.what() << std::endl;
+    }
+}
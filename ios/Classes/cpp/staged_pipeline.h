@@ -0,0 +1,84 @@
+#ifndef STAGED_PIPELINE_H
+#define STAGED_PIPELINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include "facerecognition.h"
+#include "face_gallery.h"
+#include "spsc_queue.h"
+
+/*
+ * A frame flowing through StagedRecognizer. Every stage fills its part
+ */
+struct StagedFrame {
+    int64_t id = -1;
+    int64_t submitNs = 0;
+    cv::Mat img;                            // CONVERT: adjusted image
+    std::vector<dlib::full_object_detection> rects; // DETECT
+    std::vector<ReconFace> faces;           // EXTRACT: landmarks, chips
+    FaceGallery::Snapshot gallery;          // EMBED: descriptors
+    std::vector<FaceMatch> matches;         // MATCH
+};
+
+/*
+ * compareFaces() split in stages (convert, detect, landmarks/chips,
+ * embed, match) connected by lock-free queues. Every stage runs as a task
+ * of the process TaskScheduler and processes one frame at a time, so
+ * consecutive frames overlap: frame N+1 is detected while frame N is
+ * embedded. The throughput approaches the cost of the slowest stage.
+ *
+ * Results are returned in submission order. submit() must be called by
+ * one thread at a time and the same for poll().
+ */
+class StagedRecognizer
+{
+public:
+    StagedRecognizer(FaceRecognition &recognition, FaceGallery &gallery,
+                     int32_t maxInFlight = 4);
+
+    // waits for the frames still in the stages
+    ~StagedRecognizer();
+
+    /*
+     * Copy [img] into the pipeline. Return its frame id or -1 when
+     * maxInFlight frames are already in the pipeline (the frame is dropped)
+     */
+    int64_t submit(const cv::Mat &img);
+
+    /*
+     * Get the oldest completed frame. Return false if none is ready
+     */
+    bool poll(StagedFrame &frame);
+
+    int32_t getMaxInFlight() {return m_maxInFlight;}
+
+private:
+    enum Stage {CONVERT = 0, DETECT, EXTRACT, EMBED, MATCH, N_STAGES};
+
+    typedef std::unique_ptr<StagedFrame> FramePtr;
+
+    void schedule(int stage);
+    void drain(int stage);
+    void process(int stage, StagedFrame &frame);
+
+    FaceRecognition &m_recognition;
+    FaceGallery &m_gallery;
+    int32_t m_maxInFlight;
+    int64_t m_nextId = 0;
+
+    // m_queues[s] is the input of stage s, m_output the completed frames.
+    // Each queue has one producer and one consumer because every stage
+    // is drained by at most one task at a time (m_scheduled)
+    std::vector<std::unique_ptr<SpscQueue<FramePtr>>> m_queues;
+    SpscQueue<FramePtr> m_output;
+    std::atomic<bool> m_scheduled[N_STAGES];
+
+    // frames submitted and not yet polled: bounds every queue
+    std::atomic<int32_t> m_inFlight;
+    std::atomic<int32_t> m_runningTasks;
+};
+
+#endif // STAGED_PIPELINE_H
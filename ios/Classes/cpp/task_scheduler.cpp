@@ -0,0 +1,387 @@
+#include "task_scheduler.h"
+#include "pipeline_trace.h"
+
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <string>
+
+#if defined(__linux__) || defined(__ANDROID__)
+#   include <sched.h>
+#endif
+
+// index of the worker running on this thread, -1 for the other threads
+static thread_local int32_t workerIndex = -1;
+
+static int32_t defaultWorkers()
+{
+    return std::max(2u, std::thread::hardware_concurrency());
+}
+
+TaskScheduler &TaskScheduler::instance()
+{
+    // never destroyed: tasks can still run while the process exits
+    static TaskScheduler *scheduler = new TaskScheduler();
+    return *scheduler;
+}
+
+TaskScheduler::TaskScheduler()
+    : m_policy(SCHED_POLICY_NONE),
+      m_stop(false)
+{
+    for (auto &queued : m_queued) queued.store(0);
+    m_topology = readCpuTopology(m_topologyRoot);
+    startWorkers(defaultWorkers(), SCHED_POLICY_NONE);
+}
+
+void TaskScheduler::configure(int32_t workers, int32_t policy)
+{
+    if (workers <= 0) workers = defaultWorkers();
+    if (policy < 0 || policy >= SCHED_POLICY_COUNT) policy = SCHED_POLICY_NONE;
+    // a worker can't wait for itself to stop
+    if (workerIndex >= 0) return;
+    std::lock_guard<std::mutex> guard(m_configMutex);
+    stopWorkers();
+    m_topology = readCpuTopology(m_topologyRoot);
+    startWorkers(workers, policy);
+}
+
+void TaskScheduler::setTopologyRoot(const std::string &root)
+{
+    std::lock_guard<std::mutex> guard(m_configMutex);
+    m_topologyRoot = root.empty() ? CPU_SYSFS_ROOT : root;
+}
+
+int32_t TaskScheduler::getWorkers()
+{
+    std::lock_guard<std::mutex> guard(m_configMutex);
+    return m_workers.size();
+}
+
+int32_t TaskScheduler::getPolicy()
+{
+    std::lock_guard<std::mutex> guard(m_configMutex);
+    return m_policy;
+}
+
+int32_t TaskScheduler::getFastWorkers()
+{
+    std::lock_guard<std::mutex> guard(m_configMutex);
+    return m_fastWorkers;
+}
+
+int32_t TaskScheduler::acceptingWorkers(TaskPriority priority)
+{
+    std::lock_guard<std::mutex> guard(m_configMutex);
+    int32_t count = m_workers.size();
+    if (m_policy != SCHED_POLICY_BIG_LITTLE || priority == PRIORITY_NORMAL)
+        return count;
+    return priority == PRIORITY_LATENCY ? m_fastWorkers : count - m_fastWorkers;
+}
+
+CpuTopology TaskScheduler::getTopology()
+{
+    std::lock_guard<std::mutex> guard(m_configMutex);
+    return m_topology;
+}
+
+void TaskScheduler::startWorkers(int32_t count, int32_t policy)
+{
+    const std::vector<TaskPriority> all =
+        {PRIORITY_LATENCY, PRIORITY_NORMAL, PRIORITY_BACKGROUND};
+
+    // big.LITTLE needs two groups: at least a worker in each
+    if (policy == SCHED_POLICY_BIG_LITTLE &&
+            (!m_topology.heterogeneous() || count < 2))
+        policy = SCHED_POLICY_NONE;
+    m_policy = policy;
+    m_fastWorkers = policy == SCHED_POLICY_BIG_LITTLE
+            ? std::min<int32_t>(m_topology.fast.size(), count - 1)
+            : count;
+
+    m_stop.store(false);
+    for (int32_t i = 0; i < count; ++i) {
+        Worker *w = new Worker();
+        if (policy == SCHED_POLICY_BIG_LITTLE) {
+            bool fast = i < m_fastWorkers;
+            w->accepts = fast
+                    ? std::vector<TaskPriority>{PRIORITY_LATENCY, PRIORITY_NORMAL}
+                    : std::vector<TaskPriority>{PRIORITY_NORMAL, PRIORITY_BACKGROUND};
+            w->cpus = fast ? m_topology.fast : m_topology.slow;
+        } else {
+            w->accepts = all;
+            if (policy == SCHED_POLICY_PIN)
+                w->cpus.push_back(m_topology.cpus[i % m_topology.cpus.size()].id);
+        }
+        m_workers.emplace_back(w);
+    }
+    for (int32_t i = 0; i < count; ++i)
+        m_workers[i]->thread = std::thread(&TaskScheduler::workerLoop, this, i);
+}
+
+void TaskScheduler::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_sleepMutex);
+        m_stop.store(true);
+    }
+    m_wake.notify_all();
+    for (auto &w : m_workers)
+        if (w->thread.joinable()) w->thread.join();
+
+    // the tasks left in the workers deques go to the next workers
+    std::lock_guard<std::mutex> guard(m_injectMutex);
+    for (auto &w : m_workers)
+        for (int p = 0; p < PRIORITY_COUNT; ++p)
+            for (auto &task : w->tasks[p])
+                m_inject[p].push_back(std::move(task));
+    m_workers.clear();
+}
+
+bool TaskScheduler::accepts(int32_t index, TaskPriority priority)
+{
+    // the other threads only run tasks while waiting for them
+    if (index < 0) return true;
+    auto &accepts = m_workers[index]->accepts;
+    return std::find(accepts.begin(), accepts.end(), priority) != accepts.end();
+}
+
+bool TaskScheduler::hasWork(int32_t index)
+{
+    for (TaskPriority p : m_workers[index]->accepts)
+        if (m_queued[p].load() > 0) return true;
+    return false;
+}
+
+void TaskScheduler::submit(Task task, TaskPriority priority)
+{
+    if (workerIndex >= 0 && accepts(workerIndex, priority)) {
+        Worker &w = *m_workers[workerIndex];
+        std::lock_guard<std::mutex> guard(w.mutex);
+        w.tasks[priority].push_back(std::move(task));
+    } else {
+        std::lock_guard<std::mutex> guard(m_injectMutex);
+        m_inject[priority].push_back(std::move(task));
+    }
+    m_queued[priority].fetch_add(1);
+    {
+        // taking the lock orders the increment with the sleeping workers
+        std::lock_guard<std::mutex> guard(m_sleepMutex);
+    }
+    // the woken worker may not accept [priority]: wake them all when the
+    // workers are split
+    if (m_policy == SCHED_POLICY_BIG_LITTLE)
+        m_wake.notify_all();
+    else
+        m_wake.notify_one();
+}
+
+bool TaskScheduler::popTask(int32_t index, TaskPriority lowest, Task &task)
+{
+    if (index < 0) {
+        // not a worker: never the background tasks
+        for (int p = 0; p <= std::min<int>(lowest, PRIORITY_NORMAL); ++p)
+            if (popTaskOf(index, (TaskPriority)p, task)) return true;
+        return false;
+    }
+    for (TaskPriority p : m_workers[index]->accepts)
+        if (p <= lowest && popTaskOf(index, p, task)) return true;
+    return false;
+}
+
+bool TaskScheduler::popTaskOf(int32_t index, TaskPriority priority, Task &task)
+{
+    if (m_queued[priority].load() == 0) return false;
+
+    if (index >= 0) {
+        Worker &w = *m_workers[index];
+        std::lock_guard<std::mutex> guard(w.mutex);
+        if (!w.tasks[priority].empty()) {
+            task = std::move(w.tasks[priority].back());
+            w.tasks[priority].pop_back();
+            m_queued[priority].fetch_sub(1);
+            return true;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_injectMutex);
+        if (!m_inject[priority].empty()) {
+            task = std::move(m_inject[priority].front());
+            m_inject[priority].pop_front();
+            m_queued[priority].fetch_sub(1);
+            return true;
+        }
+    }
+    // only the workers can steal: the other threads don't synchronize
+    // with configure()
+    if (index < 0) return false;
+    size_t n = m_workers.size();
+    for (size_t i = 1; i < n; ++i) {
+        Worker &victim = *m_workers[(index + i) % n];
+        std::lock_guard<std::mutex> guard(victim.mutex);
+        if (!victim.tasks[priority].empty()) {
+            task = std::move(victim.tasks[priority].front());
+            victim.tasks[priority].pop_front();
+            m_queued[priority].fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::run(Task &task)
+{
+    try {
+        task();
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Native TaskScheduler task: " << e.what() << std::endl;
+    }
+}
+
+void TaskScheduler::workerLoop(int32_t index)
+{
+    workerIndex = index;
+    Worker &w = *m_workers[index];
+    std::string name = (m_policy == SCHED_POLICY_BIG_LITTLE
+            ? (index < m_fastWorkers ? "fast worker " : "slow worker ")
+            : "worker ") + std::to_string(index);
+    pipelineTraceSetThreadName(name.c_str());
+#if defined(__linux__) || defined(__ANDROID__)
+    if (!w.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int32_t cpu : w.cpus) CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            std::cout << "Native TaskScheduler: can't pin " << name << std::endl;
+    }
+#endif
+
+    while (!m_stop.load()) {
+        Task task;
+        if (popTask(index, PRIORITY_BACKGROUND, task)) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this, index]() {
+            return m_stop.load() || hasWork(index);
+        });
+    }
+    workerIndex = -1;
+}
+
+bool TaskScheduler::runPending(TaskPriority lowest)
+{
+    Task task;
+    if (!popTask(workerIndex, lowest, task)) return false;
+    run(task);
+    return true;
+}
+
+void TaskScheduler::runPlaced(Task task, TaskPriority priority)
+{
+    if (m_policy != SCHED_POLICY_BIG_LITTLE
+            || (workerIndex >= 0 && accepts(workerIndex, priority))) {
+        task();
+        return;
+    }
+    // waiting without running queued tasks: this thread could pick up
+    // [task] itself
+    std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+    std::future<void> result = done->get_future();
+    submit([task, done]() {
+        try {
+            task();
+            done->set_value();
+        }
+        catch (...)
+        {
+            done->set_exception(std::current_exception());
+        }
+    }, priority);
+    result.get();
+}
+
+void TaskScheduler::parallelFor(int64_t begin, int64_t end,
+                                const std::function<void(int64_t)> &fn,
+                                int64_t grain, TaskPriority priority)
+{
+    if (grain < 1) grain = 1;
+    if (end - begin <= grain) {
+        for (int64_t i = begin; i < end; ++i) fn(i);
+        return;
+    }
+    TaskGroup group;
+    for (int64_t from = begin; from < end; from += grain) {
+        int64_t to = std::min(end, from + grain);
+        group.run([&fn, from, to]() {
+            for (int64_t i = from; i < to; ++i) fn(i);
+        }, priority);
+    }
+    group.wait();
+}
+
+void TaskScheduler::forkJoin(int64_t begin, int64_t end,
+                             const std::function<void(int64_t)> &fn,
+                             int64_t grain, int32_t threads, TaskPriority priority)
+{
+    if (grain < 1) grain = 1;
+    // the other workers would never take the tasks
+    int32_t workers = acceptingWorkers(priority) + 1;
+    if (threads <= 0 || threads > workers) threads = workers;
+    int64_t chunks = (end - begin + grain - 1) / grain;
+    if (threads > chunks) threads = chunks;
+    if (threads <= 1) {
+        for (int64_t i = begin; i < end; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<int64_t> next(begin);
+    auto work = [&fn, &next, end, grain]() {
+        for (;;) {
+            int64_t from = next.fetch_add(grain);
+            if (from >= end) return;
+            int64_t to = std::min(end, from + grain);
+            for (int64_t i = from; i < to; ++i) fn(i);
+        }
+    };
+    TaskGroup group;
+    for (int32_t t = 1; t < threads; ++t)
+        group.run(std::cref(work), priority);
+    work();
+    group.wait();
+}
+
+void TaskGroup::run(TaskScheduler::Task task, TaskPriority priority)
+{
+    m_pending.fetch_add(1);
+    int32_t lowest = m_lowest.load();
+    while (priority > lowest && !m_lowest.compare_exchange_weak(lowest, priority));
+    TaskScheduler::instance().submit([this, task]() {
+        try {
+            task();
+        }
+        catch (std::exception& e)
+        {
+            std::cout << "Native TaskGroup task: " << e.what() << std::endl;
+        }
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (m_pending.fetch_sub(1) == 1)
+            m_done.notify_all();
+    }, priority);
+}
+
+void TaskGroup::wait()
+{
+    while (m_pending.load() > 0) {
+        if (TaskScheduler::instance().runPending((TaskPriority)m_lowest.load()))
+            continue;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait_for(lock, std::chrono::milliseconds(1),
+                        [this]() {return m_pending.load() == 0;});
+    }
+    // the last task can still hold the mutex it notified with
+    std::lock_guard<std::mutex> guard(m_mutex);
+}
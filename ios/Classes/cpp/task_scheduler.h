@@ -0,0 +1,186 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpu_topology.h"
+
+/*
+ * Class of a task, which decides the workers allowed to run it under
+ * SCHED_POLICY_BIG_LITTLE
+ */
+enum TaskPriority {
+    PRIORITY_LATENCY = 0,   // on the frame critical path: detection, landmarks
+    PRIORITY_NORMAL,
+    PRIORITY_BACKGROUND,    // enrolment jitter
+    PRIORITY_COUNT
+};
+
+/*
+ * Placement of the workers on the CPUs
+ */
+enum SchedulerPolicy {
+    SCHED_POLICY_NONE = 0,      // the OS places the workers
+    SCHED_POLICY_PIN,           // worker i only runs on core i % cores
+    SCHED_POLICY_BIG_LITTLE,    // latency workers on the fast cores,
+                                // background workers on the slow cores
+    SCHED_POLICY_COUNT
+};
+
+/*
+ * Process-wide work-stealing scheduler used by all the native parallelism
+ * (staged pipeline, descriptors, gallery search, jitter).
+ *
+ * Every worker owns a deque per priority: tasks submitted by a worker go
+ * to the back of its own deque and are run LIFO, idle workers steal from
+ * the front of the others. Tasks submitted by other threads go to a
+ * shared injection queue. Tasks should not block for long: the blocking
+ * loops (desktop camera, training data loaders) own threads.
+ *
+ * Under SCHED_POLICY_BIG_LITTLE the workers are split in a fast group,
+ * allowed on the fast cores only and running latency and normal tasks,
+ * and a slow group on the other cores running normal and background
+ * tasks, so background work never delays a frame. On identical cores it
+ * behaves as SCHED_POLICY_NONE. The work of the callers threads (ie. the
+ * Dart isolate) isn't placed: the detection and the landmarks go to the
+ * fast workers with runPlaced().
+ */
+class TaskScheduler
+{
+public:
+    typedef std::function<void()> Task;
+
+    static TaskScheduler &instance();
+
+    /*
+     * Restart the pool with [workers] threads (<= 0 uses the number of
+     * cores) placed with [policy] (see SchedulerPolicy, pinning works on
+     * Linux and Android only). Queued tasks are kept.
+     * Ignored when called by a task
+     */
+    void configure(int32_t workers, int32_t policy);
+
+    /*
+     * Read the CPU topology from [root] instead of CPU_SYSFS_ROOT at the
+     * next configure(). Used to simulate big.LITTLE devices
+     */
+    void setTopologyRoot(const std::string &root);
+
+    int32_t getWorkers();
+    int32_t getPolicy();
+
+    // the fast workers are the first ones
+    int32_t getFastWorkers();
+
+    CpuTopology getTopology();
+
+    void submit(Task task, TaskPriority priority = PRIORITY_NORMAL);
+
+    /*
+     * Run one queued task of [lowest] priority or more urgent in the
+     * calling thread. Return false if there was none. Used by waiters to
+     * help instead of sleeping. The other threads never run background
+     * tasks: a frame waiting for its tasks must not load training data
+     */
+    bool runPending(TaskPriority lowest = PRIORITY_BACKGROUND);
+
+    /*
+     * Run [task] on a worker accepting [priority] and wait for it when
+     * the calling thread isn't one and the workers are split (ie. the
+     * Dart isolate under SCHED_POLICY_BIG_LITTLE), else run it in the
+     * calling thread. The exceptions of [task] are thrown to the caller
+     */
+    void runPlaced(Task task, TaskPriority priority);
+
+    /*
+     * Call [fn](i) for i in [begin, end) on the workers, [grain] indexes
+     * per task, and wait for them
+     */
+    void parallelFor(int64_t begin, int64_t end,
+                     const std::function<void(int64_t)> &fn,
+                     int64_t grain = 1,
+                     TaskPriority priority = PRIORITY_NORMAL);
+
+    /*
+     * parallelFor() on at most [threads] threads, the caller included,
+     * and never more than the workers accepting [priority] and the
+     * caller (<= 0: all of them). Only threads - 1 tasks are queued:
+     * every thread takes [grain] indexes at a time from a shared counter
+     * until there are none left, so a late or slow thread costs nothing. Used to split one computation (ie. a layer of the
+     * recognition network) without a task per chunk
+     */
+    void forkJoin(int64_t begin, int64_t end,
+                  const std::function<void(int64_t)> &fn,
+                  int64_t grain, int32_t threads,
+                  TaskPriority priority = PRIORITY_NORMAL);
+
+private:
+    TaskScheduler();
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks[PRIORITY_COUNT];
+        std::thread thread;
+        // priorities run by this worker, most urgent first
+        std::vector<TaskPriority> accepts;
+        std::vector<int32_t> cpus;      // empty: not pinned
+    };
+
+    void startWorkers(int32_t count, int32_t policy);
+    void stopWorkers();
+    void workerLoop(int32_t index);
+    bool accepts(int32_t index, TaskPriority priority);
+    int32_t acceptingWorkers(TaskPriority priority);
+    bool hasWork(int32_t index);
+    bool popTask(int32_t index, TaskPriority lowest, Task &task);
+    bool popTaskOf(int32_t index, TaskPriority priority, Task &task);
+    void run(Task &task);
+
+    std::mutex m_configMutex;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<int32_t> m_policy;
+    int32_t m_fastWorkers = 0;
+    std::string m_topologyRoot = CPU_SYSFS_ROOT;
+    CpuTopology m_topology;
+
+    std::mutex m_injectMutex;
+    std::deque<Task> m_inject[PRIORITY_COUNT];
+
+    // sleeping workers wait for a queued task they accept
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    std::atomic<int64_t> m_queued[PRIORITY_COUNT];
+    std::atomic<bool> m_stop;
+};
+
+/*
+ * Tasks which can be waited together. wait() runs queued tasks while
+ * waiting, so it can be called from a worker without deadlocks: only
+ * tasks at least as urgent as the least urgent one of the group, so that
+ * waiting for latency tasks doesn't run a long background task
+ */
+class TaskGroup
+{
+public:
+    TaskGroup() : m_pending(0), m_lowest(PRIORITY_LATENCY) {}
+    ~TaskGroup() {wait();}
+
+    void run(TaskScheduler::Task task, TaskPriority priority = PRIORITY_NORMAL);
+    void wait();
+
+private:
+    std::atomic<int32_t> m_pending;
+    std::atomic<int32_t> m_lowest;      // least urgent priority run
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+};
+
+#endif // TASK_SCHEDULER_H
@@ -277,6 +277,11 @@ Future<FacePoints> getFacePosePointsIsolate(Map params) async {
       .lookup<NativeFunction<Bool Function()>>('getGetOnlyRectangle')
       .asFunction<bool Function()>();
 
+  var getFaceTrackIds = nativeLib
+      .lookup<NativeFunction<Pointer<Int32> Function(Pointer<Int32> faceCount)>>(
+          'getFaceTrackIds')
+      .asFunction<Pointer<Int32> Function(Pointer<Int32> faceCount)>();
+
   int width = params['width'];
   int height = params['height'];
   int bytesPerPixel = params['bytesPerPixel'];
@@ -298,8 +303,17 @@ Future<FacePoints> getFacePosePointsIsolate(Map params) async {
       .asTypedList(retFaceCount.value * (onlyRect ? 2 : 68) * 2)
       .toList();
 
+  List<int> ids = [];
+  Pointer<Int32> retIdsCount = calloc<Int32>(4);
+  Pointer<Int32> retIds = getFaceTrackIds(retIdsCount);
+  if (retIds != nullptr) {
+    ids = retIds.asTypedList(retIdsCount.value).toList();
+    calloc.free(retIds);
+  }
+  calloc.free(retIdsCount);
+
   FacePoints ret =
-      FacePoints(retFaceCount.value, (onlyRect ? 2 : 68), points, []);
+      FacePoints(retFaceCount.value, (onlyRect ? 2 : 68), points, [], ids);
   calloc.free(retFaceCount);
   calloc.free(retFacePoints);
   calloc.free(buffer);
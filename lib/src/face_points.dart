@@ -4,11 +4,16 @@ class FacePoints {
   final List<int> points;
   final List<String> names;
 
-  FacePoints(this.nFaces, this.nFacePoints, this.points, this.names);
+  /// persistent id of each face: the same person keeps the same id
+  /// while tracked across frames
+  final List<int> ids;
+
+  FacePoints(this.nFaces, this.nFacePoints, this.points, this.names,
+      [this.ids = const []]);
 
   @override
   String toString() {
     return 'Faces: $nFaces,  points per faces: $nFacePoints,  '
-        'names: $names,  n points: ${points.length}';
+        'names: $names,  ids: $ids,  n points: ${points.length}';
   }
 }
\ No newline at end of file
@@ -298,6 +298,9 @@ Future<List<RecognizedFace>> compareFaceIsolate(Map params) async {
     if (resultingFaces[i].ref.faceImg != nullptr) {
       calloc.free(resultingFaces[i].ref.faceImg);
     }
+    if (resultingFaces[i].ref.name != nullptr) {
+      calloc.free(resultingFaces[i].ref.name);
+    }
     if (resultingFaces[i] != nullptr) {
       calloc.free(resultingFaces[i]);
     }
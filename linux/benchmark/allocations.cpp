@@ -0,0 +1,157 @@
+/*
+ * Heap allocations of FaceNetEngine::runBatch() once the workspace of its
+ * batch bucket exists: none on a single thread, on several threads only
+ * the few tasks of the scheduler, never a workspace buffer.
+ *
+ * The allocations are counted by the global operator new below, so this
+ * test has an executable of its own: the benchmark timings don't pay
+ * for the counting.
+ *
+ * usage: face_engine_allocations [--models DIR] [--iterations N]
+ *
+ * DIR must contain dlib_face_recognition_resnet_model_v1.dat. Exit code:
+ * 0 passed, 2 failed, 77 skipped (model not found).
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "face_models.h"
+#include "face_net_engine.h"
+#include "bench_chips.h"
+
+using namespace std;
+
+// exit code of a skipped test (SKIP_RETURN_CODE of the ctest target)
+static const int EXIT_SKIPPED = 77;
+
+static atomic<int64_t> allocations(0);
+static atomic<int64_t> allocatedBytes(0);
+// a workspace buffer of the engine is larger than this
+static const size_t LARGE_ALLOCATION = 4096;
+static atomic<int64_t> largeAllocations(0);
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    allocatedBytes.fetch_add(size, memory_order_relaxed);
+    if (size >= LARGE_ALLOCATION)
+        largeAllocations.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+static string readFile(const string &path)
+{
+    ifstream in(path, ios::binary);
+    if (!in) return string();
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+int main(int argc, char **argv)
+{
+    string modelsDir = ".";
+    int iterations = 5;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--models" && i + 1 < argc) modelsDir = argv[++i];
+        else if (arg == "--iterations" && i + 1 < argc)
+            iterations = max(1, atoi(argv[++i]));
+        else {
+            cerr << "usage: " << argv[0] << " [--models DIR] [--iterations N]" << endl;
+            return 1;
+        }
+    }
+
+    string fr = readFile(modelsDir + "/dlib_face_recognition_resnet_model_v1.dat");
+    if (fr.empty()) {
+        cout << "faceDescriptor allocations skipped: model not found" << endl;
+        return EXIT_SKIPPED;
+    }
+    shared_ptr<const FaceNetEngine> engine = faceNetEngine(loadFaceNet(fr.data(), fr.size()));
+    if (!engine) {
+        cerr << "faceDescriptor allocations FAILED: no engine for the model" << endl;
+        return 2;
+    }
+
+    dlib::rand rnd(3);
+    vector<dlib::matrix<dlib::rgb_pixel>> chips;
+    vector<const uint8_t *> pixels;
+    for (int i = 0; i < FaceNetEngine::MAX_BATCH; ++i)
+        chips.push_back(noiseChip(rnd));
+    for (auto &chip : chips)
+        pixels.push_back(reinterpret_cast<const uint8_t *>(&chip(0, 0)));
+    vector<float> descriptors(pixels.size() * FaceNetEngine::DESCRIPTOR_SIZE);
+
+    // every bucket, and batches padded to one
+    const vector<int> batches = {1, 2, 3, 4, 5, FaceNetEngine::MAX_BATCH};
+    for (int batch : batches)
+        engine->reserve(batch);
+    int failures = 0;
+    for (int32_t threads : {1, 0}) {
+        FaceNetEngine::setThreads(threads);
+        int64_t calls = 0;
+        int64_t count = allocations.load(), bytes = allocatedBytes.load(),
+                large = largeAllocations.load();
+        for (int i = 0; i < iterations; ++i)
+            for (int batch : batches) {
+                engine->runBatch(pixels.data(), batch, descriptors.data());
+                ++calls;
+            }
+        count = allocations.load() - count;
+        bytes = allocatedBytes.load() - bytes;
+        large = largeAllocations.load() - large;
+
+        string variant = threads == 1 ? "1 thread" : "all threads";
+        cout << "faceDescriptor engine steady state, " << variant << ": "
+             << (double)count / calls << " allocations (" << (double)bytes / calls
+             << " bytes) per batch, " << large << " of " << LARGE_ALLOCATION
+             << " bytes or more" << endl;
+        if (large > 0) {
+            cerr << "faceDescriptor allocations " << variant << " FAILED: " << large
+                 << " workspace sized allocations after the warm up" << endl;
+            ++failures;
+        } else if (threads == 1 && count > 0) {
+            cerr << "faceDescriptor allocations " << variant << " FAILED: " << count
+                 << " allocations after the warm up" << endl;
+            ++failures;
+        }
+    }
+    FaceNetEngine::setThreads(0);
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,22 @@
+#ifndef BENCH_CHIPS_H
+#define BENCH_CHIPS_H
+
+#include <dlib/image_processing.h>
+#include <dlib/rand.h>
+
+/*
+ * A 150x150 chip of random pixels, the input of the recognition network
+ * when the image has no face: it runs the same layers
+ */
+inline dlib::matrix<dlib::rgb_pixel> noiseChip(dlib::rand &rnd)
+{
+    dlib::matrix<dlib::rgb_pixel> chip(150, 150);
+    for (long r = 0; r < chip.nr(); ++r)
+        for (long c = 0; c < chip.nc(); ++c)
+            chip(r, c) = dlib::rgb_pixel(rnd.get_random_8bit_number(),
+                                         rnd.get_random_8bit_number(),
+                                         rnd.get_random_8bit_number());
+    return chip;
+}
+
+#endif // BENCH_CHIPS_H
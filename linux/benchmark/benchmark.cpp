@@ -0,0 +1,1115 @@
+/*
+ * Native benchmark of the pipeline stages.
+ *
+ * Every stage runs [iterations] times after a warm up run and the
+ * timings are written as JSON, so that different runs (or different
+ * devices) can be compared with a script.
+ *
+ * usage: face_benchmark [--models DIR] [--image FILE] [--iterations N]
+ *                       [--out FILE] [--workers N] [--policy P]
+ *                       [--sysfs DIR] [--cascade FILE]
+ *                       [--yunet FILE] [--sface FILE] [--require-models]
+ *
+ * DIR must contain the model files used by the plugin assets:
+ *   shape_predictor_68_face_landmarks.dat
+ *   shape_predictor_5_face_landmarks-B.dat
+ *   dlib_face_recognition_resnet_model_v1.dat
+ * The stages which need a missing model are reported as skipped. The
+ * correctness checks (ie. the folded network against the affine one) are
+ * reported as failed and the exit code is then 2. With --require-models
+ * nothing runs when one of them is missing and the exit code is 77
+ * (skipped), so that the checks can't pass without running.
+ *
+ * --workers and --policy configure the task scheduler (see
+ * SchedulerPolicy). --sysfs reads the CPU capacities from a fake
+ * /sys/devices/system/cpu tree, ie. to simulate a big.LITTLE device:
+ *   DIR/cpu0/cpu_capacity .. DIR/cpu3/cpu_capacity = 512
+ *   DIR/cpu4/cpu_capacity .. DIR/cpu7/cpu_capacity = 1024
+ *
+ * --cascade is an OpenCV cascade XML file (ie.
+ * haarcascade_frontalface_default.xml) for the PREFILTER_CASCADE stage of
+ * the coarse-to-fine detector. Its recall is measured against the faces
+ * of the single-stage HOG detector.
+ *
+ * --yunet and --sface are the ONNX models of the OpenCV detector and
+ * recognizer backends, compared with the dlib ones on the same frames.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include <dlib/opencv.h>
+#include <dlib/image_processing.h>
+#include <dlib/image_processing/frontal_face_detector.h>
+
+#include "common.h"
+#include "face_models.h"
+#include "face_net_blob.h"
+#include "shape_predictor_blob.h"
+#include "face_gallery.h"
+#include "facerecognition.h"
+#include "task_scheduler.h"
+#include "face_pipeline.h"
+#include "face_prefilter.h"
+#include "face_backend.h"
+#include "motion_gate.h"
+#include "bench_chips.h"
+
+#ifndef BENCH_DEFAULT_IMAGE
+#   define BENCH_DEFAULT_IMAGE "face points 68.jpeg"
+#endif
+
+using namespace std;
+
+// exit code of a skipped run (SKIP_RETURN_CODE of the ctest target)
+static const int EXIT_SKIPPED = 77;
+
+struct BenchResult {
+    string stage;
+    string variant;
+    int iterations = 0;
+    int items = 1;          // items processed per iteration (ie faces in a batch)
+    double minMs = 0;
+    double medianMs = 0;
+    double meanMs = 0;
+    double p95Ms = 0;
+    double maxMs = 0;
+    double recall = -1;     // share of the reference faces found, -1: not measured
+};
+
+struct BenchSkipped {
+    string stage;
+    string reason;
+};
+
+struct BenchFailure {
+    string stage;
+    string reason;
+};
+
+static vector<BenchResult> results;
+static vector<BenchSkipped> skipped;
+static vector<BenchFailure> failed;
+
+// keeps the compiler from optimizing away the benchmarked calls
+static volatile int64_t sink = 0;
+
+/*
+ * Store the statistics of [times] (ms), measured by the caller
+ */
+static void store(const string &stage, const string &variant,
+                  int items, vector<double> times)
+{
+    sort(times.begin(), times.end());
+
+    BenchResult r;
+    r.stage = stage;
+    r.variant = variant;
+    r.iterations = times.size();
+    r.items = items;
+    r.minMs = times.front();
+    r.maxMs = times.back();
+    r.medianMs = times[times.size() / 2];
+    r.p95Ms = times[min(times.size() - 1, (size_t)(times.size() * 0.95))];
+    double sum = 0;
+    for (double t : times) sum += t;
+    r.meanMs = sum / times.size();
+    results.push_back(r);
+
+    cout << stage << " [" << variant << "] median " << r.medianMs
+         << " ms  p95 " << r.p95Ms << " ms" << endl;
+}
+
+/*
+ * Run [body] [iterations] times and store its timings. [setup] runs before
+ * every call of [body] and is not timed
+ */
+static void measure(const string &stage, const string &variant,
+                    int iterations, int items,
+                    const function<void()> &setup,
+                    const function<void()> &body)
+{
+    // warm up: caches, lazy allocations and thread pools
+    setup();
+    body();
+
+    vector<double> times;
+    times.reserve(iterations);
+    for (int i = 0; i < iterations; ++i) {
+        setup();
+        auto t0 = chrono::steady_clock::now();
+        body();
+        auto t1 = chrono::steady_clock::now();
+        times.push_back(chrono::duration<double, milli>(t1 - t0).count());
+    }
+    store(stage, variant, items, times);
+}
+
+static void measure(const string &stage, const string &variant,
+                    int iterations, const function<void()> &body)
+{
+    measure(stage, variant, iterations, 1, [](){}, body);
+}
+
+static void skip(const string &stage, const string &reason)
+{
+    skipped.push_back({stage, reason});
+    cout << stage << " skipped: " << reason << endl;
+}
+
+// a correctness check which doesn't hold: the run fails
+static void fail(const string &stage, const string &reason)
+{
+    failed.push_back({stage, reason});
+    cerr << stage << " FAILED: " << reason << endl;
+}
+
+static string sizeString(const cv::Mat &m)
+{
+    return to_string(m.cols) + "x" + to_string(m.rows);
+}
+
+static string jsonString(const string &s)
+{
+    string ret = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') ret += '\\';
+        ret += c;
+    }
+    return ret + "\"";
+}
+
+static void writeJson(ostream &out, const string &image, int iterations)
+{
+    out << "{\n";
+    out << "  \"version\": 1,\n";
+    out << "  \"timestamp\": " << time(nullptr) << ",\n";
+    out << "  \"hardware_concurrency\": " << thread::hardware_concurrency() << ",\n";
+    out << "  \"image\": " << jsonString(image) << ",\n";
+    out << "  \"iterations\": " << iterations << ",\n";
+
+    TaskScheduler &scheduler = TaskScheduler::instance();
+    CpuTopology topology = scheduler.getTopology();
+    out << "  \"scheduler\": {\"workers\": " << scheduler.getWorkers()
+        << ", \"policy\": " << scheduler.getPolicy()
+        << ", \"fast_workers\": " << scheduler.getFastWorkers()
+        << ", \"cpus\": [";
+    for (size_t i = 0; i < topology.cpus.size(); ++i)
+        out << (i ? ", " : "") << "{\"id\": " << topology.cpus[i].id
+            << ", \"capacity\": " << topology.cpus[i].capacity << "}";
+    out << "], \"fast\": [";
+    for (size_t i = 0; i < topology.fast.size(); ++i)
+        out << (i ? ", " : "") << topology.fast[i];
+    out << "], \"slow\": [";
+    for (size_t i = 0; i < topology.slow.size(); ++i)
+        out << (i ? ", " : "") << topology.slow[i];
+    out << "]},\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        out << (i ? ",\n" : "\n")
+            << "    {\"stage\": " << jsonString(r.stage)
+            << ", \"variant\": " << jsonString(r.variant)
+            << ", \"iterations\": " << r.iterations
+            << ", \"items\": " << r.items
+            << ", \"min_ms\": " << r.minMs
+            << ", \"median_ms\": " << r.medianMs
+            << ", \"mean_ms\": " << r.meanMs
+            << ", \"p95_ms\": " << r.p95Ms
+            << ", \"max_ms\": " << r.maxMs;
+        if (r.recall >= 0) out << ", \"recall\": " << r.recall;
+        out << "}";
+    }
+    out << "\n  ],\n";
+    out << "  \"skipped\": [";
+    for (size_t i = 0; i < skipped.size(); ++i) {
+        out << (i ? ",\n" : "\n")
+            << "    {\"stage\": " << jsonString(skipped[i].stage)
+            << ", \"reason\": " << jsonString(skipped[i].reason) << "}";
+    }
+    out << "\n  ],\n";
+    out << "  \"failed\": [";
+    for (size_t i = 0; i < failed.size(); ++i) {
+        out << (i ? ",\n" : "\n")
+            << "    {\"stage\": " << jsonString(failed[i].stage)
+            << ", \"reason\": " << jsonString(failed[i].reason) << "}";
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+}
+
+static string readFile(const string &path)
+{
+    ifstream in(path, ios::binary);
+    if (!in) return string();
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// a random unit length descriptor
+static dlib::matrix<float,0,1> randomDescriptor(dlib::rand &rnd)
+{
+    dlib::matrix<float,0,1> d(128);
+    for (long i = 0; i < d.size(); ++i)
+        d(i) = rnd.get_random_gaussian();
+    return d / dlib::length(d);
+}
+
+// -------------------------------------------------------------------------
+/// stages
+
+static void benchConversions(const cv::Mat &rgb, int iterations)
+{
+    // synthetic frames in every input format, as the camera plugins send them
+    cv::Mat noise(720, 1280, CV_8UC3);
+    cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(255));
+
+    struct Input { ColorSpace cs; const char *name; cv::Mat mat; };
+    vector<Input> inputs;
+    cv::Mat bgr, rgba, gray;
+    cv::cvtColor(noise, bgr, cv::COLOR_RGB2BGR);
+    cv::cvtColor(noise, rgba, cv::COLOR_RGB2RGBA);
+    cv::cvtColor(noise, gray, cv::COLOR_RGB2GRAY);
+    inputs.push_back({SRC_RGB, "SRC_RGB", noise});
+    inputs.push_back({SRC_BGR, "SRC_BGR", bgr});
+    inputs.push_back({SRC_RGBA, "SRC_RGBA", rgba});
+    inputs.push_back({SRC_YUV, "SRC_YUV", noise});
+    inputs.push_back({SRC_GRAY, "SRC_GRAY", gray});
+
+    for (auto &in : inputs) {
+        cv::Mat work;
+        for (double scale : {1.0, 0.5}) {
+            measure("resampleMat",
+                    string(in.name) + " " + sizeString(in.mat) +
+                        " scale " + to_string(scale).substr(0, 3),
+                    iterations, 1,
+                    [&](){ in.mat.copyTo(work); },
+                    [&](){ resampleMat(work, in.cs, scale, -1, 2); });
+        }
+    }
+    cv::Mat work;
+    measure("resampleMat", "SRC_RGB " + sizeString(noise) + " rotate 90 flip",
+            iterations, 1,
+            [&](){ noise.copyTo(work); },
+            [&](){ resampleMat(work, SRC_RGB, 1.0, 0, 1); });
+
+    cv::Mat img = rgb.clone();
+    measure("matToBmp", sizeString(img), iterations, [&](){
+        int32_t len;
+        u_char *bmp = matToBmp(img, &len);
+        sink += len;
+        free(bmp);
+    });
+    measure("matToRaw", sizeString(img), iterations, [&](){
+        int32_t w, h, bpp, len;
+        u_char *raw = matToRaw(img, &w, &h, &bpp, &len);
+        sink += len;
+        free(raw);
+    });
+}
+
+static vector<dlib::rectangle> benchDetection(const cv::Mat &rgb, int iterations)
+{
+    dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+    vector<dlib::rectangle> faces;
+
+    for (double scale : {1.0, 0.5, 0.25}) {
+        cv::Mat img;
+        cv::resize(rgb, img, cv::Size(0, 0), scale, scale);
+        dlib::cv_image<dlib::rgb_pixel> frame(img);
+        vector<dlib::rectangle> found;
+        measure("hogDetector", sizeString(img), iterations, [&](){
+            found = detector(frame);
+            sink += found.size();
+        });
+        if (scale == 1.0) faces = found;
+    }
+
+    // the same detector on a frame without faces
+    cv::Mat noise(rgb.rows, rgb.cols, CV_8UC3);
+    cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(255));
+    dlib::cv_image<dlib::rgb_pixel> frame(noise);
+    measure("hogDetector", sizeString(noise) + " noise", iterations, [&](){
+        sink += detector(frame).size();
+    });
+    return faces;
+}
+
+static vector<dlib::full_object_detection> benchShapePredictor(
+        const string &stage,
+        const shared_ptr<const FaceShapePredictor> &sp,
+        const cv::Mat &rgb,
+        const vector<dlib::rectangle> &faces,
+        int iterations)
+{
+    vector<dlib::full_object_detection> shapes;
+    if (!sp) {
+        skip(stage, "model not found");
+        return shapes;
+    }
+    if (faces.empty()) {
+        skip(stage, "no face detected");
+        return shapes;
+    }
+    dlib::cv_image<dlib::rgb_pixel> frame(rgb);
+    measure(stage, to_string(faces.size()) + " faces", iterations,
+            faces.size(), [](){}, [&](){
+        shapes.clear();
+        for (auto &face : faces)
+            shapes.push_back((*sp)(frame, face));
+        sink += shapes.size();
+    });
+    return shapes;
+}
+
+/*
+ * The 68 points model [dat] parsed by dlib against its blobs
+ * (shape_predictor_blob.h): the load time from memory and from the
+ * memory mapped file, the landmarks time and their distance to dlib's
+ * on [faces] (the center of the image without faces), relative to the
+ * face width. SHAPE_LEAVES_FP32 must give dlib's landmarks, else the run
+ * fails
+ */
+static void benchShapePredictorBlob(const string &dat, const cv::Mat &rgb,
+                                    vector<dlib::rectangle> faces, int iterations)
+{
+    if (dat.empty()) {
+        skip("loadShapePredictor", "model not found");
+        return;
+    }
+    if (faces.empty()) {
+        long side = min(rgb.cols, rgb.rows) / 2;
+        faces.push_back(dlib::centered_rect(dlib::point(rgb.cols / 2, rgb.rows / 2),
+                                            side, side));
+    }
+    dlib::cv_image<dlib::rgb_pixel> frame(rgb);
+    // a few runs: the .dat model takes a fraction of a second
+    const int loads = min(iterations, 5);
+
+    dlib::shape_predictor reference;
+    measure("loadShapePredictor", "dat dlib", loads, [&](){
+        reference = dlib::shape_predictor();
+        vector<int8_t> buf(dat.begin(), dat.end());
+        dlib::deserialize(buf) >> reference;
+    });
+    shared_ptr<const FaceShapePredictor> loaded;
+    measure("loadShapePredictor", "dat", loads, [&](){
+        loaded = loadShapePredictor(dat.data(), dat.size());
+    });
+    vector<dlib::full_object_detection> expected;
+    measure("shapePredictor68", "dlib", iterations, faces.size(), [](){}, [&](){
+        expected.clear();
+        for (auto &face : faces)
+            expected.push_back(reference(frame, face));
+        sink += expected.size();
+    });
+    if (!loaded) {
+        fail("loadShapePredictor", "the .dat model can't be packed");
+        return;
+    }
+
+    // the trees of a cascade: pruned to half in the last variant
+    vector<char> blob;
+    ShapeBlobOptions options;
+    options.leafEncoding = SHAPE_LEAVES_FP32;
+    packShapePredictor(dat.data(), dat.size(), options, blob);
+    ShapeBlobHeader header;
+    memcpy(&header, blob.data(), sizeof(header));
+    const int32_t trees = header.cascadeCount ? header.treeCount / header.cascadeCount : 0;
+
+    struct Variant {
+        string name;
+        int32_t leafEncoding;
+        int32_t maxTrees;
+    };
+    const vector<Variant> variants = {
+        {"fp32", SHAPE_LEAVES_FP32, 0},
+        {"fp16", SHAPE_LEAVES_FP16, 0},
+        {"int8", SHAPE_LEAVES_INT8, 0},
+        {"fp16 " + to_string(trees / 2) + " trees", SHAPE_LEAVES_FP16, max(1, trees / 2)},
+    };
+    const string path = "face_benchmark.spb";
+    for (const Variant &v : variants) {
+        options.leafEncoding = v.leafEncoding;
+        options.maxTrees = v.maxTrees;
+        if (!packShapePredictor(dat.data(), dat.size(), options, blob)) {
+            fail("loadShapePredictor blob " + v.name, "the .dat model can't be packed");
+            continue;
+        }
+        {
+            ofstream out(path, ios::binary | ios::trunc);
+            out.write(blob.data(), blob.size());
+        }
+        shared_ptr<const FaceShapePredictor> sp;
+        measure("loadShapePredictor", "blob " + v.name, loads, [&](){
+            sp = loadShapePredictor(blob.data(), blob.size());
+        });
+        measure("loadShapePredictor", "blob " + v.name + " file", loads, [&](){
+            sp = loadShapePredictorFile(path);
+        });
+        if (!sp) {
+            fail("loadShapePredictor blob " + v.name, "blob can't be read");
+            remove(path.c_str());
+            continue;
+        }
+
+        vector<dlib::full_object_detection> shapes;
+        measure("shapePredictor68", "blob " + v.name, iterations, faces.size(),
+                [](){}, [&](){
+            shapes.clear();
+            for (auto &face : faces)
+                shapes.push_back((*sp)(frame, face));
+            sink += shapes.size();
+        });
+        double sum = 0, largest = 0;
+        long points = 0;
+        for (size_t i = 0; i < shapes.size(); ++i)
+            for (unsigned long k = 0; k < shapes[i].num_parts(); ++k) {
+                double d = dlib::length(shapes[i].part(k) - expected[i].part(k))
+                           / faces[i].width();
+                sum += d;
+                largest = max(largest, d);
+                ++points;
+            }
+        cout << "shapePredictor68 blob " << v.name << ": " << blob.size() << " bytes ("
+             << dat.size() << " .dat), landmark error mean " << sum / max(1L, points)
+             << " max " << largest << " of the face width" << endl;
+        if (v.leafEncoding == SHAPE_LEAVES_FP32 && v.maxTrees == 0 && largest > 0)
+            fail("shapePredictor68 blob " + v.name, "landmarks differ from dlib's");
+        sp.reset();
+        remove(path.c_str());
+    }
+}
+
+static vector<dlib::matrix<dlib::rgb_pixel>> benchChips(
+        const cv::Mat &rgb,
+        const vector<dlib::rectangle> &faces,
+        const vector<dlib::full_object_detection> &shapes,
+        int iterations)
+{
+    vector<dlib::matrix<dlib::rgb_pixel>> chips;
+    dlib::cv_image<dlib::rgb_pixel> frame(rgb);
+
+    // without the 5 points model the chips are taken from the rectangles
+    vector<dlib::chip_details> details;
+    if (!shapes.empty()) {
+        for (auto &shape : shapes)
+            details.push_back(dlib::get_face_chip_details(shape, 150, 0.25));
+    } else {
+        for (auto &face : faces)
+            details.push_back(dlib::chip_details(face, dlib::chip_dims(150, 150)));
+    }
+    if (details.empty()) {
+        skip("extract_image_chip", "no face detected");
+        return chips;
+    }
+
+    measure("extract_image_chip",
+            to_string(details.size()) + " chips 150x150" +
+                (shapes.empty() ? " from rectangles" : ""),
+            iterations, details.size(), [](){}, [&](){
+        chips.clear();
+        for (auto &d : details) {
+            dlib::matrix<dlib::rgb_pixel> chip;
+            dlib::extract_image_chip(frame, d, chip);
+            chips.push_back(move(chip));
+        }
+        sink += chips.size();
+    });
+    return chips;
+}
+
+/*
+ * Recognition network with its affine layers folded into the convolutions
+ * ([model], as loaded by the plugin) and as trained ([unfolded]). The
+ * descriptors of both must be the same within float rounding
+ */
+static void benchDescriptors(
+        const shared_ptr<const facenet::anet_type> &model,
+        const shared_ptr<const facenet::anet_type> &unfolded,
+        vector<dlib::matrix<dlib::rgb_pixel>> chips,
+        int iterations)
+{
+    if (!model) {
+        skip("faceDescriptor", "model not found");
+        return;
+    }
+    // without a detected face a noise chip still runs the same network
+    if (chips.empty()) {
+        dlib::rand rnd(1);
+        chips.push_back(noiseChip(rnd));
+    }
+
+    facenet::anet_type net = *model;
+    facenet::anet_type affineNet = *unfolded;
+    shared_ptr<const FaceNetEngine> engine = faceNetEngine(model);
+    dlib::matrix<float,0,1> descriptor(FaceNetEngine::DESCRIPTOR_SIZE);
+    for (size_t batch : {1, 2, 4, 8, 16}) {
+        vector<dlib::matrix<dlib::rgb_pixel>> input;
+        for (size_t i = 0; i < batch; ++i)
+            input.push_back(chips[i % chips.size()]);
+        measure("faceDescriptor", "batch " + to_string(batch),
+                iterations, batch, [](){}, [&](){
+            sink += net(input, batch).size();
+        });
+        measure("faceDescriptor", "batch " + to_string(batch) + " affine",
+                iterations, batch, [](){}, [&](){
+            sink += affineNet(input, batch).size();
+        });
+        if (!engine) continue;
+        vector<const uint8_t *> pixels;
+        for (auto &chip : input)
+            pixels.push_back(reinterpret_cast<const uint8_t *>(&chip(0, 0)));
+        vector<float> descriptors(batch * FaceNetEngine::DESCRIPTOR_SIZE);
+        measure("faceDescriptor", "batch " + to_string(batch) + " engine " +
+                FaceNetEngine::kernelName(), iterations, batch, [](){}, [&](){
+            engine->runBatch(pixels.data(), batch, descriptors.data());
+            sink += descriptors[0] > 0;
+        });
+    }
+
+    // tolerance of the folding: far under the 0.6 matching threshold
+    float maxDistance = 0;
+    for (auto &chip : chips)
+        maxDistance = max(maxDistance, dlib::length(net(chip) - affineNet(chip)));
+    cout << "faceDescriptor folded vs affine distance " << maxDistance << endl;
+    if (maxDistance > 1e-3f)
+        fail("faceDescriptor folded", "descriptors differ from the affine network by " +
+             to_string(maxDistance));
+
+    // the engine against dlib on the same chips
+    if (!engine) {
+        fail("faceDescriptor engine", "no engine for the network");
+        return;
+    }
+    maxDistance = 0;
+    for (auto &chip : chips) {
+        engine->run(reinterpret_cast<const uint8_t *>(&chip(0, 0)), &descriptor(0));
+        maxDistance = max(maxDistance, dlib::length(descriptor - affineNet(chip)));
+    }
+    cout << "faceDescriptor engine vs dlib distance " << maxDistance << endl;
+    if (maxDistance > 1e-3f)
+        fail("faceDescriptor engine", "descriptors differ from dlib by " +
+             to_string(maxDistance));
+
+    // a batch computes the same descriptors as the chips one by one
+    vector<const uint8_t *> pixels;
+    for (auto &chip : chips)
+        pixels.push_back(reinterpret_cast<const uint8_t *>(&chip(0, 0)));
+    vector<float> descriptors(pixels.size() * FaceNetEngine::DESCRIPTOR_SIZE);
+    engine->runBatch(pixels.data(), pixels.size(), descriptors.data());
+    maxDistance = 0;
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        engine->run(pixels[i], &descriptor(0));
+        maxDistance = max(maxDistance, dlib::length(descriptor - dlib::mat(
+                &descriptors[i * FaceNetEngine::DESCRIPTOR_SIZE],
+                FaceNetEngine::DESCRIPTOR_SIZE, 1)));
+    }
+    cout << "faceDescriptor engine batch vs single distance " << maxDistance << endl;
+    if (maxDistance > 1e-5f)
+        fail("faceDescriptor engine batch", "descriptors differ from single chips by " +
+             to_string(maxDistance));
+}
+
+/*
+ * Latency of one face with the layers of the engine split on 1 to all the
+ * threads (FaceNetEngine::setThreads())
+ */
+static void benchIntraOp(const shared_ptr<const facenet::anet_type> &model,
+                         const vector<dlib::matrix<dlib::rgb_pixel>> &chips,
+                         int iterations)
+{
+    shared_ptr<const FaceNetEngine> engine = faceNetEngine(model);
+    if (!engine) {
+        skip("faceDescriptor threads", "model not found");
+        return;
+    }
+    dlib::rand rnd(4);
+    dlib::matrix<dlib::rgb_pixel> chip = chips.empty() ? noiseChip(rnd) : chips[0];
+    const uint8_t *pixels = reinterpret_cast<const uint8_t *>(&chip(0, 0));
+    float descriptor[FaceNetEngine::DESCRIPTOR_SIZE];
+
+    int32_t all = TaskScheduler::instance().getWorkers() + 1;
+    for (int32_t threads = 1; ; threads = min(threads * 2, all)) {
+        FaceNetEngine::setThreads(threads);
+        measure("faceDescriptor", string("engine ") + FaceNetEngine::kernelName() +
+                " threads " + to_string(threads), iterations, [&](){
+            engine->run(pixels, descriptor);
+            sink += descriptor[0] > 0;
+        });
+        if (threads == all) break;
+    }
+    FaceNetEngine::setThreads(0);
+}
+
+/*
+ * ENGINE_PRECISION_INT8 calibrated on half of the chips and their
+ * jittered copies, its drift and its match decisions at the 0.6
+ * threshold checked on the other half: the run fails if a decision
+ * changes on the faces of the image
+ */
+static void benchQuantization(const shared_ptr<const facenet::anet_type> &model,
+                              const vector<dlib::matrix<dlib::rgb_pixel>> &chips,
+                              int iterations)
+{
+    shared_ptr<const FaceNetEngine> reference = faceNetEngine(model);
+    if (!reference) {
+        skip("faceDescriptor int8", "model not found");
+        return;
+    }
+
+    dlib::rand rnd(5);
+    vector<dlib::matrix<dlib::rgb_pixel>> local;
+    for (auto &chip : chips) {
+        local.push_back(chip);
+        for (int i = 0; i < 3; ++i)
+            local.push_back(dlib::jitter_image(chip, rnd));
+    }
+    // without detected faces: noise, only a smoke test of the drift
+    while (local.size() < 8)
+        local.push_back(noiseChip(rnd));
+    vector<const uint8_t *> calibration, heldOut;
+    for (size_t i = 0; i < local.size(); ++i)
+        (i % 2 == 0 ? calibration : heldOut).push_back(
+                reinterpret_cast<const uint8_t *>(&local[i](0, 0)));
+
+    shared_ptr<const FaceNetEngine> quantized = quantizedFaceNetEngine(model, calibration);
+    if (!quantized) {
+        fail("faceDescriptor int8", "calibration failed");
+        return;
+    }
+    QuantizationReport report = checkQuantization(*reference, *quantized, heldOut, 0.6f);
+    cout << "faceDescriptor int8 drift max " << report.maxDrift << " mean "
+         << report.meanDrift << ", " << report.flips << " decisions changed on "
+         << report.pairs << " held-out pairs" << endl;
+
+    float descriptor[FaceNetEngine::DESCRIPTOR_SIZE];
+    measure("faceDescriptor", string("engine ") + FaceNetEngine::kernelName(ENGINE_PRECISION_INT8),
+            iterations, 1, [](){}, [&](){
+        quantized->run(calibration[0], descriptor);
+        sink += descriptor[0] > 0;
+    });
+    // the guarantee of setPrecision(): no decision changes on real faces
+    if (report.flips > 0 && chips.empty())
+        skip("faceDescriptor int8 decisions", "no face in the image, " +
+             to_string(report.flips) + " decisions changed on noise");
+    else if (report.flips > 0)
+        fail("faceDescriptor int8", to_string(report.flips) +
+             " match decisions changed on held-out chips");
+}
+
+/*
+ * Startup cost of the recognition network: the .dat model parsed by dlib
+ * against its blob (face_net_blob.h), both from memory and from their
+ * file (the page cache is warm after the first run). The blob must give
+ * the same descriptor, else the run fails
+ */
+static void benchModelLoading(const string &modelsDir, const string &fr, int iterations)
+{
+    shared_ptr<const facenet::anet_type> net = loadFaceNet(fr.data(), fr.size());
+    if (!net) {
+        skip("loadFaceNet", "model not found");
+        return;
+    }
+    stringstream ss;
+    if (!writeFaceNetBlob(*net, ss)) {
+        fail("loadFaceNet", "blob can't be written");
+        return;
+    }
+    string blob = ss.str();
+    string blobPath = "face_benchmark.fnb";
+    {
+        ofstream out(blobPath, ios::binary | ios::trunc);
+        out.write(blob.data(), blob.size());
+    }
+    cout << "loadFaceNet .dat " << fr.size() << " bytes, blob "
+         << blob.size() << " bytes" << endl;
+
+    // a few runs: the .dat model takes a fraction of a second
+    iterations = min(iterations, 5);
+    shared_ptr<const facenet::anet_type> loaded;
+    measure("loadFaceNet", "dat", iterations, [&](){
+        loaded = loadFaceNet(fr.data(), fr.size());
+    });
+    measure("loadFaceNet", "dat file", iterations, [&](){
+        loaded = loadFaceNetFile(modelsDir + "/dlib_face_recognition_resnet_model_v1.dat");
+    });
+    measure("loadFaceNet", "blob", iterations, [&](){
+        loaded = loadFaceNet(blob.data(), blob.size());
+    });
+    measure("loadFaceNet", "blob file", iterations, [&](){
+        loaded = loadFaceNetFile(blobPath);
+    });
+    remove(blobPath.c_str());
+
+    if (!loaded) {
+        fail("loadFaceNet blob", "blob can't be read");
+        return;
+    }
+    dlib::rand rnd(6);
+    dlib::matrix<dlib::rgb_pixel> chip = noiseChip(rnd);
+    facenet::anet_type a = *net;
+    facenet::anet_type b = *loaded;
+    float distance = dlib::length(a(chip) - b(chip));
+    if (distance != 0)
+        fail("loadFaceNet blob", "descriptor distance " + to_string(distance) +
+             " from the .dat model");
+}
+
+static void benchMatching(int iterations)
+{
+    dlib::rand rnd(7);
+    vector<ReconFace> faces(4);
+    for (auto &f : faces)
+        f.face_descriptor = randomDescriptor(rnd);
+
+    for (int size : {10, 100, 1000, 10000}) {
+        FaceGallery gallery;
+        dlib::matrix<dlib::rgb_pixel> chip;
+        for (int i = 0; i < size; ++i)
+            gallery.add("face" + to_string(i), randomDescriptor(rnd), chip);
+        FaceGallery::Snapshot snapshot = gallery.snapshot();
+
+        measure("matchFaces",
+                to_string(faces.size()) + " faces vs " + to_string(size),
+                iterations, faces.size(), [](){}, [&](){
+            sink += FaceRecognition::matchFaces(snapshot->faces, faces).size();
+        });
+    }
+}
+
+/*
+ * PresenceMonitor: cost of the idle frames and wake up latency, from the
+ * first frame with a face to the first full result. The camera latency
+ * adds the frames skipped before the scan at 30 fps.
+ */
+static void benchPresence(const cv::Mat &rgb, const FaceModels &models,
+                          int iterations)
+{
+    FacePipeline pipeline(make_shared<FaceModels>(models));
+    pipeline.configure(OPT_DETECTOR_COLOR_SPACE, SRC_RGB);
+    pipeline.configure(OPT_PRESENCE_ENABLED, 1);
+    PresenceMonitor &presence = pipeline.presence;
+    cv::Mat empty(rgb.rows, rgb.cols, CV_8UC3, cv::Scalar(90, 90, 90));
+
+    // one frame as getFacePosePoints() runs it, return the faces found
+    auto frame = [&](const cv::Mat &img) {
+        if (!presence.admit(img, pipeline.detector)) return -1;
+        cv::Mat work = img.clone();
+        int32_t faces = 0;
+        pipeline.detector.getFacePosePoints(work, &faces);
+        presence.report(faces);
+        return faces;
+    };
+
+    const double frameMs = 1000.0 / 30;
+    for (int stride : {1, 3, 6}) {
+        pipeline.configure(OPT_PRESENCE_IDLE_STRIDE, stride);
+        presence.sleep();
+        measure("presenceIdle", "stride " + to_string(stride) + " " +
+                    sizeString(empty),
+                iterations, stride, [](){}, [&](){
+            for (int i = 0; i < stride; ++i) sink += frame(empty);
+        });
+
+        vector<double> processing, camera;
+        dlib::rand rnd(stride);
+        for (int i = 0; i < iterations; ++i) {
+            presence.sleep();
+            // the face shows up anywhere in the stride
+            for (int k = rnd.get_random_32bit_number() % stride; k > 0; --k)
+                frame(empty);
+            int frames = 0;
+            auto t0 = chrono::steady_clock::now();
+            while (frames < 100 && frame(rgb) <= 0) frames++;
+            auto t1 = chrono::steady_clock::now();
+            if (frames == 100) {
+                skip("presenceWake", "no face found in the image");
+                return;
+            }
+            double ms = chrono::duration<double, milli>(t1 - t0).count();
+            processing.push_back(ms);
+            camera.push_back(ms + frames * frameMs);
+        }
+        store("presenceWake", "stride " + to_string(stride), 1, processing);
+        store("presenceWake", "stride " + to_string(stride) + " camera 30fps",
+              1, camera);
+    }
+}
+
+/*
+ * Coarse-to-fine detection: prefilter candidates verified by HOG against
+ * HOG on the whole frame. The frames are the image at different scales,
+ * mirrored or not; the faces of the single-stage detector are the
+ * reference of the recall (IoU >= 0.5).
+ */
+static void benchPrefilter(const cv::Mat &rgb, const string &cascade,
+                           int iterations)
+{
+    dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+    auto hog = [&](cv::Mat &img) {
+        return detector(dlib::cv_image<dlib::rgb_pixel>(img));
+    };
+
+    vector<cv::Mat> frames;
+    for (double scale : {1.0, 0.75, 0.5}) {
+        cv::Mat img, flipped;
+        cv::resize(rgb, img, cv::Size(0, 0), scale, scale, cv::INTER_AREA);
+        cv::flip(img, flipped, 1);
+        frames.push_back(img);
+        frames.push_back(flipped);
+    }
+    vector<vector<dlib::rectangle>> reference;
+    size_t referenceFaces = 0;
+    for (auto &f : frames) {
+        reference.push_back(hog(f));
+        referenceFaces += reference.back().size();
+    }
+    string variant = to_string(frames.size()) + " frames " + sizeString(rgb) +
+                     " to " + sizeString(frames.back());
+    measure("prefilter", "none " + variant, iterations, frames.size(),
+            [](){}, [&](){
+        for (auto &f : frames) sink += hog(f).size();
+    });
+
+    vector<int32_t> modes;
+    FacePrefilter prefilter;
+    if (cascade.empty())
+        skip("prefilter cascade", "no --cascade file");
+    else if (!prefilter.loadCascade(cascade.data(), cascade.size()))
+        skip("prefilter cascade", "cannot parse the --cascade file");
+    else
+        modes.push_back(PREFILTER_CASCADE);
+    modes.push_back(PREFILTER_SKIN);
+
+    for (int32_t mode : modes) {
+        prefilter.setMode(mode);
+        string name = mode == PREFILTER_CASCADE ? "cascade" : "skin";
+        vector<vector<dlib::rectangle>> found(frames.size());
+        measure("prefilter", name + " " + variant, iterations, frames.size(),
+                [](){}, [&](){
+            for (size_t i = 0; i < frames.size(); ++i) {
+                found[i] = detectInRegions(frames[i],
+                                           prefilter.candidates(frames[i]),
+                                           vector<dlib::rectangle>(), hog);
+                sink += found[i].size();
+            }
+        });
+
+        size_t matched = 0;
+        for (size_t i = 0; i < frames.size(); ++i) {
+            for (auto &r : reference[i]) {
+                for (auto &f : found[i]) {
+                    double inter = r.intersect(f).area();
+                    if (inter / (r.area() + f.area() - inter) < 0.5) continue;
+                    matched++;
+                    break;
+                }
+            }
+        }
+        results.back().recall = referenceFaces == 0 ? 1.0
+                : (double)matched / referenceFaces;
+        cout << "prefilter [" << name << "] recall "
+             << results.back().recall << endl;
+    }
+    prefilter.setMode(PREFILTER_SKIN);
+    measure("prefilterCandidates", "skin " + sizeString(rgb), iterations,
+            [&](){ sink += prefilter.candidates(rgb).rects.size(); });
+    if (modes.front() == PREFILTER_CASCADE) {
+        prefilter.setMode(PREFILTER_CASCADE);
+        measure("prefilterCandidates", "cascade " + sizeString(rgb), iterations,
+                [&](){ sink += prefilter.candidates(rgb).rects.size(); });
+    }
+}
+
+/*
+ * The backends of face_backend.h on the same frames: detection at
+ * different sizes, alignment and descriptor of the faces found by each
+ * detector. The distance between the descriptors of the image and of
+ * its mirror (the same person) must stay under 0.6 for every backend.
+ */
+static void benchBackends(cv::Mat &rgb, const FaceModels &models,
+                          const string &yunet, const string &sface,
+                          int iterations)
+{
+    vector<BackendConfig> detectors(1), recognizers(1);
+    if (yunet.empty()) {
+        skip("backend yunet", "no --yunet model");
+    } else {
+        detectors.push_back(BackendConfig());
+        detectors.back().detector = DETECTOR_BACKEND_YUNET;
+        detectors.back().detectorModel = yunet;
+    }
+    if (sface.empty()) {
+        skip("backend sface", "no --sface model");
+    } else {
+        recognizers.push_back(BackendConfig());
+        recognizers.back().recognizer = RECOGNIZER_BACKEND_SFACE;
+        recognizers.back().recognizerModel = sface;
+    }
+
+    cv::Mat mirror;
+    cv::flip(rgb, mirror, 1);
+    for (auto &d : detectors) {
+        string name = d.detector == DETECTOR_BACKEND_YUNET ? "yunet" : "hog";
+        unique_ptr<DetectorBackend> detector = createDetectorBackend(d);
+        if (!detector) {
+            skip("backendDetect " + name, "cannot load the model");
+            continue;
+        }
+        for (double scale : {1.0, 0.5}) {
+            cv::Mat img;
+            cv::resize(rgb, img, cv::Size(0, 0), scale, scale, cv::INTER_AREA);
+            measure("backendDetect", name + " " + sizeString(img), iterations, [&](){
+                sink += detector->detect(img).size();
+            });
+        }
+        vector<dlib::full_object_detection> faces = detector->detect(rgb);
+        vector<dlib::full_object_detection> mirrorFaces = detector->detect(mirror);
+        if (faces.empty() || mirrorFaces.empty()) {
+            skip("backendDescriptor " + name, "no face found in the image");
+            continue;
+        }
+
+        for (auto &r : recognizers) {
+            string variant = name + " + " +
+                    (r.recognizer == RECOGNIZER_BACKEND_SFACE ? "sface" : "resnet");
+            shared_ptr<RecognizerBackend> recognizer = createRecognizerBackend(
+                    r, models.recognizerShapePredictor, models.net);
+            if (!recognizer) {
+                skip("backendDescriptor " + variant, "cannot load the models");
+                continue;
+            }
+            dlib::full_object_detection shape;
+            dlib::matrix<dlib::rgb_pixel> chip, mirrorChip;
+            measure("backendAlign", variant, iterations, [&](){
+                sink += recognizer->align(rgb, faces[0],
+                                          shape, chip);
+            });
+            recognizer->align(mirror, mirrorFaces[0], shape, mirrorChip);
+            if (chip.size() == 0 || mirrorChip.size() == 0) {
+                skip("backendDescriptor " + variant, "the face can't be aligned");
+                continue;
+            }
+            dlib::matrix<float,0,1> descriptor;
+            measure("backendDescriptor", variant, iterations, [&](){
+                descriptor = recognizer->descriptor(chip);
+                sink += descriptor.size();
+            });
+            cout << "backendDescriptor [" << variant << "] mirror distance "
+                 << dlib::length(descriptor - recognizer->descriptor(mirrorChip))
+                 << endl;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    string modelsDir = ".";
+    string imagePath = BENCH_DEFAULT_IMAGE;
+    string outPath = "benchmark.json";
+    int iterations = 20;
+    int workers = 0;
+    int policy = SCHED_POLICY_NONE;
+    string sysfsRoot;
+    string cascadePath;
+    string yunetPath;
+    string sfacePath;
+    bool requireModels = false;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--models" && i + 1 < argc) modelsDir = argv[++i];
+        else if (arg == "--image" && i + 1 < argc) imagePath = argv[++i];
+        else if (arg == "--out" && i + 1 < argc) outPath = argv[++i];
+        else if (arg == "--iterations" && i + 1 < argc)
+            iterations = max(1, atoi(argv[++i]));
+        else if (arg == "--workers" && i + 1 < argc) workers = atoi(argv[++i]);
+        else if (arg == "--policy" && i + 1 < argc) policy = atoi(argv[++i]);
+        else if (arg == "--sysfs" && i + 1 < argc) sysfsRoot = argv[++i];
+        else if (arg == "--cascade" && i + 1 < argc) cascadePath = argv[++i];
+        else if (arg == "--yunet" && i + 1 < argc) yunetPath = argv[++i];
+        else if (arg == "--sface" && i + 1 < argc) sfacePath = argv[++i];
+        else if (arg == "--require-models") requireModels = true;
+        else {
+            cerr << "usage: " << argv[0]
+                 << " [--models DIR] [--image FILE] [--iterations N] [--out FILE]"
+                 << " [--workers N] [--policy P] [--sysfs DIR] [--cascade FILE]"
+                 << " [--yunet FILE] [--sface FILE] [--require-models]"
+                 << endl;
+            return 1;
+        }
+    }
+
+    TaskScheduler::instance().setTopologyRoot(sysfsRoot);
+    TaskScheduler::instance().configure(workers, policy);
+
+    cv::Mat bgr = cv::imread(imagePath);
+    if (bgr.empty()) {
+        cerr << "cannot read " << imagePath << endl;
+        return 1;
+    }
+    cv::Mat rgb;
+    cv::cvtColor(bgr, rgb, cv::COLOR_BGR2RGB);
+
+    string sp68 = readFile(modelsDir + "/shape_predictor_68_face_landmarks.dat");
+    string sp5 = readFile(modelsDir + "/shape_predictor_5_face_landmarks-B.dat");
+    string fr = readFile(modelsDir + "/dlib_face_recognition_resnet_model_v1.dat");
+    if (requireModels && (sp68.empty() || sp5.empty() || fr.empty())) {
+        cout << "benchmark skipped: models not found in " << modelsDir << endl;
+        return EXIT_SKIPPED;
+    }
+    FaceModels models;
+    models.detectorShapePredictor = loadShapePredictor(sp68.data(), sp68.size());
+    models.recognizerShapePredictor = loadShapePredictor(sp5.data(), sp5.size());
+    models.net = loadFaceNet(fr.data(), fr.size());
+
+    benchConversions(rgb, iterations);
+    vector<dlib::rectangle> faces = benchDetection(rgb, iterations);
+    benchShapePredictor("shapePredictor68", models.detectorShapePredictor,
+                        rgb, faces, iterations);
+    benchShapePredictorBlob(sp68, rgb, faces, iterations);
+    vector<dlib::full_object_detection> shapes5 =
+            benchShapePredictor("shapePredictor5", models.recognizerShapePredictor,
+                                rgb, faces, iterations);
+    vector<dlib::matrix<dlib::rgb_pixel>> chips =
+            benchChips(rgb, faces, shapes5, iterations);
+    benchDescriptors(models.net, loadFaceNet(fr.data(), fr.size(), false),
+                     chips, iterations);
+    benchQuantization(models.net, chips, iterations);
+    benchIntraOp(models.net, chips, iterations);
+    benchModelLoading(modelsDir, fr, iterations);
+    benchMatching(iterations);
+    benchPresence(rgb, models, iterations);
+    benchPrefilter(rgb, cascadePath.empty() ? string() : readFile(cascadePath),
+                   iterations);
+    benchBackends(rgb, models, yunetPath, sfacePath, iterations);
+
+    ofstream out(outPath);
+    if (!out) {
+        cerr << "cannot write " << outPath << endl;
+        return 1;
+    }
+    writeJson(out, imagePath, iterations);
+    cout << "results written to " << outPath << endl;
+    if (!failed.empty()) {
+        cerr << failed.size() << " correctness checks failed" << endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Converts the models to their fast loading formats.
+ *
+ * --net writes the recognition network (.dat), its affine layers folded
+ * into the convolutions, as a blob of face_net_blob.h. The blob is read
+ * back and must give the descriptor of the .dat network on a test chip.
+ *
+ * --shape writes a shape predictor (.dat) as a blob of
+ * shape_predictor_blob.h, its leaves in --leaves fp32, fp16 (default) or
+ * int8, only the first --trees trees of every cascade if given. The
+ * distance of its landmarks to the .dat model ones on a test image is
+ * printed (see benchShapePredictorBlob() in the benchmark for real faces).
+ *
+ * usage: face_model_convert --net IN.dat OUT.fnb
+ *        face_model_convert --shape IN.dat OUT.spb [--leaves E] [--trees N]
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "face_models.h"
+#include "face_net_blob.h"
+#include "shape_predictor_blob.h"
+
+using namespace std;
+
+static string readFile(const string &path)
+{
+    ifstream in(path, ios::binary);
+    if (!in) return string();
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+static int usage()
+{
+    cerr << "usage: face_model_convert --net IN.dat OUT.fnb" << endl
+         << "       face_model_convert --shape IN.dat OUT.spb"
+         << " [--leaves fp32|fp16|int8] [--trees N]" << endl;
+    return 2;
+}
+
+static int convertNet(const string &inPath, const string &outPath)
+{
+    string dat = readFile(inPath);
+    std::shared_ptr<const facenet::anet_type> net = loadFaceNet(dat.data(), dat.size());
+    if (!net) {
+        cerr << "can't read " << inPath << endl;
+        return 1;
+    }
+    {
+        ofstream out(outPath, ios::binary | ios::trunc);
+        if (!out || !writeFaceNetBlob(*net, out)) {
+            cerr << "can't write " << outPath << endl;
+            return 1;
+        }
+    }
+
+    std::shared_ptr<const facenet::anet_type> blob = loadFaceNetFile(outPath, false);
+    if (!blob) {
+        cerr << "can't read back " << outPath << endl;
+        return 1;
+    }
+
+    // the weights are copied as they are: the descriptors are identical
+    mt19937 rnd(7);
+    dlib::matrix<dlib::rgb_pixel> chip(150, 150);
+    for (long r = 0; r < chip.nr(); ++r)
+        for (long c = 0; c < chip.nc(); ++c)
+            chip(r, c) = dlib::rgb_pixel(rnd() & 0xff, rnd() & 0xff, rnd() & 0xff);
+    facenet::anet_type a = *net;
+    facenet::anet_type b = *blob;
+    float distance = dlib::length(a(chip) - b(chip));
+    if (distance != 0) {
+        cerr << outPath << " differs from " << inPath
+             << ": descriptor distance " << distance << endl;
+        return 1;
+    }
+    cout << "wrote " << outPath << endl;
+    return 0;
+}
+
+static int convertShape(const string &inPath, const string &outPath,
+                        const ShapeBlobOptions &options)
+{
+    string dat = readFile(inPath);
+    dlib::shape_predictor reference;
+    try {
+        vector<int8_t> buf(dat.begin(), dat.end());
+        dlib::deserialize(buf) >> reference;
+    } catch (dlib::serialization_error &e) {
+        cerr << "can't read " << inPath << ": " << e.what() << endl;
+        return 1;
+    }
+    {
+        ofstream out(outPath, ios::binary | ios::trunc);
+        if (!out || !writeShapePredictorBlob(dat.data(), dat.size(), options, out)) {
+            cerr << "can't write " << outPath << endl;
+            return 1;
+        }
+    }
+
+    std::shared_ptr<const FaceShapePredictor> blob = loadShapePredictorFile(outPath);
+    if (!blob) {
+        cerr << "can't read back " << outPath << endl;
+        return 1;
+    }
+
+    // a smooth test image: the landmarks of noise would be meaningless
+    dlib::array2d<unsigned char> image(300, 300);
+    for (long r = 0; r < image.nr(); ++r)
+        for (long c = 0; c < image.nc(); ++c)
+            image[r][c] = 128 + 100 * std::sin(r * 0.05) * std::cos(c * 0.07);
+    dlib::rectangle face(75, 75, 224, 224);
+    dlib::full_object_detection a = reference(image, face);
+    dlib::full_object_detection b = (*blob)(image, face);
+    double largest = 0;
+    for (unsigned long k = 0; k < a.num_parts(); ++k)
+        largest = std::max(largest, dlib::length(a.part(k) - b.part(k)) / face.width());
+    cout << "wrote " << outPath << ": " << blob->size() << " bytes (" << dat.size()
+         << " .dat), largest landmark distance " << largest
+         << " of the face width on the test image" << endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && string(argv[1]) == "--net")
+        return convertNet(argv[2], argv[3]);
+    if (argc >= 4 && string(argv[1]) == "--shape") {
+        ShapeBlobOptions options;
+        for (int i = 4; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "--leaves" && i + 1 < argc) {
+                string leaves = argv[++i];
+                if (leaves == "fp32") options.leafEncoding = SHAPE_LEAVES_FP32;
+                else if (leaves == "fp16") options.leafEncoding = SHAPE_LEAVES_FP16;
+                else if (leaves == "int8") options.leafEncoding = SHAPE_LEAVES_INT8;
+                else return usage();
+            } else if (arg == "--trees" && i + 1 < argc) {
+                options.maxTrees = max(0, atoi(argv[++i]));
+            } else {
+                return usage();
+            }
+        }
+        return convertShape(argv[2], argv[3], options);
+    }
+    return usage();
+}
@@ -0,0 +1,260 @@
+/*
+ * Replay of the frames recorded with startFrameRecording().
+ *
+ * The frames go through a FacePipeline with the settings they were
+ * recorded with, as fast as possible or with the recorded timing
+ * (--realtime). Throughput and per-frame latency are printed as JSON.
+ *
+ * The faces found in every frame are written to --outputs, one line per
+ * frame. Passing the outputs of a previous run as --golden compares the
+ * two runs and fails if any frame differs more than --tolerance.
+ *
+ * usage: face_replay FILE [--models DIR] [--realtime] [--out FILE]
+ *                         [--outputs FILE] [--golden FILE] [--tolerance N]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_recorder.h"
+#include "face_models.h"
+#include "face_pipeline.h"
+
+using namespace std;
+
+struct FrameOutput {
+    int64_t index;
+    string source;
+    vector<double> values;  // for each face: the values written by runFrame()
+};
+
+static string readFile(const string &path)
+{
+    ifstream in(path, ios::binary);
+    if (!in) return string();
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+static void configure(FacePipeline &pipeline, const FrameHeader &h)
+{
+    if (h.source == FRAME_DETECTOR) {
+        pipeline.configure(OPT_DETECTOR_COLOR_SPACE, h.colorSpace);
+        pipeline.configure(OPT_DETECTOR_SCALE_FACTOR, h.scaleFactor);
+        pipeline.configure(OPT_DETECTOR_ROTATION, h.rotation);
+        pipeline.configure(OPT_DETECTOR_FLIP, h.flip);
+        // changing it resets the tracking
+        if (pipeline.detector.getGetOnlyRectangle() != (bool)h.onlyRectangle)
+            pipeline.configure(OPT_DETECTOR_ONLY_RECTANGLE, h.onlyRectangle);
+        if (pipeline.detector.getAntiShakeSamples() != h.antiShakeSamples)
+            pipeline.configure(OPT_DETECTOR_ANTISHAKE_SAMPLES, h.antiShakeSamples);
+    } else {
+        pipeline.configure(OPT_RECOGNIZER_COLOR_SPACE, h.colorSpace);
+        pipeline.configure(OPT_RECOGNIZER_SCALE_FACTOR, h.scaleFactor);
+        pipeline.configure(OPT_RECOGNIZER_ROTATION, h.rotation);
+        pipeline.configure(OPT_RECOGNIZER_FLIP, h.flip);
+    }
+}
+
+/*
+ * Run a frame as getFacePosePoints() or compareFaces() do.
+ * Detector values: track id and the smoothed points of each face.
+ * Recognizer values: track id, rectangle and quality of each face
+ */
+static FrameOutput runFrame(FacePipeline &pipeline, RecordedFrame &frame,
+                            int64_t index)
+{
+    FrameOutput out;
+    out.index = index;
+    cv::Mat img = frame.image.clone();
+
+    if (frame.header.source == FRAME_DETECTOR) {
+        out.source = "detector";
+        int32_t faceCount;
+        pipeline.detector.getFacePosePoints(img, &faceCount);
+        vector<int32_t> ids = pipeline.detector.getTrackIds(faceCount);
+        for (int i = 0; i < faceCount; ++i) {
+            out.values.push_back(i < (int)ids.size() ? ids[i] : -1);
+            for (int32_t p : pipeline.detector.shapes[i].antiShakeQueue.average())
+                out.values.push_back(p);
+        }
+    } else {
+        out.source = "recognizer";
+        vector<ReconFace> faces = pipeline.recognition.detectFaces(img);
+        FaceGallery::Snapshot gallery = pipeline.gallery.snapshot();
+        pipeline.recognition.compareFaces(gallery->faces, faces);
+        for (auto &f : faces) {
+            out.values.push_back(f.trackId);
+            out.values.push_back(f.faceRect.left());
+            out.values.push_back(f.faceRect.top());
+            out.values.push_back(f.faceRect.right());
+            out.values.push_back(f.faceRect.bottom());
+            out.values.push_back(round(f.quality * 10000) / 10000);
+        }
+    }
+    return out;
+}
+
+static void writeOutputs(const string &path, const vector<FrameOutput> &outputs)
+{
+    ofstream out(path);
+    for (auto &o : outputs) {
+        out << o.index << " " << o.source << " " << o.values.size();
+        for (double v : o.values) out << " " << v;
+        out << "\n";
+    }
+}
+
+static bool readOutputs(const string &path, vector<FrameOutput> &outputs)
+{
+    ifstream in(path);
+    if (!in) return false;
+    string line;
+    while (getline(in, line)) {
+        istringstream ss(line);
+        FrameOutput o;
+        size_t n;
+        if (!(ss >> o.index >> o.source >> n)) continue;
+        o.values.resize(n);
+        for (auto &v : o.values) ss >> v;
+        outputs.push_back(o);
+    }
+    return true;
+}
+
+/*
+ * Return the number of frames which differ from [golden]
+ */
+static int64_t diffOutputs(const vector<FrameOutput> &outputs,
+                           const vector<FrameOutput> &golden,
+                           double tolerance)
+{
+    int64_t differences = 0;
+    size_t n = max(outputs.size(), golden.size());
+    for (size_t i = 0; i < n; ++i) {
+        if (i >= outputs.size() || i >= golden.size()) {
+            ++differences;
+            continue;
+        }
+        const FrameOutput &a = outputs[i];
+        const FrameOutput &b = golden[i];
+        bool same = a.source == b.source && a.values.size() == b.values.size();
+        for (size_t j = 0; same && j < a.values.size(); ++j)
+            same = fabs(a.values[j] - b.values[j]) <= tolerance;
+        if (!same) {
+            if (differences < 10)
+                cerr << "frame " << a.index << " differs from the golden run" << endl;
+            ++differences;
+        }
+    }
+    return differences;
+}
+
+static double percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    return sorted[min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, char **argv)
+{
+    string recording;
+    string modelsDir = ".";
+    string outPath;
+    string outputsPath;
+    string goldenPath;
+    double tolerance = 0;
+    bool realtime = false;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--models" && i + 1 < argc) modelsDir = argv[++i];
+        else if (arg == "--out" && i + 1 < argc) outPath = argv[++i];
+        else if (arg == "--outputs" && i + 1 < argc) outputsPath = argv[++i];
+        else if (arg == "--golden" && i + 1 < argc) goldenPath = argv[++i];
+        else if (arg == "--tolerance" && i + 1 < argc) tolerance = atof(argv[++i]);
+        else if (arg == "--realtime") realtime = true;
+        else if (recording.empty() && arg[0] != '-') recording = arg;
+        else {
+            recording.clear();
+            break;
+        }
+    }
+    if (recording.empty()) {
+        cerr << "usage: " << argv[0] << " FILE [--models DIR] [--realtime]"
+             << " [--out FILE] [--outputs FILE] [--golden FILE] [--tolerance N]"
+             << endl;
+        return 1;
+    }
+
+    FrameReader reader;
+    if (!reader.open(recording)) {
+        cerr << "cannot read " << recording << endl;
+        return 1;
+    }
+
+    string sp68 = readFile(modelsDir + "/shape_predictor_68_face_landmarks.dat");
+    string sp5 = readFile(modelsDir + "/shape_predictor_5_face_landmarks-B.dat");
+    string fr = readFile(modelsDir + "/dlib_face_recognition_resnet_model_v1.dat");
+    std::shared_ptr<FaceModels> models = std::make_shared<FaceModels>();
+    models->detectorShapePredictor = loadShapePredictor(sp68.data(), sp68.size());
+    models->recognizerShapePredictor = loadShapePredictor(sp5.data(), sp5.size());
+    models->net = loadFaceNet(fr.data(), fr.size());
+    FacePipeline pipeline(models);
+
+    vector<FrameOutput> outputs;
+    vector<double> latencies;
+    RecordedFrame frame;
+    auto start = chrono::steady_clock::now();
+    while (reader.next(frame)) {
+        if (realtime)
+            this_thread::sleep_until(start + chrono::nanoseconds(frame.header.timestampNs));
+        configure(pipeline, frame.header);
+        auto t0 = chrono::steady_clock::now();
+        outputs.push_back(runFrame(pipeline, frame, outputs.size()));
+        auto t1 = chrono::steady_clock::now();
+        latencies.push_back(chrono::duration<double, milli>(t1 - t0).count());
+    }
+    double wallS = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    sort(latencies.begin(), latencies.end());
+
+    int64_t differences = -1;
+    if (!goldenPath.empty()) {
+        vector<FrameOutput> golden;
+        if (!readOutputs(goldenPath, golden)) {
+            cerr << "cannot read " << goldenPath << endl;
+            return 1;
+        }
+        differences = diffOutputs(outputs, golden, tolerance);
+    }
+    if (!outputsPath.empty())
+        writeOutputs(outputsPath, outputs);
+
+    ostringstream json;
+    json << fixed << setprecision(3);
+    json << "{\n";
+    json << "  \"frames\": " << outputs.size() << ",\n";
+    json << "  \"realtime\": " << (realtime ? "true" : "false") << ",\n";
+    json << "  \"wall_s\": " << wallS << ",\n";
+    json << "  \"fps\": " << (wallS > 0 ? outputs.size() / wallS : 0) << ",\n";
+    json << "  \"latency_ms\": {\"p50\": " << percentile(latencies, 0.5)
+         << ", \"p95\": " << percentile(latencies, 0.95)
+         << ", \"p99\": " << percentile(latencies, 0.99)
+         << ", \"max\": " << (latencies.empty() ? 0 : latencies.back()) << "},\n";
+    json << "  \"golden_differences\": " << differences << "\n";
+    json << "}\n";
+    cout << json.str();
+    if (!outPath.empty()) ofstream(outPath) << json.str();
+
+    return differences > 0 ? 2 : 0;
+}
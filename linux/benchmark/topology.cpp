@@ -0,0 +1,176 @@
+/*
+ * CPU topology read from fake /sys/devices/system/cpu trees and the
+ * workers TaskScheduler places on it under SCHED_POLICY_BIG_LITTLE:
+ *  - 4x512 + 4x1024: the 4 big cores are fast
+ *  - 1+3+4 (a prime, 3 mid and 4 little cores): the prime and the mid
+ *    cores are fast
+ *  - 8 identical cores: no split, big.LITTLE falls back to no placement
+ *  - a gap in the ids and an offline core without capacity: the cores
+ *    after them are still read
+ *
+ * usage: face_cpu_topology [DIR]
+ *
+ * The trees are written under DIR (default: the working directory).
+ * Exit code: 0 passed, 2 failed.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "cpu_topology.h"
+#include "task_scheduler.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what)
+{
+    if (ok) return;
+    cerr << "cpu topology FAILED: " << what << endl;
+    ++failures;
+}
+
+static bool makeDir(const string &path)
+{
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+static void writeFile(const string &path, const string &content)
+{
+    ofstream out(path, ios::trunc);
+    out << content << "\n";
+}
+
+/*
+ * Write a fake sysfs tree at [root]: cpu_capacity [capacities][i] for the
+ * cpu [ids][i], a negative capacity writes the directory only. [present]
+ * is the content of the present file, none if empty
+ */
+static string fakeSysfs(const string &root, const vector<int32_t> &ids,
+                        const vector<int64_t> &capacities, const string &present)
+{
+    makeDir(root);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        string dir = root + "/cpu" + to_string(ids[i]);
+        makeDir(dir);
+        if (capacities[i] >= 0)
+            writeFile(dir + "/cpu_capacity", to_string(capacities[i]));
+    }
+    if (!present.empty())
+        writeFile(root + "/present", present);
+    return root;
+}
+
+static string ids(const vector<int32_t> &v)
+{
+    string s;
+    for (int32_t id : v) s += (s.empty() ? "" : ",") + to_string(id);
+    return "{" + s + "}";
+}
+
+static void checkIds(const vector<int32_t> &v, const vector<int32_t> &expected,
+                     const string &what)
+{
+    check(v == expected, what + " " + ids(v) + ", expected " + ids(expected));
+}
+
+/*
+ * The workers placed on the topology of [root]: [fastWorkers] of [workers]
+ * take the latency tasks, a forkJoin() at PRIORITY_LATENCY runs on them
+ * and the caller only, runPlaced() on one of them
+ */
+static void checkScheduler(const string &name, const string &root, int32_t workers,
+                           int32_t policy, int32_t fastWorkers)
+{
+    TaskScheduler &scheduler = TaskScheduler::instance();
+    scheduler.setTopologyRoot(root);
+    scheduler.configure(workers, SCHED_POLICY_BIG_LITTLE);
+    check(scheduler.getPolicy() == policy,
+          name + " policy " + to_string(scheduler.getPolicy()));
+    check(scheduler.getFastWorkers() == fastWorkers,
+          name + " fast workers " + to_string(scheduler.getFastWorkers())
+          + ", expected " + to_string(fastWorkers));
+
+    mutex guard;
+    set<thread::id> threads;
+    scheduler.forkJoin(0, 256, [&](int64_t) {
+        {
+            lock_guard<mutex> lock(guard);
+            threads.insert(this_thread::get_id());
+        }
+        this_thread::sleep_for(chrono::microseconds(200));
+    }, 1, 0, PRIORITY_LATENCY);
+    check((int32_t)threads.size() <= fastWorkers + 1,
+          name + " latency forkJoin on " + to_string(threads.size()) + " threads");
+
+    // the detection runs on a fast worker, not in the calling thread
+    thread::id placed;
+    scheduler.runPlaced([&]() {placed = this_thread::get_id();}, PRIORITY_LATENCY);
+    check((placed != this_thread::get_id()) == (policy == SCHED_POLICY_BIG_LITTLE),
+          name + " runPlaced() in the wrong thread");
+}
+
+int main(int argc, char **argv)
+{
+    string dir = argc > 1 ? argv[1] : ".";
+    if (argc > 2 || !makeDir(dir)) {
+        cerr << "usage: " << argv[0] << " [DIR]" << endl;
+        return 1;
+    }
+
+    string bigLittle = fakeSysfs(dir + "/sysfs_4x512_4x1024",
+            {0, 1, 2, 3, 4, 5, 6, 7},
+            {512, 512, 512, 512, 1024, 1024, 1024, 1024}, "0-7");
+    CpuTopology t = readCpuTopology(bigLittle);
+    check(t.cpus.size() == 8, "4x512 + 4x1024 cpus " + to_string(t.cpus.size()));
+    checkIds(t.fast, {4, 5, 6, 7}, "4x512 + 4x1024 fast");
+    checkIds(t.slow, {0, 1, 2, 3}, "4x512 + 4x1024 slow");
+    check(t.heterogeneous(), "4x512 + 4x1024 not heterogeneous");
+
+    string prime = fakeSysfs(dir + "/sysfs_1_3_4",
+            {0, 1, 2, 3, 4, 5, 6, 7},
+            {325, 325, 325, 325, 870, 870, 870, 1024}, "0-7");
+    t = readCpuTopology(prime);
+    checkIds(t.fast, {4, 5, 6, 7}, "1+3+4 fast");
+    checkIds(t.slow, {0, 1, 2, 3}, "1+3+4 slow");
+    check(t.heterogeneous(), "1+3+4 not heterogeneous");
+
+    string same = fakeSysfs(dir + "/sysfs_8x1024",
+            {0, 1, 2, 3, 4, 5, 6, 7},
+            {1024, 1024, 1024, 1024, 1024, 1024, 1024, 1024}, "0-7");
+    t = readCpuTopology(same);
+    checkIds(t.fast, {0, 1, 2, 3, 4, 5, 6, 7}, "8x1024 fast");
+    checkIds(t.slow, {0, 1, 2, 3, 4, 5, 6, 7}, "8x1024 slow");
+    check(!t.heterogeneous(), "8x1024 heterogeneous");
+
+    // cpu2 offline without any capacity, no cpu3, no present file
+    string gaps = fakeSysfs(dir + "/sysfs_gaps",
+            {0, 1, 2, 4, 5}, {512, 512, -1, 1024, 1024}, "");
+    t = readCpuTopology(gaps);
+    check(t.cpus.size() == 4, "gaps cpus " + to_string(t.cpus.size()));
+    checkIds(t.fast, {4, 5}, "gaps fast");
+    checkIds(t.slow, {0, 1}, "gaps slow");
+
+    checkScheduler("4x512 + 4x1024", bigLittle, 8, SCHED_POLICY_BIG_LITTLE, 4);
+    checkScheduler("1+3+4", prime, 8, SCHED_POLICY_BIG_LITTLE, 4);
+    // a slow worker is always left for the background tasks
+    checkScheduler("1+3+4 on 4 workers", prime, 4, SCHED_POLICY_BIG_LITTLE, 3);
+    checkScheduler("8x1024", same, 8, SCHED_POLICY_NONE, 8);
+
+    TaskScheduler::instance().setTopologyRoot("");
+    TaskScheduler::instance().configure(0, SCHED_POLICY_NONE);
+    if (failures) return 2;
+    cout << "cpu topology passed" << endl;
+    return 0;
+}
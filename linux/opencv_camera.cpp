@@ -61,14 +61,19 @@
 #endif
 #include "gl/fl_my_texture_gl.h"
 #include "opencv_camera.h"
+#include "../ios/Classes/cpp/pipeline_trace.h"
 #include <GL/gl.h>
-#include <thread>
 
 OpenCVCamera::OpenCVCamera() 
     : cameraThredRunning(false),
       message(MSG_NONE) {
 }
 
+OpenCVCamera::~OpenCVCamera() {
+  if (cameraThredRunning) message = MSG_STOP;
+  if (cameraThread.joinable()) cameraThread.join();
+}
+
 void OpenCVCamera::open(int width, int height) {
     if (cap.isOpened()) {
       std::cerr << "Camera already opened!" << std::endl;
@@ -109,57 +114,57 @@ if (cameraThredRunning) {
     std::cerr << "ERROR! Camera thread already running!" << std::endl;
     return;
 }
+// the thread of the last start(), already stopped
+if (cameraThread.joinable()) cameraThread.join();
 cameraThredRunning = true;
+glContext = context;
+textureName = texture_name;
+flTexture = texture;
+textureRegistrar = texture_registrar;
 
-std::thread camera_thread([](OpenCVCamera *me,
-            GdkGLContext* context,
-            unsigned int texture_name,
-            g_autoptr(FlTexture) texture,
-            FlTextureRegistrar* texture_registrar) {
-    // cv::Mat frame;
-    for (;;) {
-      if (me->message == MSG_STOP) {
-        me->message = MSG_NONE;
-        me->cameraThredRunning = false;
-        return;
-      }
+// a thread of its own: the blocking reads would hold a scheduler worker
+cameraThread = std::thread([this]() {
+    pipelineTraceSetThreadName("camera");
+    while (captureFrame());
+});
+}
 
-      gdk_gl_context_make_current(context);
+bool OpenCVCamera::captureFrame() {
+  if (message == MSG_STOP) {
+    message = MSG_NONE;
+    cameraThredRunning = false;
+    return false;
+  }
+  gdk_gl_context_make_current(glContext);
 
-      me->cap.read(me->frame);
-      // if (me->frame.empty()) continue;
-      // if (me->message == MSG_GET_MAT_FRAME) {
-      //   me->currentFrame = me->frame;
-      //   me->message = MSG_NONE;
-      // }
+  {
+    STATS_SCOPE(STAGE_CAMERA_READ);
+    cap.read(frame);
+  }
+  // if (frame.empty()) continue;
+  // if (message == MSG_GET_MAT_FRAME) {
+  //   currentFrame = frame;
+  //   message = MSG_NONE;
+  // }
 
-      std::vector<uint8_t> buffer;
-      if (me->frame.isContinuous()) {
-          buffer.assign(me->frame.data, me->frame.data + me->frame.total() * me->frame.channels());
-      } else {
-          for (int i = 0; i < me->frame.rows; ++i) {
-              buffer.insert(
-                buffer.end(), 
-                me->frame.ptr<uchar>(i), 
-                me->frame.ptr<uchar>(i) + me->frame.cols * me->frame.channels());
-          }
+  std::vector<uint8_t> buffer;
+  if (frame.isContinuous()) {
+      buffer.assign(frame.data, frame.data + frame.total() * frame.channels());
+  } else {
+      for (int i = 0; i < frame.rows; ++i) {
+          buffer.insert(
+            buffer.end(), 
+            frame.ptr<uchar>(i), 
+            frame.ptr<uchar>(i) + frame.cols * frame.channels());
       }
+  }
 
-      glBindTexture(GL_TEXTURE_2D, texture_name); 
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, me->width, me->height, 
-              0, GL_BGR, GL_UNSIGNED_BYTE, buffer.data());
-      fl_texture_registrar_mark_texture_frame_available(texture_registrar, texture);
-      gdk_gl_context_clear_current();
-    }
-  },
-    this,
-    context,
-    texture_name,
-    texture,
-    texture_registrar);
-    
-  camera_thread.detach();
-
+  glBindTexture(GL_TEXTURE_2D, textureName); 
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 
+          0, GL_BGR, GL_UNSIGNED_BYTE, buffer.data());
+  fl_texture_registrar_mark_texture_frame_available(textureRegistrar, flTexture);
+  gdk_gl_context_clear_current();
+  return true;
 }
 
 cv::Mat OpenCVCamera::getCurrentMatFrame() {
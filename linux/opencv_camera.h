@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <atomic>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/video/video.hpp>
@@ -17,6 +18,7 @@ class OpenCVCamera {
 
 public:
     OpenCVCamera();
+    ~OpenCVCamera();
     void open(int width, int height);
     cv::Mat getNewFrame();
     void start(GdkGLContext* context,
@@ -30,11 +32,20 @@ public:
     std::atomic<CameraMsg> message;
 
 private:
+    // read, upload and publish one frame, false once stopped
+    bool captureFrame();
+
     cv::Mat frame;
-    bool cameraThredRunning;
+    std::atomic<bool> cameraThredRunning;
     cv::VideoCapture cap;
     int width;
     int height;
+    GdkGLContext* glContext = nullptr;
+    unsigned int textureName = 0;
+    FlTexture* flTexture = nullptr;
+    FlTextureRegistrar* textureRegistrar = nullptr;
+    // blocked ~33 ms a frame in cap.read(): not a scheduler worker
+    std::thread cameraThread;
 };
 
 #endif //OPENCV_CAMERA_H
\ No newline at end of file